@@ -0,0 +1,114 @@
+/**
+ * \file append_bench.c
+ * \date October 2026
+ *
+ * A log file that is only ever appended to, run in a directory (normally a
+ * mount point).  Records of a fixed size are appended, each with a write of
+ * its own, until the file reaches the given size; the rate is printed for
+ * every tenth of the way.  Where each version is a copy of the file the rate
+ * falls as the file grows; where a version costs only the bytes appended it
+ * stays flat.
+ *
+ * In a versfs mount the blocks taken by the log's history (under
+ * /.versfs/history) are then printed next to the size of the log.
+ *
+ * USAGE: append_bench <directory> [ file MiB ] [ record KiB ]
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Bytes of disk taken by the files in dir, or -1 if it cannot be read. */
+static long long disk_use (const char* dir) {
+  char path[4096 + 256];
+  struct dirent* de;
+  struct stat st;
+  long long total = 0;
+  DIR* dp = opendir(dir);
+
+  if (dp == NULL)
+    return -1;
+  while ((de = readdir(dp)) != NULL) {
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    if (de->d_name[0] != '.' && stat(path, &st) == 0)
+      total += (long long) st.st_blocks * 512;
+  }
+  closedir(dp);
+  return total;
+}
+
+int main (int argc, char* argv[]) {
+  char path[4096];
+  char* record;
+  long long size, step, done = 0, use;
+  size_t rec_size;
+  double start, split;
+  int fd, tenth = 1;
+
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "USAGE: %s <directory> [ file MiB ] [ record KiB ]\n",
+	    argv[0]);
+    return 1;
+  }
+  size = (argc > 2 ? atoll(argv[2]) : 64) * 1024 * 1024;
+  rec_size = (argc > 3 ? atoi(argv[3]) : 64) * 1024;
+  if (size <= 0 || rec_size == 0) {
+    fprintf(stderr, "ERROR: sizes must be positive\n");
+    return 1;
+  }
+  record = malloc(rec_size);
+  if (record == NULL)
+    return 1;
+  memset(record, 'l', rec_size);
+
+  snprintf(path, sizeof(path), "%s/append.log", argv[1]);
+  unlink(path);
+  fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  step = size / 10;
+  start = split = now();
+  while (done < size) {
+    if (write(fd, record, rec_size) != (ssize_t) rec_size) {
+      fprintf(stderr, "ERROR: append at %lld: %s\n", done, strerror(errno));
+      close(fd);
+      return 1;
+    }
+    done += rec_size;
+    if (done >= tenth * step) {
+      double t = now();
+      printf("%7.1f MiB  %9.0f appends/s\n", done / 1048576.0,
+	     (double) step / rec_size / (t - split));
+      split = t;
+      tenth += 1;
+    }
+  }
+  close(fd);
+  printf("total      %9.0f appends/s\n", done / rec_size / (now() - start));
+
+  snprintf(path, sizeof(path), "%s/.versfs/history/append.log", argv[1]);
+  use = disk_use(path);
+  if (use >= 0)
+    printf("history    %.1f MiB on disk for a %.1f MiB log\n",
+	   use / 1048576.0, done / 1048576.0);
+  free(record);
+  return 0;
+}
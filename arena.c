@@ -0,0 +1,133 @@
+/**
+ * \file arena.c
+ * \date October 2026
+ *
+ * Each thread's arena is one block, used from the start.  What does not
+ * fit goes in blocks of its own from the heap, kept on a list with the
+ * position they stand for; once the arena is empty again the main block is
+ * regrown to the most that was needed at once, up to ARENA_KEEP, so the
+ * next round fits in it.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+struct overflow {
+	size_t           at;		/* position of the block in the arena */
+	struct overflow *next;
+	/* The memory follows, aligned. */
+};
+
+#define OVERFLOW_HEAD \
+	((sizeof(struct overflow) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+struct arena {
+	char            *base;
+	size_t           size;
+	size_t           used;		/* including overflow blocks */
+	size_t           peak;		/* most used since base was sized */
+	struct overflow *overflow;	/* newest first */
+};
+
+static pthread_key_t  arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+static void arena_free(void *arg)
+{
+	struct arena *a = arg;
+	struct overflow *o, *next;
+
+	for (o = a->overflow; o != NULL; o = next) {
+		next = o->next;
+		free(o);
+	}
+	free(a->base);
+	free(a);
+}
+
+static void arena_key_create(void)
+{
+	pthread_key_create(&arena_key, arena_free);
+}
+
+static struct arena *this_arena(void)
+{
+	struct arena *a;
+
+	pthread_once(&arena_once, arena_key_create);
+	a = pthread_getspecific(arena_key);
+	if (a == NULL) {
+		a = calloc(1, sizeof(*a));
+		if (a != NULL)
+			pthread_setspecific(arena_key, a);
+	}
+	return a;
+}
+
+size_t arena_mark(void)
+{
+	struct arena *a = this_arena();
+
+	return a == NULL ? 0 : a->used;
+}
+
+void arena_release(size_t mark)
+{
+	struct arena *a = this_arena();
+	struct overflow *o;
+	size_t want;
+
+	if (a == NULL)
+		return;
+	while ((o = a->overflow) != NULL && o->at >= mark) {
+		a->overflow = o->next;
+		free(o);
+	}
+	a->used = mark;
+	if (mark != 0 || a->peak <= a->size)
+		return;
+
+	// Empty, and something overflowed: make room for it next time.
+	want = a->peak < ARENA_KEEP ? a->peak : ARENA_KEEP;
+	if (want > a->size) {
+		char *base = malloc(want);
+		if (base != NULL) {
+			free(a->base);
+			a->base = base;
+			a->size = want;
+		}
+	}
+	a->peak = a->size;
+}
+
+void *arena_alloc(size_t size)
+{
+	struct arena *a = this_arena();
+	struct overflow *o;
+	void *p;
+
+	if (a == NULL)
+		return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+	if (size == 0)
+		size = ARENA_ALIGN;
+
+	if (a->overflow == NULL && a->used + size <= a->size) {
+		p = a->base + a->used;
+	} else {
+		o = malloc(OVERFLOW_HEAD + size);
+		if (o == NULL)
+			return NULL;
+		o->at = a->used;
+		o->next = a->overflow;
+		a->overflow = o;
+		p = (char *) o + OVERFLOW_HEAD;
+	}
+	a->used += size;
+	if (a->used > a->peak)
+		a->peak = a->used;
+	return p;
+}
@@ -0,0 +1,34 @@
+/**
+ * \file arena.h
+ * \date October 2026
+ *
+ * Per-thread scratch memory.  Each thread has a bump arena: allocating is
+ * moving a pointer, and everything allocated since a mark is given back at
+ * once by releasing to it.  An operation takes a mark on entry and releases
+ * it on the way out, so the arena is empty between requests and a FUSE
+ * thread makes no heap allocations for scratch space once its arena has
+ * grown to what its requests need.  Memory is kept only up to ARENA_KEEP
+ * bytes per thread, and freed when the thread exits.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* The most an idle arena holds on to; larger requests are served from the
+   heap and given back on release. */
+#define ARENA_KEEP (2 * 1024 * 1024)
+
+/* Where the arena is now, to release to later. */
+size_t arena_mark(void);
+
+/* Free everything allocated since mark was taken.  Marks are released in
+   the reverse order of taking them. */
+void arena_release(size_t mark);
+
+/* size bytes, aligned for any type, valid until the release of a mark
+   taken before.  NULL if out of memory. */
+void *arena_alloc(size_t size);
+
+#endif /* ARENA_H */
@@ -0,0 +1,102 @@
+/**
+ * \file attrcache.c
+ * \date October 2026
+ *
+ * The attribute cache: a direct-mapped table of slots indexed by a hash of
+ * the path, so a put simply replaces whatever was in its slot.  Slots are
+ * locked in stripes.  Invalidation bumps a generation number instead of
+ * touching the table; entries stored under an older generation are ignored.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "attrcache.h"
+
+#define ATTRCACHE_SLOTS   16384
+#define ATTRCACHE_STRIPES 64
+
+struct slot {
+	char           *path;
+	unsigned        hash;
+	unsigned        generation;
+	long long       expires_ms;
+	struct stat     st;
+};
+
+static struct slot      slots[ATTRCACHE_SLOTS];
+static pthread_mutex_t  stripes[ATTRCACHE_STRIPES] = {
+	[0 ... ATTRCACHE_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+static unsigned         generation = 0;
+
+static unsigned hash_path(const char *path)
+{
+	unsigned h = 2166136261u;
+
+	while (*path != '\0')
+		h = (h ^ (unsigned char) *path++) * 16777619u;
+	return h;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+unsigned attrcache_generation(void)
+{
+	return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+void attrcache_put(const char *path, const struct stat *st, unsigned gen)
+{
+	unsigned h = hash_path(path);
+	struct slot *s = &slots[h % ATTRCACHE_SLOTS];
+	pthread_mutex_t *lock = &stripes[h % ATTRCACHE_STRIPES];
+	char *copy = strdup(path);
+
+	pthread_mutex_lock(lock);
+	free(s->path);
+	s->path = copy;
+	s->hash = h;
+	s->generation = gen;
+	s->expires_ms = now_ms() + ATTRCACHE_TTL_MS;
+	s->st = *st;
+	pthread_mutex_unlock(lock);
+}
+
+int attrcache_take(const char *path, struct stat *st)
+{
+	unsigned h = hash_path(path);
+	struct slot *s = &slots[h % ATTRCACHE_SLOTS];
+	pthread_mutex_t *lock = &stripes[h % ATTRCACHE_STRIPES];
+	char *old = NULL;
+	int res = -1;
+
+	pthread_mutex_lock(lock);
+	if (s->path != NULL && s->hash == h && strcmp(s->path, path) == 0) {
+		if (s->generation == attrcache_generation() &&
+		    s->expires_ms > now_ms()) {
+			*st = s->st;
+			res = 0;
+		}
+		old = s->path;
+		s->path = NULL;
+	}
+	pthread_mutex_unlock(lock);
+
+	free(old);
+	return res;
+}
+
+void attrcache_invalidate(void)
+{
+	__atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+}
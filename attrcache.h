@@ -0,0 +1,40 @@
+/**
+ * \file attrcache.h
+ * \date October 2026
+ *
+ * A short-lived cache of file attributes gathered while listing directories.
+ * readdir already has every entry's attributes at hand (one fstatat() against
+ * the open directory), so it parks them here; the getattr that the kernel
+ * sends for each entry straight afterwards (ls -l, find) then takes them
+ * instead of walking the path again with lstat().
+ *
+ * Each cached entry is used at most once and only within ATTRCACHE_TTL_MS of
+ * being stored.  Any change to the tree must call attrcache_invalidate() once
+ * it is done, which drops everything cached so far.
+ */
+
+#ifndef ATTRCACHE_H
+#define ATTRCACHE_H
+
+#include <sys/stat.h>
+
+#define ATTRCACHE_TTL_MS 1000
+
+/* The current generation.  Take it before gathering attributes and pass it
+   to attrcache_put(), so that attributes read before a concurrent change are
+   not cached as current. */
+unsigned attrcache_generation(void);
+
+/* Remember the attributes of path (a path in the mount point), gathered
+   during generation. */
+void attrcache_put(const char *path, const struct stat *st,
+		   unsigned generation);
+
+/* Copy out and drop the attributes cached for path.  Returns 0 on a hit and
+   -1 if there is no current entry. */
+int attrcache_take(const char *path, struct stat *st);
+
+/* Forget everything cached so far. */
+void attrcache_invalidate(void);
+
+#endif /* ATTRCACHE_H */
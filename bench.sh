@@ -0,0 +1,75 @@
+#!/bin/sh
+# Sequential throughput benchmark for mirrorfs, caesarfs and versfs.
+#
+# Each file system is mounted once per request-size setting, a file is
+# written and read back with dd, and the results are appended to
+# bench_output.txt.  For versfs the number of versions left behind by the
+# single logical write is reported as well.  versfs keeps a full copy per
+# write request, so it is run with a smaller file (VERS_SIZE_MB).  Mount
+# options in EXTRA_OPTS are added to every mount, e.g. no_splice_write to
+# measure without splicing, or splice_read to splice writes as well.
+#
+# USAGE: sh bench.sh [ size in MiB ] [ file system ... ]
+
+SIZE_MB=${1:-256}
+VERS_SIZE_MB=${VERS_SIZE_MB:-4}
+EXTRA_OPTS=${EXTRA_OPTS:-}
+[ $# -gt 0 ] && shift
+FILESYSTEMS=${*:-"mirrorfs caesarfs versfs"}
+SETTINGS="4096 32768 131072 1048576"
+
+STG=${PWD}/bench_stg
+MNT=${PWD}/bench_mnt
+OUT=${PWD}/bench_output.txt
+
+# Pull the rate (e.g. "812 MB/s") out of the last line dd prints.
+dd_rate () {
+  tail -n 1 | awk -F, '{ gsub(/^ +/, "", $NF); print $NF }'
+}
+
+mount_fs () {
+  fs=$1
+  opts=$2
+  if [ "$fs" = "caesarfs" ]; then
+    ./$fs "$STG" "$MNT" 3 -o "$opts"
+  else
+    ./$fs "$STG" "$MNT" -o "$opts"
+  fi
+  sleep 1
+}
+
+count_versions () {
+  if [ -d "$STG/.versfs/history/bench.dat" ]; then
+    find "$STG/.versfs/history/bench.dat" -mindepth 2 -type f -name '[0-9]*' | wc -l
+  else
+    echo "-"
+  fi
+}
+
+echo "# $(date) size=${SIZE_MB}MiB versfs_size=${VERS_SIZE_MB}MiB opts=${EXTRA_OPTS:--}" >> "$OUT"
+printf "%-10s %-10s %-14s %-14s %s\n" fs max_write write read versions | tee -a "$OUT"
+
+for fs in $FILESYSTEMS; do
+  for w in $SETTINGS; do
+    rm -rf "$STG" "$MNT"
+    mkdir -p "$STG" "$MNT"
+    opts="max_write=$w,max_read=$w,max_readahead=$w${EXTRA_OPTS:+,$EXTRA_OPTS}"
+    count=$SIZE_MB
+    [ "$fs" = "versfs" ] && count=$VERS_SIZE_MB
+
+    mount_fs $fs $opts
+    wr=$(dd if=/dev/zero of="$MNT/bench.dat" bs=1M count=$count conv=fsync 2>&1 | dd_rate)
+    fusermount -u "$MNT"
+
+    # Remount so the read is not served from the page cache.
+    mount_fs $fs $opts
+    rd=$(dd if="$MNT/bench.dat" of=/dev/null bs=1M 2>&1 | dd_rate)
+    fusermount -u "$MNT"
+
+    vers="-"
+    [ "$fs" = "versfs" ] && vers=$(count_versions)
+    printf "%-10s %-10s %-14s %-14s %s\n" $fs $w "$wr" "$rd" "$vers" | tee -a "$OUT"
+  done
+done
+
+rm -rf "$STG" "$MNT"
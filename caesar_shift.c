@@ -0,0 +1,298 @@
+/**
+ * \file caesar_shift.c
+ * \date October 2026
+ *
+ * Scalar, SSE2 and AVX2 versions of the Caesar byte shift.  The fastest one
+ * the CPU supports is picked once, before main() runs; caesar_shift() then
+ * costs a single indirect call per buffer.  Large buffers can additionally be
+ * spread over a small pool of worker threads.
+ */
+
+#include <pthread.h>
+#include "caesar_shift.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef void (*shift_fn)(unsigned char *, const unsigned char *, size_t,
+			 unsigned char);
+
+static void shift_scalar(unsigned char *dst, const unsigned char *src,
+			 size_t n, unsigned char key)
+{
+	size_t i;
+
+	// Unsigned arithmetic wraps, which is exactly the modulo 256 we want.
+	for (i = 0; i < n; i += 1)
+		dst[i] = (unsigned char) (src[i] + key);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static void shift_sse2(unsigned char *dst, const unsigned char *src,
+		       size_t n, unsigned char key)
+{
+	const __m128i k = _mm_set1_epi8((char) key);
+	size_t i = 0;
+
+	for (; i + 64 <= n; i += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i b = _mm_loadu_si128((const __m128i *) (src + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *) (src + i + 48));
+		_mm_storeu_si128((__m128i *) (dst + i),      _mm_add_epi8(a, k));
+		_mm_storeu_si128((__m128i *) (dst + i + 16), _mm_add_epi8(b, k));
+		_mm_storeu_si128((__m128i *) (dst + i + 32), _mm_add_epi8(c, k));
+		_mm_storeu_si128((__m128i *) (dst + i + 48), _mm_add_epi8(d, k));
+	}
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_add_epi8(a, k));
+	}
+	shift_scalar(dst + i, src + i, n - i, key);
+}
+
+__attribute__((target("avx2")))
+static void shift_avx2(unsigned char *dst, const unsigned char *src,
+		       size_t n, unsigned char key)
+{
+	const __m256i k = _mm256_set1_epi8((char) key);
+	size_t i = 0;
+
+	for (; i + 128 <= n; i += 128) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i *) (src + i + 64));
+		__m256i d = _mm256_loadu_si256((const __m256i *) (src + i + 96));
+		_mm256_storeu_si256((__m256i *) (dst + i),      _mm256_add_epi8(a, k));
+		_mm256_storeu_si256((__m256i *) (dst + i + 32), _mm256_add_epi8(b, k));
+		_mm256_storeu_si256((__m256i *) (dst + i + 64), _mm256_add_epi8(c, k));
+		_mm256_storeu_si256((__m256i *) (dst + i + 96), _mm256_add_epi8(d, k));
+	}
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+		_mm256_storeu_si256((__m256i *) (dst + i), _mm256_add_epi8(a, k));
+	}
+	// Let the SSE2 version take care of the last 0-31 bytes.
+	shift_sse2(dst + i, src + i, n - i, key);
+}
+#endif /* HAVE_X86_SIMD */
+
+static const char *impl_names[CAESAR_NUM_IMPLS] = {
+	[CAESAR_SCALAR]	= "scalar",
+	[CAESAR_SSE2]	= "sse2",
+	[CAESAR_AVX2]	= "avx2",
+};
+
+static shift_fn         shift_impl = shift_scalar;
+static enum caesar_impl shift_impl_id = CAESAR_SCALAR;
+
+void caesar_shift(unsigned char *dst, const unsigned char *src, size_t n,
+		  unsigned char key)
+{
+	shift_impl(dst, src, n, key);
+}
+
+int caesar_shift_use(enum caesar_impl impl)
+{
+	shift_fn fn = NULL;
+
+	switch (impl) {
+	case CAESAR_SCALAR:
+		fn = shift_scalar;
+		break;
+#ifdef HAVE_X86_SIMD
+	case CAESAR_SSE2:
+		if (__builtin_cpu_supports("sse2"))
+			fn = shift_sse2;
+		break;
+	case CAESAR_AVX2:
+		if (__builtin_cpu_supports("avx2"))
+			fn = shift_avx2;
+		break;
+#endif
+	default:
+		break;
+	}
+	if (fn == NULL)
+		return -1;
+
+	shift_impl = fn;
+	shift_impl_id = impl;
+	return 0;
+}
+
+const char *caesar_shift_name(enum caesar_impl impl)
+{
+	if (impl < 0 || impl >= CAESAR_NUM_IMPLS)
+		return "unknown";
+	return impl_names[impl];
+}
+
+enum caesar_impl caesar_shift_current(void)
+{
+	return shift_impl_id;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Worker pool */
+
+#define POOL_MAX_THREADS 16
+#define POOL_QUEUE_LEN   64
+
+/* Pieces of one caesar_shift_parallel() call; the caller sleeps until all of
+   the pieces it queued have been shifted. */
+struct batch {
+	pthread_mutex_t lock;
+	pthread_cond_t  done;
+	int             pending;
+};
+
+struct piece {
+	unsigned char       *dst;
+	const unsigned char *src;
+	size_t               n;
+	unsigned char        key;
+	struct batch        *batch;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  nonempty;
+	struct piece    queue[POOL_QUEUE_LEN];
+	int             head;
+	int             count;
+	int             stopping;
+	int             nthreads;
+	pthread_t       threads[POOL_MAX_THREADS];
+} pool = {
+	.lock     = PTHREAD_MUTEX_INITIALIZER,
+	.nonempty = PTHREAD_COND_INITIALIZER,
+};
+
+static void *pool_worker(void *arg)
+{
+	struct piece piece;
+
+	(void) arg;
+	for (;;) {
+		pthread_mutex_lock(&pool.lock);
+		while (pool.count == 0 && !pool.stopping)
+			pthread_cond_wait(&pool.nonempty, &pool.lock);
+		if (pool.count == 0) {
+			pthread_mutex_unlock(&pool.lock);
+			return NULL;
+		}
+		piece = pool.queue[pool.head];
+		pool.head = (pool.head + 1) % POOL_QUEUE_LEN;
+		pool.count -= 1;
+		pthread_mutex_unlock(&pool.lock);
+
+		caesar_shift(piece.dst, piece.src, piece.n, piece.key);
+
+		pthread_mutex_lock(&piece.batch->lock);
+		if (--piece.batch->pending == 0)
+			pthread_cond_signal(&piece.batch->done);
+		pthread_mutex_unlock(&piece.batch->lock);
+	}
+}
+
+void caesar_shift_parallel(unsigned char *dst, const unsigned char *src,
+			   size_t n, unsigned char key)
+{
+	struct batch batch;
+	size_t chunk, pos;
+	int pieces;
+
+	pieces = pool.nthreads + 1;
+	if (n < CAESAR_PARALLEL_MIN || pieces == 1) {
+		caesar_shift(dst, src, n, key);
+		return;
+	}
+
+	// One piece per worker plus one for this thread, each a whole number
+	// of cache lines so that no two threads write the same line.
+	chunk = (n / pieces + 63) & ~(size_t) 63;
+
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.done, NULL);
+	batch.pending = 0;
+
+	// Queue every piece but the first.  Workers cannot take any of them
+	// before the pool lock is dropped, so pending is final by then.  If
+	// the queue is full (other requests are using the pool), the rest is
+	// left for this thread.
+	pthread_mutex_lock(&pool.lock);
+	for (pos = chunk; pos < n && pool.count < POOL_QUEUE_LEN; pos += chunk) {
+		int tail = (pool.head + pool.count) % POOL_QUEUE_LEN;
+		pool.queue[tail].dst   = dst + pos;
+		pool.queue[tail].src   = src + pos;
+		pool.queue[tail].n     = n - pos < chunk ? n - pos : chunk;
+		pool.queue[tail].key   = key;
+		pool.queue[tail].batch = &batch;
+		pool.count += 1;
+		batch.pending += 1;
+	}
+	pthread_cond_broadcast(&pool.nonempty);
+	pthread_mutex_unlock(&pool.lock);
+
+	caesar_shift(dst, src, chunk < n ? chunk : n, key);
+	if (pos < n)
+		caesar_shift(dst + pos, src + pos, n - pos, key);
+
+	pthread_mutex_lock(&batch.lock);
+	while (batch.pending > 0)
+		pthread_cond_wait(&batch.done, &batch.lock);
+	pthread_mutex_unlock(&batch.lock);
+
+	pthread_cond_destroy(&batch.done);
+	pthread_mutex_destroy(&batch.lock);
+}
+
+int caesar_shift_start_workers(int nthreads)
+{
+	if (pool.nthreads != 0 || nthreads <= 0)
+		return -1;
+	if (nthreads > POOL_MAX_THREADS)
+		nthreads = POOL_MAX_THREADS;
+
+	pool.stopping = 0;
+	while (pool.nthreads < nthreads) {
+		if (pthread_create(&pool.threads[pool.nthreads], NULL,
+				   pool_worker, NULL) != 0)
+			break;
+		pool.nthreads += 1;
+	}
+	return pool.nthreads == nthreads ? 0 : -1;
+}
+
+void caesar_shift_stop_workers(void)
+{
+	int i, nthreads = pool.nthreads;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.stopping = 1;
+	pthread_cond_broadcast(&pool.nonempty);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < nthreads; i += 1)
+		pthread_join(pool.threads[i], NULL);
+	pool.nthreads = 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+__attribute__((constructor))
+static void caesar_shift_select(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+#endif
+	if (caesar_shift_use(CAESAR_AVX2) == 0)
+		return;
+	if (caesar_shift_use(CAESAR_SSE2) == 0)
+		return;
+	caesar_shift_use(CAESAR_SCALAR);
+}
@@ -0,0 +1,54 @@
+/**
+ * \file caesar_shift.h
+ * \date October 2026
+ *
+ * The byte transform behind caesarfs: every byte of a buffer is shifted by a
+ * fixed key, modulo 256.  A vectorized implementation is selected at start-up
+ * according to what the CPU supports, with a portable scalar fallback.
+ */
+
+#ifndef CAESAR_SHIFT_H
+#define CAESAR_SHIFT_H
+
+#include <stddef.h>
+
+enum caesar_impl {
+	CAESAR_SCALAR,
+	CAESAR_SSE2,
+	CAESAR_AVX2,
+	CAESAR_NUM_IMPLS
+};
+
+/* Store src[i] + key (mod 256) into dst[i] for the n bytes at src.  dst may
+   be the same buffer as src, in which case the shift happens in place. */
+void caesar_shift(unsigned char *dst, const unsigned char *src, size_t n,
+		  unsigned char key);
+
+/* Buffers of at least this many bytes are split across the worker pool. */
+#define CAESAR_PARALLEL_MIN (256 * 1024)
+
+/* Like caesar_shift(), but a large buffer is cut into cache-line aligned
+   pieces that the worker pool and the calling thread shift concurrently.
+   Without a pool, or for small buffers, this is just caesar_shift(). */
+void caesar_shift_parallel(unsigned char *dst, const unsigned char *src,
+			   size_t n, unsigned char key);
+
+/* Start nthreads worker threads for caesar_shift_parallel().  Returns 0, or
+   -1 if the pool is already running or the threads cannot be created.  Call
+   it after the process has daemonized: threads do not survive fork(). */
+int caesar_shift_start_workers(int nthreads);
+
+/* Stop and join the worker threads. */
+void caesar_shift_stop_workers(void);
+
+/* Switch to a particular implementation.  Returns 0 on success, -1 if the
+   CPU (or the compiler) does not support it. */
+int caesar_shift_use(enum caesar_impl impl);
+
+/* The name of an implementation, e.g. for benchmark output. */
+const char *caesar_shift_name(enum caesar_impl impl);
+
+/* The implementation currently in use. */
+enum caesar_impl caesar_shift_current(void);
+
+#endif /* CAESAR_SHIFT_H */
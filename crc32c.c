@@ -0,0 +1,78 @@
+/**
+ * \file crc32c.c
+ * \date October 2026
+ *
+ * Table-driven and SSE4.2 versions of CRC-32C, one of them chosen before
+ * main() runs.
+ */
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#define HAVE_X86_CRC32 1
+#include <immintrin.h>
+#endif
+
+/* The polynomial, bit-reversed. */
+#define CRC32C_POLY 0x82f63b78
+
+typedef uint32_t (*crc_fn)(uint32_t, const unsigned char *, size_t);
+
+static uint32_t table[256];
+
+static uint32_t crc_table(uint32_t crc, const unsigned char *p, size_t n)
+{
+	while (n-- > 0)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef HAVE_X86_CRC32
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+	uint64_t c = crc;
+	uint64_t word;
+
+	for (; n > 0 && ((uintptr_t) p & 7) != 0; n -= 1)
+		c = _mm_crc32_u8((uint32_t) c, *p++);
+	for (; n >= 8; n -= 8, p += 8) {
+		__builtin_memcpy(&word, p, 8);
+		c = _mm_crc32_u64(c, word);
+	}
+	for (; n > 0; n -= 1)
+		c = _mm_crc32_u8((uint32_t) c, *p++);
+	return (uint32_t) c;
+}
+#endif
+
+static crc_fn crc_impl = crc_table;
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t n)
+{
+	return ~crc_impl(~crc, buf, n);
+}
+
+int crc32c_hardware(void)
+{
+	return crc_impl != crc_table;
+}
+
+__attribute__((constructor))
+static void crc32c_select(void)
+{
+	uint32_t c;
+	int i, k;
+
+	for (i = 0; i < 256; i += 1) {
+		c = i;
+		for (k = 0; k < 8; k += 1)
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		table[i] = c;
+	}
+#ifdef HAVE_X86_CRC32
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		crc_impl = crc_sse42;
+#endif
+}
@@ -0,0 +1,24 @@
+/**
+ * \file crc32c.h
+ * \date October 2026
+ *
+ * CRC-32C (Castagnoli), the checksum of iSCSI, ext4 and btrfs metadata.  On
+ * x86 CPUs with SSE4.2 it is computed by the crc32 instruction, eight bytes
+ * at a time; elsewhere from a table.  The implementation is picked once at
+ * start-up.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Extend crc, the CRC-32C of some bytes (0 for none), by the n bytes at buf:
+   crc32c(crc32c(0, a, n), b, m) is the CRC of a followed by b. */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t n);
+
+/* Whether the hardware implementation is in use. */
+int crc32c_hardware(void);
+
+#endif /* CRC32C_H */
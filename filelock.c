@@ -0,0 +1,70 @@
+/**
+ * \file filelock.c
+ * \date October 2026
+ *
+ * A table of mutexes indexed by an FNV-1a hash of the path.  Each mutex
+ * has a cache line to itself, so that threads on different stripes do not
+ * slow each other down by sharing one.
+ */
+
+#include <pthread.h>
+#include "filelock.h"
+
+static struct stripe {
+	pthread_mutex_t lock;
+} __attribute__((aligned(64))) stripes[FILELOCK_STRIPES];
+
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+static void init_stripes(void)
+{
+	unsigned i;
+
+	for (i = 0; i < FILELOCK_STRIPES; i += 1)
+		pthread_mutex_init(&stripes[i].lock, NULL);
+}
+
+static unsigned stripe_of(const char *path)
+{
+	unsigned h = 2166136261u;
+
+	for (; *path != '\0'; path += 1)
+		h = (h ^ (unsigned char) *path) * 16777619u;
+	return h % FILELOCK_STRIPES;
+}
+
+void filelock_lock(const char *path)
+{
+	pthread_once(&stripes_once, init_stripes);
+	pthread_mutex_lock(&stripes[stripe_of(path)].lock);
+}
+
+void filelock_unlock(const char *path)
+{
+	pthread_mutex_unlock(&stripes[stripe_of(path)].lock);
+}
+
+void filelock_lock2(const char *a, const char *b)
+{
+	unsigned sa = stripe_of(a), sb = stripe_of(b);
+
+	pthread_once(&stripes_once, init_stripes);
+	// Lower stripe first, as every thread does.
+	if (sa > sb) {
+		unsigned t = sa;
+		sa = sb;
+		sb = t;
+	}
+	pthread_mutex_lock(&stripes[sa].lock);
+	if (sb != sa)
+		pthread_mutex_lock(&stripes[sb].lock);
+}
+
+void filelock_unlock2(const char *a, const char *b)
+{
+	unsigned sa = stripe_of(a), sb = stripe_of(b);
+
+	pthread_mutex_unlock(&stripes[sa].lock);
+	if (sb != sa)
+		pthread_mutex_unlock(&stripes[sb].lock);
+}
@@ -0,0 +1,34 @@
+/**
+ * \file filelock.h
+ * \date October 2026
+ *
+ * Per-file locks for the version store.  Committing a version reads and
+ * bumps the history's counter and copies the file, so two threads
+ * committing the same file at once could both claim one version number, or
+ * store the versions out of order.  Each file's commits are serialised by
+ * a lock picked from a fixed table by a hash of the file's storage path;
+ * files that hash to different stripes never wait on each other, so a
+ * mount with many writers scales with the number of files being written
+ * rather than funnelling through one lock.
+ */
+
+#ifndef FILELOCK_H
+#define FILELOCK_H
+
+/* Stripes in the table: with many more stripes than FUSE threads, two
+   unrelated files rarely share one. */
+#define FILELOCK_STRIPES 1024
+
+/* Lock and unlock the file at the storage path path.  Not recursive: a
+   thread must not lock a file it already holds, nor a second file unless
+   through filelock_lock2(). */
+void filelock_lock(const char *path);
+void filelock_unlock(const char *path);
+
+/* Lock two files at once (for rename), in an order that cannot deadlock
+   against another thread doing the same.  Either may be the same file, or
+   share a stripe with, the other. */
+void filelock_lock2(const char *a, const char *b);
+void filelock_unlock2(const char *a, const char *b);
+
+#endif /* FILELOCK_H */
@@ -0,0 +1,369 @@
+/**
+ * \file fingerprint.c
+ * \date October 2026
+ *
+ * The fingerprint table: a hash table by path threaded on an LRU list, like
+ * the mapping cache's, under one lock.  A fingerprint being updated is out
+ * of the table altogether, so hashing happens without the lock.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "crc32c.h"
+#include "fingerprint.h"
+#include "iobackend.h"
+
+#define FP_BUCKETS 1024
+
+/* Files and bytes of block checksums kept: at 4 bytes per FP_BLOCK, the
+   default covers 256 GiB of files. */
+#define FP_MAX_FILES 4096
+#define FP_MAX_BYTES (16 * 1024 * 1024)
+
+/* Blocks are read back this many at a time. */
+#define FP_READ (16 * FP_BLOCK)
+
+struct fingerprint {
+	char               *path;
+	int                 vers_num;
+	dev_t               dev;
+	ino_t               ino;
+	off_t               size;	/* -1 until the first update */
+	size_t              nblocks;
+	size_t              cap;
+	uint32_t           *crc;
+	int                 dirty;	/* behind the file; see fp_mark_dirty() */
+	struct fingerprint *hash_next;
+	struct fingerprint *lru_prev;
+	struct fingerprint *lru_next;
+};
+
+static pthread_mutex_t     table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fingerprint *buckets[FP_BUCKETS];
+/* Most recently used at the head. */
+static struct fingerprint *lru_head = NULL;
+static struct fingerprint *lru_tail = NULL;
+static size_t              num_files = 0;
+static size_t              num_bytes = 0;
+static unsigned long long  hashed = 0;
+
+static const unsigned char zeros[FP_BLOCK];
+
+static unsigned hash_path(const char *path)
+{
+	unsigned h = 5381;
+
+	while (*path != '\0')
+		h = h * 33 + (unsigned char) *path++;
+	return h % FP_BUCKETS;
+}
+
+static void lru_unlink(struct fingerprint *fp)
+{
+	if (fp->lru_prev != NULL)
+		fp->lru_prev->lru_next = fp->lru_next;
+	else
+		lru_head = fp->lru_next;
+	if (fp->lru_next != NULL)
+		fp->lru_next->lru_prev = fp->lru_prev;
+	else
+		lru_tail = fp->lru_prev;
+	fp->lru_prev = fp->lru_next = NULL;
+}
+
+/* Take fp out of the table and the LRU list. */
+static void table_remove(struct fingerprint *fp)
+{
+	struct fingerprint **pp = &buckets[hash_path(fp->path)];
+
+	while (*pp != fp)
+		pp = &(*pp)->hash_next;
+	*pp = fp->hash_next;
+	fp->hash_next = NULL;
+	lru_unlink(fp);
+	num_files -= 1;
+	num_bytes -= fp->cap * sizeof(uint32_t);
+}
+
+static struct fingerprint *table_find(const char *path)
+{
+	struct fingerprint *fp;
+
+	for (fp = buckets[hash_path(path)]; fp != NULL; fp = fp->hash_next)
+		if (strcmp(fp->path, path) == 0)
+			return fp;
+	return NULL;
+}
+
+void fp_free(struct fingerprint *fp)
+{
+	if (fp == NULL)
+		return;
+	free(fp->path);
+	free(fp->crc);
+	free(fp);
+}
+
+struct fingerprint *fp_take(const char *path)
+{
+	struct fingerprint *fp;
+
+	pthread_mutex_lock(&table_lock);
+	fp = table_find(path);
+	if (fp != NULL)
+		table_remove(fp);
+	pthread_mutex_unlock(&table_lock);
+	return fp;
+}
+
+void fp_put(const char *path, struct fingerprint *fp, int vers_num)
+{
+	struct fingerprint *old, *evict = NULL;
+	char *copy = NULL;
+
+	if (fp->path == NULL || strcmp(fp->path, path) != 0) {
+		copy = strdup(path);
+		if (copy == NULL) {
+			fp_free(fp);
+			return;
+		}
+		free(fp->path);
+		fp->path = copy;
+	}
+	fp->vers_num = vers_num;
+
+	pthread_mutex_lock(&table_lock);
+	old = table_find(path);
+	if (old != NULL)
+		table_remove(old);
+	fp->hash_next = buckets[hash_path(path)];
+	buckets[hash_path(path)] = fp;
+	fp->lru_prev = NULL;
+	fp->lru_next = lru_head;
+	if (lru_head != NULL)
+		lru_head->lru_prev = fp;
+	lru_head = fp;
+	if (lru_tail == NULL)
+		lru_tail = fp;
+	num_files += 1;
+	num_bytes += fp->cap * sizeof(uint32_t);
+
+	// Evicted fingerprints are chained on hash_next, to be freed
+	// without the lock.
+	while (lru_tail != fp &&
+	       (num_files > FP_MAX_FILES || num_bytes > FP_MAX_BYTES)) {
+		struct fingerprint *victim = lru_tail;
+		table_remove(victim);
+		victim->hash_next = evict;
+		evict = victim;
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	fp_free(old);
+	while (evict != NULL) {
+		old = evict->hash_next;
+		fp_free(evict);
+		evict = old;
+	}
+}
+
+int fp_version(const struct fingerprint *fp)
+{
+	return fp->vers_num;
+}
+
+void fp_mark_dirty(const char *path)
+{
+	struct fingerprint *fp;
+
+	pthread_mutex_lock(&table_lock);
+	fp = table_find(path);
+	if (fp != NULL)
+		fp->dirty = 1;
+	pthread_mutex_unlock(&table_lock);
+}
+
+int fp_dirty(const struct fingerprint *fp)
+{
+	return fp->dirty;
+}
+
+void fp_forget(const char *path)
+{
+	fp_free(fp_take(path));
+}
+
+void fp_forget_tree(const char *dir)
+{
+	struct fingerprint *fp, *next, *gone = NULL;
+	size_t len = strlen(dir);
+	int i;
+
+	pthread_mutex_lock(&table_lock);
+	for (i = 0; i < FP_BUCKETS; i += 1) {
+		for (fp = buckets[i]; fp != NULL; fp = next) {
+			next = fp->hash_next;
+			if (strncmp(fp->path, dir, len) == 0 &&
+			    fp->path[len] == '/') {
+				table_remove(fp);
+				fp->hash_next = gone;
+				gone = fp;
+			}
+		}
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	while (gone != NULL) {
+		next = gone->hash_next;
+		fp_free(gone);
+		gone = next;
+	}
+}
+
+/* Hash blocks [from, to) of the file open as fd, size bytes long, into
+   fp->crc.  Blocks below old_nblocks are compared with what was there.
+   Returns 1 if any differed, 0 if none did, or -errno. */
+static int hash_blocks(struct fingerprint *fp, int fd, off_t size,
+		       size_t old_nblocks, size_t from, size_t to)
+{
+	size_t mark = arena_mark();
+	unsigned char *buf = arena_alloc(FP_READ);
+	int changed = 0;
+
+	if (buf == NULL)
+		return -ENOMEM;
+	while (from < to) {
+		off_t off = (off_t) from * FP_BLOCK;
+		size_t want = (to - from) * (size_t) FP_BLOCK;
+		size_t done;
+		ssize_t res;
+
+		if (want > FP_READ)
+			want = FP_READ;
+		if (want > size - off)
+			want = size - off;
+		res = iob_pread(fd, buf, want, off);
+		if (res >= 0 && res != want)
+			res = -EIO;	/* Shorter than st_size said. */
+		if (res < 0) {
+			arena_release(mark);
+			return res;
+		}
+		for (done = 0; done < want; done += FP_BLOCK, from += 1) {
+			size_t n = want - done < FP_BLOCK ? want - done : FP_BLOCK;
+			uint32_t crc = crc32c(0, buf + done, n);
+			if (from >= old_nblocks || fp->crc[from] != crc)
+				changed = 1;
+			fp->crc[from] = crc;
+		}
+		__atomic_add_fetch(&hashed, want, __ATOMIC_RELAXED);
+	}
+	arena_release(mark);
+	return changed;
+}
+
+int fp_update(struct fingerprint **fpp, int fd, const struct stat *st,
+	      off_t off, off_t len)
+{
+	struct fingerprint *fp = *fpp;
+	off_t size = st->st_size;
+	off_t old_size;
+	size_t nblocks = (size + FP_BLOCK - 1) / FP_BLOCK;
+	size_t old_nblocks, b;
+	uint32_t zero_crc;
+	int changed, res;
+
+	if (fp == NULL) {
+		fp = calloc(1, sizeof(*fp));
+		if (fp == NULL) {
+			*fpp = NULL;
+			return -ENOMEM;
+		}
+		fp->size = -1;
+	}
+	// Another file under the same name (one renamed over it) is
+	// compared whole with what the old one held.
+	if (fp->dev != st->st_dev || fp->ino != st->st_ino) {
+		fp->dev = st->st_dev;
+		fp->ino = st->st_ino;
+		len = -1;
+	}
+	if (nblocks > fp->cap) {
+		size_t cap = nblocks + nblocks / 4;
+		uint32_t *crc = realloc(fp->crc, cap * sizeof(uint32_t));
+		if (crc == NULL) {
+			fp_free(fp);
+			*fpp = NULL;
+			return -ENOMEM;
+		}
+		fp->crc = crc;
+		fp->cap = cap;
+	}
+
+	old_size = fp->size;
+	old_nblocks = fp->nblocks;
+	changed = old_size != size;
+	if (old_size < 0) {
+		old_nblocks = 0;
+		len = -1;
+	}
+
+	if (len < 0) {
+		res = hash_blocks(fp, fd, size, old_nblocks, 0, nblocks);
+	} else {
+		res = 0;
+		if (old_size != size) {
+			// From the block the data used to end in (or now
+			// ends in) onwards, all may differ; whole blocks the
+			// file has grown by, unless written, are holes.
+			size_t lo = (old_size < size ? old_size : size) / FP_BLOCK;
+			size_t hole = (old_size + FP_BLOCK - 1) / FP_BLOCK;
+			if (hole > nblocks || old_size > size)
+				hole = nblocks;
+			res = hash_blocks(fp, fd, size, old_nblocks, lo, hole);
+			zero_crc = crc32c(0, zeros, FP_BLOCK);
+			for (b = hole; b < nblocks; b += 1)
+				fp->crc[b] = zero_crc;
+			if (hole < nblocks && size % FP_BLOCK != 0)
+				fp->crc[nblocks - 1] =
+					crc32c(0, zeros, size % FP_BLOCK);
+		}
+		if (res >= 0 && len > 0 && off < size) {
+			size_t to = (off + len + FP_BLOCK - 1) / FP_BLOCK;
+			res = hash_blocks(fp, fd, size, old_nblocks,
+					  off / FP_BLOCK, to < nblocks ? to : nblocks);
+		}
+	}
+	if (res < 0) {
+		fp_free(fp);
+		*fpp = NULL;
+		return res;
+	}
+
+	fp->size = size;
+	fp->nblocks = nblocks;
+	fp->dirty = 0;
+	*fpp = fp;
+	return changed || res;
+}
+
+size_t fp_blocks(const struct fingerprint *fp)
+{
+	return fp->nblocks;
+}
+
+uint32_t fp_block_crc(const struct fingerprint *fp, size_t i)
+{
+	return fp->crc[i];
+}
+
+unsigned long long fp_bytes_hashed(void)
+{
+	return __atomic_load_n(&hashed, __ATOMIC_RELAXED);
+}
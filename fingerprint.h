@@ -0,0 +1,74 @@
+/**
+ * \file fingerprint.h
+ * \date October 2026
+ *
+ * Content fingerprints of the newest version of files, to tell a write that
+ * changed a file from one that stored the bytes it already had.  A
+ * fingerprint is the CRC-32C (crc32c.h) of every FP_BLOCK bytes of the file,
+ * so after a write only the blocks it touched need hashing again, read back
+ * from the page cache, to know whether anything changed.
+ *
+ * Fingerprints are kept in memory only, by storage path, for a bounded
+ * number of files; a file without one (first written since mounting, or
+ * evicted) is hashed whole once.  The caller serialises the use of each
+ * file's fingerprint (in versfs, with the file's lock of filelock.h).
+ */
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define FP_BLOCK (64 * 1024)
+
+struct fingerprint;
+
+/* Take the fingerprint of the file at path out of the table, so that no
+   other thread can see it while it is updated.  NULL if there is none. */
+struct fingerprint *fp_take(const char *path);
+
+/* Put fp back as the fingerprint of path, describing its version vers_num.
+   Other files' fingerprints may be evicted to make room. */
+void fp_put(const char *path, struct fingerprint *fp, int vers_num);
+
+/* The version a fingerprint taken with fp_take() describes. */
+int fp_version(const struct fingerprint *fp);
+
+void fp_free(struct fingerprint *fp);
+
+/* Mark the fingerprint of path as behind the file: bytes of it changed
+   that no version holds yet, such as those waiting for the file's version
+   window (vwindow.h).  The next fp_update(), given a range that covers
+   them, brings it up to date again. */
+void fp_mark_dirty(const char *path);
+
+/* Non-zero if fp was marked behind its file since its last update. */
+int fp_dirty(const struct fingerprint *fp);
+
+/* Drop the fingerprint of path, e.g. when the file is gone or may have
+   changed without a version. */
+void fp_forget(const char *path);
+
+/* Drop the fingerprints of every file under the directory dir. */
+void fp_forget_tree(const char *dir);
+
+/* Bring *fp (or a new fingerprint, if *fp is NULL or of another file) up
+   to date with the file open as fd, whose attributes are st.  Besides any
+   change in length, only the bytes in [off, off + len) may have changed
+   since *fp was made; len -1 means any of them may have.  Returns 1 if the
+   contents differ from what *fp described, 0 if they are the same, or
+   -errno, in which case *fp is freed and NULL. */
+int fp_update(struct fingerprint **fp, int fd, const struct stat *st,
+	      off_t off, off_t len);
+
+/* The number of blocks of the file as of the last update, and the CRC-32C
+   of block i; only the last block can be shorter than FP_BLOCK. */
+size_t fp_blocks(const struct fingerprint *fp);
+uint32_t fp_block_crc(const struct fingerprint *fp, size_t i);
+
+/* Bytes hashed so far, for statistics. */
+unsigned long long fp_bytes_hashed(void);
+
+#endif /* FINGERPRINT_H */
@@ -0,0 +1,175 @@
+/**
+ * \file fsync_bench.c
+ * \date October 2026
+ *
+ * fsync-heavy workloads, run in a directory (normally a mount point):
+ *
+ *   wal  Each thread appends 4 KiB records to a file of its own and
+ *        fdatasync()s after every one, as a database's write-ahead log does.
+ *   pkg  Each thread installs 16 KiB files the way package managers do:
+ *        write a temporary file, fsync() it, rename it into place and
+ *        fsync() the directory.
+ *
+ * Each runs with one thread and then with the given number, so that the
+ * second shows how well concurrent syncs are batched.  Reported are
+ * operations per second and the median and 99th percentile latency of one
+ * operation (record plus sync, or whole install).
+ *
+ * USAGE: fsync_bench <directory> [ threads ] [ operations per thread ]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAL_RECORD 4096
+#define PKG_FILE   (16 * 1024)
+
+struct worker {
+  const char* dir;
+  int id;
+  int ops;
+  int fd;
+  int (*op) (struct worker* w, int i);
+  double* latency;
+  int failed;
+};
+
+static char payload[PKG_FILE];
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int wal_op (struct worker* w, int i) {
+  char path[4096];
+
+  if (i == 0) {
+    snprintf(path, sizeof(path), "%s/wal.%d", w->dir, w->id);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd == -1)
+      return -errno;
+  }
+  if (pwrite(w->fd, payload, WAL_RECORD, (off_t) i * WAL_RECORD) != WAL_RECORD ||
+      fdatasync(w->fd) == -1)
+    return -errno;
+  if (i == w->ops - 1)
+    close(w->fd);
+  return 0;
+}
+
+static int pkg_op (struct worker* w, int i) {
+  char tmp[4096];
+  char path[4096];
+  int fd;
+
+  snprintf(tmp, sizeof(tmp), "%s/pkg.%d.%d.tmp", w->dir, w->id, i);
+  snprintf(path, sizeof(path), "%s/pkg.%d.%d", w->dir, w->id, i);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return -errno;
+  if (write(fd, payload, PKG_FILE) != PKG_FILE || fsync(fd) == -1) {
+    close(fd);
+    return -errno;
+  }
+  if (close(fd) == -1 || rename(tmp, path) == -1)
+    return -errno;
+  fd = open(w->dir, O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    return -errno;
+  if (fsync(fd) == -1) {
+    close(fd);
+    return -errno;
+  }
+  close(fd);
+  return 0;
+}
+
+static void* worker_main (void* arg) {
+  struct worker* w = arg;
+
+  for (int i = 0; i < w->ops && !w->failed; i += 1) {
+    double start = now();
+    int res = w->op(w, i);
+    if (res < 0) {
+      fprintf(stderr, "ERROR: worker %d, operation %d: %s\n", w->id, i,
+	      strerror(-res));
+      w->failed = 1;
+    }
+    w->latency[i] = now() - start;
+  }
+  return NULL;
+}
+
+static int compare_doubles (const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+static int run (const char* name, int (*op) (struct worker*, int),
+		const char* dir, int threads, int ops) {
+  struct worker workers[threads];
+  pthread_t ids[threads];
+  double* latency = malloc(sizeof(double) * threads * ops);
+  double start, elapsed;
+  int failed = 0;
+
+  if (latency == NULL)
+    return 1;
+  start = now();
+  for (int t = 0; t < threads; t += 1) {
+    workers[t] = (struct worker) { dir, t, ops, -1, op, latency + t * ops, 0 };
+    if (pthread_create(&ids[t], NULL, worker_main, &workers[t]) != 0) {
+      fprintf(stderr, "ERROR: Cannot start thread %d\n", t);
+      exit(1);
+    }
+  }
+  for (int t = 0; t < threads; t += 1) {
+    pthread_join(ids[t], NULL);
+    failed |= workers[t].failed;
+  }
+  elapsed = now() - start;
+
+  qsort(latency, threads * ops, sizeof(double), compare_doubles);
+  printf("%-4s %3d threads %9.0f ops/s   p50 %7.3f ms   p99 %7.3f ms\n",
+	 name, threads, threads * ops / elapsed,
+	 latency[threads * ops / 2] * 1e3,
+	 latency[(size_t) (threads * ops * 0.99)] * 1e3);
+  free(latency);
+  return failed;
+}
+
+int main (int argc, char* argv[]) {
+  const char* dir;
+  int threads, ops, failed = 0;
+
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr,
+	    "USAGE: %s <directory> [ threads ] [ operations per thread ]\n",
+	    argv[0]);
+    return 1;
+  }
+  dir = argv[1];
+  threads = argc > 2 ? atoi(argv[2]) : 8;
+  ops = argc > 3 ? atoi(argv[3]) : 200;
+  if (threads < 1 || ops < 1) {
+    fprintf(stderr, "ERROR: threads and operations must be positive\n");
+    return 1;
+  }
+  memset(payload, 'w', sizeof(payload));
+
+  failed |= run("wal", wal_op, dir, 1, ops);
+  failed |= run("wal", wal_op, dir, threads, ops);
+  failed |= run("pkg", pkg_op, dir, 1, ops);
+  failed |= run("pkg", pkg_op, dir, threads, ops);
+  return failed;
+}
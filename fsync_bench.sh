@@ -0,0 +1,46 @@
+#!/bin/sh
+# fsync benchmark for mirrorfs, caesarfs and versfs.
+#
+# Runs fsync_bench (make fsync_bench) in a plain directory on the same file
+# system, as the baseline, and then in each file system mounted over an
+# empty storage directory.  The results are appended to bench_output.txt.
+#
+# USAGE: sh fsync_bench.sh [ threads ] [ operations per thread ] [ file system ... ]
+
+THREADS=${1:-8}
+OPS=${2:-200}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+FILESYSTEMS=${*:-"mirrorfs caesarfs versfs"}
+
+STG=${PWD}/bench_stg
+MNT=${PWD}/bench_mnt
+OUT=${PWD}/bench_output.txt
+
+mount_fs () {
+  fs=$1
+  if [ "$fs" = "caesarfs" ]; then
+    ./$fs "$STG" "$MNT" 3
+  else
+    ./$fs "$STG" "$MNT"
+  fi
+  sleep 1
+}
+
+echo "# $(date) fsync threads=$THREADS ops=$OPS" >> "$OUT"
+
+rm -rf "$STG"
+mkdir -p "$STG"
+echo "native" | tee -a "$OUT"
+./fsync_bench "$STG" $THREADS $OPS | tee -a "$OUT"
+
+for fs in $FILESYSTEMS; do
+  rm -rf "$STG" "$MNT"
+  mkdir -p "$STG" "$MNT"
+  mount_fs $fs
+  echo "$fs" | tee -a "$OUT"
+  ./fsync_bench "$MNT" $THREADS $OPS | tee -a "$OUT"
+  fusermount -u "$MNT"
+done
+
+rm -rf "$STG" "$MNT"
@@ -0,0 +1,139 @@
+/**
+ * \file gsync.c
+ * \date October 2026
+ *
+ * Leader/follower group commit.  Requests wait on a list under one lock; a
+ * thread that finds no batch running takes the whole list as its batch and
+ * syncs it without the lock, then hands every waiter its result.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "gsync.h"
+#include "iobackend.h"
+
+/* On the requester's stack. */
+struct request {
+	int             fd;
+	int             flags;
+	int             res;
+	int             done;
+	struct request *next;
+};
+
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sync_done = PTHREAD_COND_INITIALIZER;
+static struct request *waiting = NULL;
+static int             running = 0;
+
+/* Run the syncs of batch, filling in each request's res. */
+static void run_batch(struct request *batch)
+{
+	struct request *r, *s;
+	struct iob_op *ops;
+	struct stat st, other;
+	size_t mark = arena_mark();
+	int n = 0, i;
+
+	for (r = batch; r != NULL; r = r->next) {
+		r->res = 0;
+		n += 1;
+	}
+
+	// Whole file systems first, one syncfs() each.
+	for (r = batch; r != NULL; r = r->next) {
+		if (!(r->flags & GSYNC_FS) || fstat(r->fd, &st) == -1)
+			continue;
+		for (s = batch; s != r; s = s->next) {
+			if ((s->flags & GSYNC_FS) && fstat(s->fd, &other) == 0 &&
+			    other.st_dev == st.st_dev)
+				break;
+		}
+		if (s != r)
+			continue;	/* Already synced in this batch. */
+		if (syncfs(r->fd) == -1) {
+			int res = -errno;
+			for (s = batch; s != NULL; s = s->next) {
+				if ((s->flags & GSYNC_FS) && fstat(s->fd, &other) == 0 &&
+				    other.st_dev == st.st_dev)
+					s->res = res;
+			}
+		}
+	}
+
+	// Then every file, once: a descriptor asked for twice gets the
+	// stronger of the two syncs.  fsync() after syncfs() finds little left
+	// to write, but it is what reports write errors for that file.
+	ops = arena_alloc(n * sizeof(*ops));
+	if (ops == NULL) {
+		for (r = batch; r != NULL; r = r->next) {
+			if (r->res == 0 && ((r->flags & GSYNC_DATA) ? fdatasync(r->fd) :
+					    fsync(r->fd)) == -1)
+				r->res = -errno;
+		}
+		arena_release(mark);
+		return;
+	}
+	n = 0;
+	for (r = batch; r != NULL; r = r->next) {
+		for (i = 0; i < n && ops[i].fd != r->fd; i += 1)
+			;
+		if (i == n) {
+			ops[n].fd = r->fd;
+			ops[n].opcode = IOB_FDATASYNC;
+			ops[n].buf = NULL;
+			ops[n].len = 0;
+			ops[n].off = 0;
+			ops[n].link = 0;
+			n += 1;
+		}
+		if (!(r->flags & GSYNC_DATA))
+			ops[i].opcode = IOB_FSYNC;
+	}
+	iob_submit(ops, n);
+	for (r = batch; r != NULL; r = r->next) {
+		for (i = 0; ops[i].fd != r->fd; i += 1)
+			;
+		if (r->res == 0 && ops[i].res < 0)
+			r->res = ops[i].res;
+	}
+	arena_release(mark);
+}
+
+int gsync(int fd, int flags)
+{
+	struct request req = { fd, flags, 0, 0, NULL };
+	struct request *batch, *r, *next;
+
+	pthread_mutex_lock(&sync_lock);
+	req.next = waiting;
+	waiting = &req;
+	while (!req.done) {
+		if (running) {
+			pthread_cond_wait(&sync_done, &sync_lock);
+			continue;
+		}
+
+		// Lead: everything waiting now, this request included, is
+		// synced together.
+		batch = waiting;
+		waiting = NULL;
+		running = 1;
+		pthread_mutex_unlock(&sync_lock);
+		run_batch(batch);
+		pthread_mutex_lock(&sync_lock);
+		for (r = batch; r != NULL; r = next) {
+			next = r->next;
+			r->done = 1;
+		}
+		running = 0;
+		pthread_cond_broadcast(&sync_done);
+	}
+	pthread_mutex_unlock(&sync_lock);
+	return req.res;
+}
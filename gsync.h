@@ -0,0 +1,28 @@
+/**
+ * \file gsync.h
+ * \date October 2026
+ *
+ * Group commit for fsync().  Syncing the backing files costs a disk flush
+ * each; when several FUSE requests want one at the same time, the first
+ * thread to arrive becomes the leader and syncs everything that is waiting
+ * in one batch, while the rest wait for its results.  Requests that arrive
+ * during a batch go in the next one, so under load every flush serves many
+ * callers.  The syncs of a batch go out together through iob_submit(), so
+ * with io_uring the backing file system sees them at once and can fold them
+ * into one journal commit.
+ */
+
+#ifndef GSYNC_H
+#define GSYNC_H
+
+/* Sync only the data of the file, as fdatasync() does. */
+#define GSYNC_DATA 1
+/* Also sync the whole file system the file is on (syncfs()), once per batch
+   however many requests ask for it: for file systems whose state on disk
+   spans more files than the one being synced. */
+#define GSYNC_FS   2
+
+/* Sync the file open as fd.  Returns 0 or -errno. */
+int gsync(int fd, int flags);
+
+#endif /* GSYNC_H */
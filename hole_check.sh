@@ -0,0 +1,58 @@
+#!/bin/sh
+# Punch a hole in a versfs file and check what reads back.
+#
+# versfs is mounted once plain and once with a Caesar transform.  A file of
+# 64 KiB of 'a' is written, 8 KiB at 4 KiB is punched with fallocate, and
+# the file is read back after a remount.  Plain, the range must read as
+# zeros.  Through the transform, zeros in the storage file would not decode
+# to zeros, so the punch must be refused and the file left as it was.
+#
+# USAGE: sh hole_check.sh
+
+STG=${PWD}/hole_stg
+MNT=${PWD}/hole_mnt
+FAILED=0
+
+check () {
+  opts=$1
+  expect=$2
+  rm -rf "$STG" "$MNT"
+  mkdir -p "$STG" "$MNT"
+
+  ./versfs "$STG" "$MNT" ${opts:+-o "$opts"}
+  sleep 1
+  head -c 65536 /dev/zero | tr '\0' a > "$MNT/hole.dat"
+  if fallocate -p -o 4096 -l 8192 "$MNT/hole.dat" 2> /dev/null; then
+    punched=yes
+  else
+    punched=no
+  fi
+  fusermount -u "$MNT"
+
+  # Remount so the read is not served from the page cache.
+  ./versfs "$STG" "$MNT" ${opts:+-o "$opts"}
+  sleep 1
+  if [ $punched = yes ]; then
+    head -c 4096 /dev/zero | tr '\0' a > hole_expect.dat
+    head -c 8192 /dev/zero >> hole_expect.dat
+    head -c 53248 /dev/zero | tr '\0' a >> hole_expect.dat
+  else
+    head -c 65536 /dev/zero | tr '\0' a > hole_expect.dat
+  fi
+  if [ $punched != $expect ]; then
+    echo "FAIL ${opts:-plain}: punched=$punched, expected $expect"
+    FAILED=1
+  elif ! cmp -s hole_expect.dat "$MNT/hole.dat"; then
+    echo "FAIL ${opts:-plain}: file reads back wrong"
+    FAILED=1
+  else
+    echo "ok   ${opts:-plain}: punched=$punched"
+  fi
+  fusermount -u "$MNT"
+}
+
+check "" yes
+check "transform=caesar:3" no
+
+rm -rf "$STG" "$MNT" hole_expect.dat
+exit $FAILED
@@ -0,0 +1,291 @@
+/**
+ * \file iobackend.c
+ * \date October 2026
+ *
+ * Blocking and io_uring implementations of the backing-file I/O interface.
+ *
+ * The io_uring backend keeps a single ring for the whole daemon.  FUSE worker
+ * threads add their operations to the submission queue under a lock and then
+ * sleep; one completion thread reaps the completion queue and wakes each
+ * submitter once all of its operations are done.  Since submitting does not
+ * wait for earlier submissions, the kernel sees the I/O of every concurrent
+ * FUSE request at once.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "iobackend.h"
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* ------------------------------------------------------------------------ */
+/* Blocking system calls */
+
+static ssize_t sync_op(struct iob_op *op)
+{
+	ssize_t res;
+
+	switch (op->opcode) {
+	case IOB_READ:
+		res = pread(op->fd, op->buf, op->len, op->off);
+		break;
+	case IOB_WRITE:
+		res = pwrite(op->fd, op->buf, op->len, op->off);
+		break;
+	case IOB_FSYNC:
+		res = fsync(op->fd);
+		break;
+	case IOB_FDATASYNC:
+		res = fdatasync(op->fd);
+		break;
+	default:
+		errno = EINVAL;
+		res = -1;
+	}
+	return res == -1 ? -errno : res;
+}
+
+static int op_failed(const struct iob_op *op)
+{
+	if (op->res < 0)
+		return 1;
+	// Short transfers break a chain, as they do in io_uring.
+	return (op->opcode == IOB_READ || op->opcode == IOB_WRITE) &&
+		op->res != op->len;
+}
+
+static void sync_submit(struct iob_op *ops, int n)
+{
+	int cancel = 0;
+	int i;
+
+	for (i = 0; i < n; i += 1) {
+		ops[i].res = cancel ? -ECANCELED : sync_op(&ops[i]);
+		if (!ops[i].link)
+			cancel = 0;
+		else if (op_failed(&ops[i]))
+			cancel = 1;
+	}
+}
+
+/* ------------------------------------------------------------------------ */
+/* io_uring */
+
+#ifdef HAVE_LIBURING
+
+#define RING_ENTRIES 256
+
+/* One per iob_submit() call, on the submitter's stack. */
+struct waiter {
+	pthread_mutex_t lock;
+	pthread_cond_t  done;
+	int             pending;
+};
+
+/* What a completion's user_data points to. */
+struct inflight {
+	struct iob_op *op;
+	struct waiter *waiter;
+};
+
+static struct io_uring ring;
+static int             ring_ready = 0;
+static pthread_mutex_t sq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t       reaper;
+
+static void *reap_completions(void *arg)
+{
+	struct io_uring_cqe *cqe;
+	struct inflight *in;
+	int res;
+
+	(void) arg;
+	for (;;) {
+		res = io_uring_wait_cqe(&ring, &cqe);
+		if (res == -EINTR)
+			continue;
+		if (res < 0) {
+			fprintf(stderr, "ERROR: io_uring completion wait failed: %d\n", res);
+			return NULL;
+		}
+		in = io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+		io_uring_cqe_seen(&ring, cqe);
+
+		// A NOP without data is the shutdown signal.
+		if (in == NULL)
+			return NULL;
+
+		in->op->res = res;
+		pthread_mutex_lock(&in->waiter->lock);
+		if (--in->waiter->pending == 0)
+			pthread_cond_signal(&in->waiter->done);
+		pthread_mutex_unlock(&in->waiter->lock);
+	}
+}
+
+static void prep_op(struct io_uring_sqe *sqe, struct iob_op *op)
+{
+	switch (op->opcode) {
+	case IOB_READ:
+		io_uring_prep_read(sqe, op->fd, op->buf, op->len, op->off);
+		break;
+	case IOB_WRITE:
+		io_uring_prep_write(sqe, op->fd, op->buf, op->len, op->off);
+		break;
+	case IOB_FSYNC:
+		io_uring_prep_fsync(sqe, op->fd, 0);
+		break;
+	case IOB_FDATASYNC:
+		io_uring_prep_fsync(sqe, op->fd, IORING_FSYNC_DATASYNC);
+		break;
+	}
+}
+
+static void uring_submit(struct iob_op *ops, int n)
+{
+	struct inflight in[n];
+	struct waiter waiter;
+	int i;
+
+	pthread_mutex_init(&waiter.lock, NULL);
+	pthread_cond_init(&waiter.done, NULL);
+	waiter.pending = n;
+
+	pthread_mutex_lock(&sq_lock);
+	// A chain must not be split across two submissions, so make room for
+	// all n entries first.
+	if (io_uring_sq_space_left(&ring) < n)
+		io_uring_submit(&ring);
+	for (i = 0; i < n; i += 1) {
+		struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+		in[i].op = &ops[i];
+		in[i].waiter = &waiter;
+		prep_op(sqe, &ops[i]);
+		if (ops[i].link && i + 1 < n)
+			sqe->flags |= IOSQE_IO_LINK;
+		io_uring_sqe_set_data(sqe, &in[i]);
+	}
+	io_uring_submit(&ring);
+	pthread_mutex_unlock(&sq_lock);
+
+	pthread_mutex_lock(&waiter.lock);
+	while (waiter.pending > 0)
+		pthread_cond_wait(&waiter.done, &waiter.lock);
+	pthread_mutex_unlock(&waiter.lock);
+
+	pthread_cond_destroy(&waiter.done);
+	pthread_mutex_destroy(&waiter.lock);
+}
+
+/* The ring takes lengths as unsigned int and has a fixed size; anything
+   that does not fit goes through the blocking path. */
+static int fits_ring(const struct iob_op *ops, int n)
+{
+	int i;
+
+	if (!ring_ready || n > RING_ENTRIES)
+		return 0;
+	for (i = 0; i < n; i += 1)
+		if (ops[i].len > UINT_MAX)
+			return 0;
+	return 1;
+}
+
+void iob_init(void)
+{
+	int res;
+
+	if (ring_ready)
+		return;
+	res = io_uring_queue_init(RING_ENTRIES, &ring, 0);
+	if (res < 0) {
+		fprintf(stderr, "WARNING: io_uring unavailable (%d), using blocking I/O\n",
+			res);
+		return;
+	}
+	if (pthread_create(&reaper, NULL, reap_completions, NULL) != 0) {
+		io_uring_queue_exit(&ring);
+		return;
+	}
+	ring_ready = 1;
+}
+
+void iob_shutdown(void)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!ring_ready)
+		return;
+	pthread_mutex_lock(&sq_lock);
+	if (io_uring_sq_space_left(&ring) < 1)
+		io_uring_submit(&ring);
+	sqe = io_uring_get_sqe(&ring);
+	io_uring_prep_nop(sqe);
+	io_uring_sqe_set_data(sqe, NULL);
+	io_uring_submit(&ring);
+	ring_ready = 0;
+	pthread_mutex_unlock(&sq_lock);
+
+	pthread_join(reaper, NULL);
+	io_uring_queue_exit(&ring);
+}
+
+const char *iob_backend_name(void)
+{
+	return ring_ready ? "io_uring" : "blocking";
+}
+
+void iob_submit(struct iob_op *ops, int n)
+{
+	if (fits_ring(ops, n))
+		uring_submit(ops, n);
+	else
+		sync_submit(ops, n);
+}
+
+#else /* !HAVE_LIBURING */
+
+void iob_init(void)
+{
+}
+
+void iob_shutdown(void)
+{
+}
+
+const char *iob_backend_name(void)
+{
+	return "blocking";
+}
+
+void iob_submit(struct iob_op *ops, int n)
+{
+	sync_submit(ops, n);
+}
+
+#endif /* HAVE_LIBURING */
+
+/* ------------------------------------------------------------------------ */
+
+ssize_t iob_pread(int fd, void *buf, size_t len, off_t off)
+{
+	struct iob_op op = { IOB_READ, fd, buf, len, off, 0, 0 };
+
+	iob_submit(&op, 1);
+	return op.res;
+}
+
+ssize_t iob_pwrite(int fd, const void *buf, size_t len, off_t off)
+{
+	struct iob_op op = { IOB_WRITE, fd, (void *) buf, len, off, 0, 0 };
+
+	iob_submit(&op, 1);
+	return op.res;
+}
@@ -0,0 +1,54 @@
+/**
+ * \file iobackend.h
+ * \date October 2026
+ *
+ * Backing-file I/O for the file systems.  By default every call is a plain
+ * blocking system call.  Built with HAVE_LIBURING (make URING=1), the calls
+ * go through one io_uring shared by all FUSE worker threads instead, so many
+ * backing I/Os can be in flight at once, and dependent operations submitted
+ * together with iob_submit() cost a single system call.
+ */
+
+#ifndef IOBACKEND_H
+#define IOBACKEND_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+enum iob_opcode {
+	IOB_READ,
+	IOB_WRITE,
+	IOB_FSYNC,
+	IOB_FDATASYNC
+};
+
+struct iob_op {
+	enum iob_opcode opcode;
+	int             fd;
+	void           *buf;
+	size_t          len;
+	off_t           off;
+	/* Start the next operation only once this one has fully succeeded
+	   (all len bytes transferred). */
+	int             link;
+	/* Filled in: bytes transferred or -errno, -ECANCELED when an earlier
+	   operation of the same chain failed or came up short. */
+	ssize_t         res;
+};
+
+/* Set up the backend.  Call from the FUSE init callback, after the daemon
+   has forked, since the io_uring backend runs a completion thread.  Falls
+   back to blocking calls if the kernel has no io_uring. */
+void iob_init(void);
+void iob_shutdown(void);
+const char *iob_backend_name(void);
+
+/* Like pread()/pwrite(), but returning -errno on failure. */
+ssize_t iob_pread(int fd, void *buf, size_t len, off_t off);
+ssize_t iob_pwrite(int fd, const void *buf, size_t len, off_t off);
+
+/* Run n operations and wait for all of them.  Unlinked operations may run
+   concurrently and in any order. */
+void iob_submit(struct iob_op *ops, int n);
+
+#endif /* IOBACKEND_H */
@@ -0,0 +1,255 @@
+/**
+ * \file mapcache.c
+ * \date October 2026
+ *
+ * The mapping cache: a hash table of mappings by path, threaded on an LRU
+ * list, all under one lock.  The lock is only taken to find, pin and unpin
+ * mappings; copying data out of a pinned mapping happens without it.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapcache.h"
+
+#define MAPCACHE_BUCKETS 256
+
+struct mapping {
+	char           *path;
+	dev_t           dev;
+	ino_t           ino;
+	struct timespec mtime;
+	unsigned char  *addr;
+	size_t          size;
+	int             refs;
+	/* Dropped from the table while still held; unmapped on the last put. */
+	int             stale;
+	/* Sequential-scan detection. */
+	off_t           next_off;
+	int             sequential;
+	struct mapping *hash_next;
+	struct mapping *lru_prev;
+	struct mapping *lru_next;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mapping *buckets[MAPCACHE_BUCKETS];
+/* Most recently used at the head. */
+static struct mapping *lru_head = NULL;
+static struct mapping *lru_tail = NULL;
+static size_t          num_entries = 0;
+static size_t          num_bytes = 0;
+static size_t          max_entries = 64;
+static size_t          max_bytes = (size_t) 1024 * 1024 * 1024;
+
+static unsigned hash_path(const char *path)
+{
+	unsigned h = 5381;
+
+	while (*path != '\0')
+		h = h * 33 + (unsigned char) *path++;
+	return h % MAPCACHE_BUCKETS;
+}
+
+static void lru_unlink(struct mapping *m)
+{
+	if (m->lru_prev != NULL)
+		m->lru_prev->lru_next = m->lru_next;
+	else
+		lru_head = m->lru_next;
+	if (m->lru_next != NULL)
+		m->lru_next->lru_prev = m->lru_prev;
+	else
+		lru_tail = m->lru_prev;
+	m->lru_prev = m->lru_next = NULL;
+}
+
+static void lru_push_front(struct mapping *m)
+{
+	m->lru_prev = NULL;
+	m->lru_next = lru_head;
+	if (lru_head != NULL)
+		lru_head->lru_prev = m;
+	lru_head = m;
+	if (lru_tail == NULL)
+		lru_tail = m;
+}
+
+static void mapping_free(struct mapping *m)
+{
+	if (m->addr != NULL)
+		munmap(m->addr, m->size);
+	free(m->path);
+	free(m);
+}
+
+/* Take m out of the table and the LRU list; free it unless it is held. */
+static void cache_remove(struct mapping *m)
+{
+	struct mapping **pp = &buckets[hash_path(m->path)];
+
+	while (*pp != m)
+		pp = &(*pp)->hash_next;
+	*pp = m->hash_next;
+	lru_unlink(m);
+	num_entries -= 1;
+	num_bytes -= m->size;
+
+	if (m->refs == 0)
+		mapping_free(m);
+	else
+		m->stale = 1;
+}
+
+static void cache_evict(void)
+{
+	struct mapping *m = lru_tail;
+
+	while (m != NULL && (num_entries > max_entries || num_bytes > max_bytes)) {
+		struct mapping *prev = m->lru_prev;
+		if (m->refs == 0)
+			cache_remove(m);
+		m = prev;
+	}
+}
+
+void mapcache_configure(size_t entries, size_t bytes)
+{
+	pthread_mutex_lock(&cache_lock);
+	max_entries = entries;
+	max_bytes = bytes;
+	cache_evict();
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static struct mapping *map_file(const char *path, const struct stat *st,
+				int fd)
+{
+	struct mapping *m = calloc(1, sizeof(*m));
+
+	if (m == NULL)
+		return NULL;
+	m->path = strdup(path);
+	if (m->path == NULL) {
+		free(m);
+		errno = ENOMEM;
+		return NULL;
+	}
+	m->dev   = st->st_dev;
+	m->ino   = st->st_ino;
+	m->mtime = st->st_mtim;
+	m->size  = st->st_size;
+
+	// An empty file cannot be mapped, nor does it need to be.
+	if (m->size > 0) {
+		m->addr = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (m->addr == MAP_FAILED) {
+			int saved = errno;
+			free(m->path);
+			free(m);
+			errno = saved;
+			return NULL;
+		}
+	}
+	return m;
+}
+
+struct mapping *mapcache_get(const char *path)
+{
+	struct mapping *m;
+	struct stat st;
+	unsigned h = hash_path(path);
+	int fd;
+
+	if (stat(path, &st) == -1)
+		return NULL;
+
+	pthread_mutex_lock(&cache_lock);
+	for (m = buckets[h]; m != NULL; m = m->hash_next)
+		if (strcmp(m->path, path) == 0)
+			break;
+	if (m != NULL) {
+		if (m->dev == st.st_dev && m->ino == st.st_ino &&
+		    m->size == st.st_size &&
+		    m->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    m->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			m->refs += 1;
+			lru_unlink(m);
+			lru_push_front(m);
+			pthread_mutex_unlock(&cache_lock);
+			return m;
+		}
+		// The path now names a different file (e.g. a history that was
+		// deleted and started over), so the old mapping is useless.
+		cache_remove(m);
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	// Map without holding the lock; mmap() of a large file is not free.
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return NULL;
+	}
+	m = map_file(path, &st, fd);
+	close(fd);
+	if (m == NULL)
+		return NULL;
+	m->refs = 1;
+
+	pthread_mutex_lock(&cache_lock);
+	m->hash_next = buckets[h];
+	buckets[h] = m;
+	lru_push_front(m);
+	num_entries += 1;
+	num_bytes += m->size;
+	cache_evict();
+	pthread_mutex_unlock(&cache_lock);
+	return m;
+}
+
+void mapcache_put(struct mapping *m)
+{
+	pthread_mutex_lock(&cache_lock);
+	m->refs -= 1;
+	if (m->refs == 0 && m->stale)
+		mapping_free(m);
+	else
+		cache_evict();
+	pthread_mutex_unlock(&cache_lock);
+}
+
+const unsigned char *mapping_data(const struct mapping *m)
+{
+	return m->addr;
+}
+
+size_t mapping_size(const struct mapping *m)
+{
+	return m->size;
+}
+
+void mapping_access(struct mapping *m, size_t size, off_t off)
+{
+	// Racy on purpose: these fields only steer a hint, and a wrong guess
+	// costs one extra madvise().
+	int sequential = off == m->next_off;
+
+	m->next_off = off + size;
+	if (m->addr == NULL || sequential == m->sequential)
+		return;
+	m->sequential = sequential;
+	madvise(m->addr, m->size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
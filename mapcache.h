@@ -0,0 +1,41 @@
+/**
+ * \file mapcache.h
+ * \date October 2026
+ *
+ * A bounded cache of read-only memory mappings of immutable files (in
+ * versfs, stored versions).  Once a file is mapped, reading it is a memory
+ * copy rather than a system call, and every reader of the file shares the
+ * same pages.  Mappings that nobody holds are evicted least recently used
+ * first once the cache exceeds its entry or byte limits.
+ */
+
+#ifndef MAPCACHE_H
+#define MAPCACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct mapping;
+
+/* Limit the cache to max_entries mappings and max_bytes of mapped data.
+   Mappings that are held open may push the cache past either limit. */
+void mapcache_configure(size_t max_entries, size_t max_bytes);
+
+/* Map the file at path, or take another reference to its cached mapping.
+   The cached mapping is reused only if the file is still the same one
+   (device, inode, size and modification time).  Returns NULL with errno set
+   on failure. */
+struct mapping *mapcache_get(const char *path);
+
+/* Drop a reference taken by mapcache_get().  The mapping stays cached. */
+void mapcache_put(struct mapping *m);
+
+const unsigned char *mapping_data(const struct mapping *m);
+size_t mapping_size(const struct mapping *m);
+
+/* Note that size bytes at off are about to be read, so that sequential
+   scans are detected and the kernel told to read ahead aggressively (and
+   random access told not to). */
+void mapping_access(struct mapping *m, size_t size, off_t off);
+
+#endif /* MAPCACHE_H */
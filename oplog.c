@@ -0,0 +1,1102 @@
+/**
+ * \file oplog.c
+ * \date October 2026
+ *
+ * Segments, records and replay of the versfs namespace log.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "oplog.h"
+#include "vstore.h"
+
+#define OPLOG_DIR VSTORE_DIR "/oplog"
+
+#define NS_PER_SEC 1000000000LL
+
+/* ------------------------------------------------------------------------ */
+/* On-disk format */
+
+/* Each segment file starts with a header.  Records follow back to back. */
+struct file_header {
+	char magic[4];		/* "VOPS" for a snapshot, "VOPL" for a log */
+	uint32_t format;	/* 1 */
+	int64_t start;		/* when the segment began, ns since the epoch */
+};
+
+#define SNAP_MAGIC "VOPS"
+#define LOG_MAGIC  "VOPL"
+
+/* A record is followed by path_len bytes of path and arg_len bytes of arg,
+   neither NUL terminated.  A snapshot is the records that build its tree
+   from nothing, all stamped with its start.  Host byte order. */
+struct record {
+	uint32_t size;		/* of the whole record */
+	uint16_t op;
+	uint16_t path_len;
+	int64_t time;		/* ns since the epoch */
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t arg_len;
+};
+
+#define RECORD_MAX (sizeof(struct record) + 2 * PATH_MAX)
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static size_t encode_record(char *buf, enum oplog_op op, int64_t time,
+			    mode_t mode, uid_t uid, gid_t gid,
+			    const char *path, size_t path_len,
+			    const char *arg, size_t arg_len)
+{
+	struct record r;
+
+	r.size = sizeof(r) + path_len + arg_len;
+	r.op = op;
+	r.path_len = path_len;
+	r.time = time;
+	r.mode = mode;
+	r.uid = uid;
+	r.gid = gid;
+	r.arg_len = arg_len;
+	memcpy(buf, &r, sizeof(r));
+	memcpy(buf + sizeof(r), path, path_len);
+	memcpy(buf + sizeof(r) + path_len, arg, arg_len);
+	return r.size;
+}
+
+static void segment_file(char *out, const char *dir, unsigned seq,
+			 const char *ext)
+{
+	if (snprintf(out, PATH_MAX, "%s/%08u.%s", dir, seq, ext) >= PATH_MAX)
+		out[0] = '\0';	/* Too long: names no file. */
+}
+
+/* The highest segment number with a file of type ext in dir, or -1. */
+static int newest_segment(const char *dir, const char *ext)
+{
+	struct dirent *de;
+	DIR *dp;
+	int newest = -1;
+
+	dp = opendir(dir);
+	if (dp == NULL)
+		return -1;
+	while ((de = readdir(dp)) != NULL) {
+		char *end;
+		unsigned long seq = strtoul(de->d_name, &end, 10);
+		if (end == de->d_name || *end != '.' || strcmp(end + 1, ext) != 0)
+			continue;
+		if (seq <= INT_MAX && (int) seq > newest)
+			newest = seq;
+	}
+	closedir(dp);
+	return newest;
+}
+
+static int read_header(FILE *f, const char *magic, int64_t *start)
+{
+	struct file_header h;
+
+	if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, magic, 4) != 0 ||
+	    h.format != 1)
+		return -EINVAL;
+	*start = h.start;
+	return 0;
+}
+
+static int segment_start(const char *file, const char *magic, int64_t *start)
+{
+	FILE *f = fopen(file, "r");
+	int res;
+
+	if (f == NULL)
+		return -errno;
+	res = read_header(f, magic, start);
+	fclose(f);
+	return res;
+}
+
+/* ------------------------------------------------------------------------ */
+/* The tree */
+
+/* What hard links share. */
+struct inode {
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	char *target;
+	unsigned refs;
+	struct node *written;	/* its first link in the snapshot being written */
+};
+
+/* A directory entry.  Entries are found by (parent, name) in one hash table
+   for the whole tree; the children of a directory are also chained, for
+   walks. */
+struct node {
+	char *name;
+	struct node *parent;
+	struct node *kids;
+	struct node *prev, *next;
+	struct node *hnext;
+	struct inode *ino;
+};
+
+struct oplog_tree {
+	struct node root;
+	struct inode root_ino;
+	struct node **buckets;
+	size_t nbuckets;
+	size_t nnodes;
+};
+
+static size_t node_hash(const struct node *parent, const char *name,
+			size_t len)
+{
+	uint64_t h = 14695981039346656037ULL ^ (uintptr_t) parent;
+	size_t i;
+
+	for (i = 0; i < len; i += 1)
+		h = (h ^ (unsigned char) name[i]) * 1099511628211ULL;
+	return h;
+}
+
+static struct oplog_tree *tree_new(void)
+{
+	struct oplog_tree *t = calloc(1, sizeof(*t));
+
+	if (t == NULL)
+		return NULL;
+	t->nbuckets = 1024;
+	t->buckets = calloc(t->nbuckets, sizeof(*t->buckets));
+	if (t->buckets == NULL) {
+		free(t);
+		return NULL;
+	}
+	t->root.name = "";
+	t->root.ino = &t->root_ino;
+	t->root_ino.mode = S_IFDIR | 0755;
+	t->root_ino.refs = 1;
+	return t;
+}
+
+static struct node *find_child(const struct oplog_tree *t,
+			       const struct node *parent,
+			       const char *name, size_t len)
+{
+	struct node *n = t->buckets[node_hash(parent, name, len) &
+				    (t->nbuckets - 1)];
+
+	for (; n != NULL; n = n->hnext) {
+		if (n->parent == parent && strncmp(n->name, name, len) == 0 &&
+		    n->name[len] == '\0')
+			return n;
+	}
+	return NULL;
+}
+
+static void hash_insert(struct oplog_tree *t, struct node *n)
+{
+	size_t b = node_hash(n->parent, n->name, strlen(n->name)) &
+		(t->nbuckets - 1);
+
+	n->hnext = t->buckets[b];
+	t->buckets[b] = n;
+}
+
+static void grow(struct oplog_tree *t)
+{
+	struct node **old = t->buckets;
+	size_t nold = t->nbuckets;
+	struct node *n, *next;
+	size_t i;
+
+	t->buckets = calloc(nold * 2, sizeof(*t->buckets));
+	if (t->buckets == NULL) {
+		// Stay at this size; lookups just get slower.
+		t->buckets = old;
+		return;
+	}
+	t->nbuckets = nold * 2;
+	for (i = 0; i < nold; i += 1) {
+		for (n = old[i]; n != NULL; n = next) {
+			next = n->hnext;
+			hash_insert(t, n);
+		}
+	}
+	free(old);
+}
+
+static void link_node(struct oplog_tree *t, struct node *parent,
+		      struct node *n)
+{
+	n->parent = parent;
+	n->prev = NULL;
+	n->next = parent->kids;
+	if (parent->kids != NULL)
+		parent->kids->prev = n;
+	parent->kids = n;
+	hash_insert(t, n);
+	if (++t->nnodes > t->nbuckets)
+		grow(t);
+}
+
+static void unlink_node(struct oplog_tree *t, struct node *n)
+{
+	struct node **p = &t->buckets[node_hash(n->parent, n->name,
+						strlen(n->name)) &
+				      (t->nbuckets - 1)];
+
+	while (*p != n)
+		p = &(*p)->hnext;
+	*p = n->hnext;
+	if (n->prev != NULL)
+		n->prev->next = n->next;
+	else
+		n->parent->kids = n->next;
+	if (n->next != NULL)
+		n->next->prev = n->prev;
+	t->nnodes -= 1;
+}
+
+static void inode_put(struct inode *ino)
+{
+	if (--ino->refs == 0) {
+		free(ino->target);
+		free(ino);
+	}
+}
+
+static void free_subtree(struct oplog_tree *t, struct node *n)
+{
+	while (n->kids != NULL)
+		free_subtree(t, n->kids);
+	unlink_node(t, n);
+	inode_put(n->ino);
+	free(n->name);
+	free(n);
+}
+
+void oplog_tree_free(struct oplog_tree *t)
+{
+	while (t->root.kids != NULL)
+		free_subtree(t, t->root.kids);
+	free(t->root_ino.target);
+	free(t->buckets);
+	free(t);
+}
+
+/* The node of the first len bytes of path, if there is one. */
+static struct node *lookup(const struct oplog_tree *t, const char *path,
+			   size_t len)
+{
+	struct node *n = (struct node *) &t->root;
+	size_t i = 0, j;
+
+	while (n != NULL) {
+		while (i < len && path[i] == '/')
+			i += 1;
+		if (i == len)
+			break;
+		for (j = i; j < len && path[j] != '/'; j += 1)
+			;
+		n = find_child(t, n, path + i, j - i);
+		i = j;
+	}
+	return n;
+}
+
+/* The directory that would hold path, and the name in it.  NULL for the
+   root, or if the directory does not exist. */
+static struct node *lookup_parent(const struct oplog_tree *t,
+				  const char *path, const char **name)
+{
+	size_t len = strlen(path);
+	struct node *parent;
+
+	while (len > 0 && path[len - 1] == '/')
+		len -= 1;
+	if (len == 0)
+		return NULL;
+	*name = path + len;
+	while (*name > path && (*name)[-1] != '/')
+		*name -= 1;
+	parent = lookup(t, path, *name - path);
+	return parent != NULL && S_ISDIR(parent->ino->mode) ? parent : NULL;
+}
+
+static struct node *node_new(const char *name, size_t len, struct inode *ino)
+{
+	struct node *n = calloc(1, sizeof(*n));
+
+	if (n == NULL)
+		return NULL;
+	n->name = strndup(name, len);
+	if (n->name == NULL) {
+		free(n);
+		return NULL;
+	}
+	n->ino = ino;
+	return n;
+}
+
+static void set_attrs(struct inode *ino, const struct record *r)
+{
+	ino->mode = r->mode;
+	ino->uid = r->uid;
+	ino->gid = r->gid;
+}
+
+static void set_target(struct inode *ino, const char *target)
+{
+	free(ino->target);
+	ino->target = strdup(target);
+}
+
+/* Add what r made at path to t. */
+static void apply_create(struct oplog_tree *t, const struct record *r,
+			 const char *path, const char *arg)
+{
+	struct node *parent, *n, *src = NULL;
+	struct inode *ino;
+	const char *name;
+
+	parent = lookup_parent(t, path, &name);
+	if (parent == NULL) {
+		if (lookup(t, path, strlen(path)) == &t->root)
+			set_attrs(&t->root_ino, r);
+		return;
+	}
+	if (r->op == OPLOG_LINK) {
+		src = lookup(t, arg, strlen(arg));
+		if (src != NULL && S_ISDIR(src->ino->mode))
+			src = NULL;
+	}
+
+	n = find_child(t, parent, name, strcspn(name, "/"));
+	if (n != NULL) {
+		if (src != NULL ? n->ino == src->ino :
+		    (n->ino->mode & S_IFMT) == (r->mode & S_IFMT)) {
+			set_attrs(n->ino, r);
+			if (r->op == OPLOG_SYMLINK)
+				set_target(n->ino, arg);
+			return;
+		}
+		free_subtree(t, n);
+	}
+
+	if (src != NULL) {
+		ino = src->ino;
+		ino->refs += 1;
+	} else {
+		ino = calloc(1, sizeof(*ino));
+		if (ino == NULL)
+			return;
+		ino->refs = 1;
+		if (r->op == OPLOG_SYMLINK)
+			set_target(ino, arg);
+	}
+	set_attrs(ino, r);
+	n = node_new(name, strcspn(name, "/"), ino);
+	if (n == NULL) {
+		inode_put(ino);
+		return;
+	}
+	link_node(t, parent, n);
+}
+
+static void apply_rename(struct oplog_tree *t, const struct record *r,
+			 const char *path, const char *arg)
+{
+	struct node *src, *parent, *n, *p;
+	const char *name;
+	size_t len;
+	char *new_name;
+
+	src = lookup(t, arg, strlen(arg));
+	parent = lookup_parent(t, path, &name);
+	if (src == NULL || src == &t->root || parent == NULL)
+		return;
+	len = strcspn(name, "/");
+	n = find_child(t, parent, name, len);
+	if (n == src)
+		return;
+	// Neither can be inside the other.
+	for (p = parent; p != NULL; p = p->parent)
+		if (p == src)
+			return;
+	for (p = src; n != NULL && p != NULL; p = p->parent)
+		if (p == n)
+			return;
+
+	new_name = strndup(name, len);
+	if (new_name == NULL)
+		return;
+	if (n != NULL)
+		free_subtree(t, n);
+	unlink_node(t, src);
+	free(src->name);
+	src->name = new_name;
+	link_node(t, parent, src);
+	set_attrs(src->ino, r);
+}
+
+static void tree_apply(struct oplog_tree *t, const struct record *r,
+		       const char *path, const char *arg)
+{
+	struct node *n;
+
+	switch (r->op) {
+	case OPLOG_CREATE:
+	case OPLOG_MKDIR:
+	case OPLOG_SYMLINK:
+	case OPLOG_LINK:
+		apply_create(t, r, path, arg);
+		break;
+	case OPLOG_UNLINK:
+	case OPLOG_RMDIR:
+		n = lookup(t, path, strlen(path));
+		if (n != NULL && n != &t->root)
+			free_subtree(t, n);
+		break;
+	case OPLOG_RENAME:
+		apply_rename(t, r, path, arg);
+		break;
+	case OPLOG_SETATTR:
+		n = lookup(t, path, strlen(path));
+		if (n != NULL)
+			set_attrs(n->ino, r);
+		break;
+	}
+}
+
+/* Path of n in the mount point, "" for the root.  Returns its length. */
+static size_t node_path(const struct node *n, char *out)
+{
+	size_t len, name_len;
+
+	if (n->parent == NULL) {
+		out[0] = '\0';
+		return 0;
+	}
+	len = node_path(n->parent, out);
+	name_len = strlen(n->name);
+	if (len + 1 + name_len >= PATH_MAX)
+		return len;
+	out[len] = '/';
+	memcpy(out + len + 1, n->name, name_len + 1);
+	return len + 1 + name_len;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Segments */
+
+/* Apply the records of the segment file to t (which may be NULL, to just
+   check the file), up to the first made after limit.  *count and *end are
+   the number of whole records read and where the last one ends.  Returns 1
+   if it stopped at limit, 0 at the end of the file, or -errno. */
+static int load_segment(struct oplog_tree *t, const char *file,
+			const char *magic, int64_t limit,
+			unsigned *count, off_t *end)
+{
+	char path[PATH_MAX];
+	char arg[PATH_MAX];
+	struct record r;
+	int64_t start;
+	FILE *f;
+	int res;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+		return -errno;
+	res = read_header(f, magic, &start);
+	if (res < 0) {
+		fclose(f);
+		return res;
+	}
+	if (count != NULL)
+		*count = 0;
+	if (end != NULL)
+		*end = sizeof(struct file_header);
+
+	// A record cut short by a crash ends the segment.
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		if (r.path_len >= PATH_MAX || r.arg_len >= PATH_MAX ||
+		    r.size != sizeof(r) + r.path_len + r.arg_len)
+			break;
+		if (fread(path, 1, r.path_len, f) != r.path_len ||
+		    fread(arg, 1, r.arg_len, f) != r.arg_len)
+			break;
+		if (r.time > limit) {
+			res = 1;
+			break;
+		}
+		path[r.path_len] = '\0';
+		arg[r.arg_len] = '\0';
+		if (t != NULL)
+			tree_apply(t, &r, path, arg);
+		if (count != NULL)
+			*count += 1;
+		if (end != NULL)
+			*end += r.size;
+	}
+	fclose(f);
+	return res;
+}
+
+static int write_node(FILE *f, int64_t time, struct node *n, char *path,
+		      size_t len)
+{
+	char buf[RECORD_MAX];
+	char link_path[PATH_MAX];
+	struct inode *ino = n->ino;
+	const char *arg = "";
+	size_t arg_len = 0;
+	struct node *kid;
+	enum oplog_op op;
+	size_t size;
+
+	if (S_ISDIR(ino->mode)) {
+		op = OPLOG_MKDIR;
+	} else if (ino->written != NULL) {
+		op = OPLOG_LINK;
+		arg_len = node_path(ino->written, link_path);
+		arg = link_path;
+	} else {
+		op = S_ISLNK(ino->mode) ? OPLOG_SYMLINK : OPLOG_CREATE;
+		if (ino->target != NULL) {
+			arg = ino->target;
+			arg_len = strlen(arg);
+		}
+		ino->written = n;
+	}
+	size = encode_record(buf, op, time, ino->mode, ino->uid, ino->gid,
+			     len == 0 ? "/" : path, len == 0 ? 1 : len,
+			     arg, arg_len);
+	if (fwrite(buf, size, 1, f) != 1)
+		return -EIO;
+
+	for (kid = n->kids; kid != NULL; kid = kid->next) {
+		size_t name_len = strlen(kid->name);
+		int res;
+
+		if (len + 1 + name_len >= PATH_MAX)
+			continue;
+		path[len] = '/';
+		memcpy(path + len + 1, kid->name, name_len + 1);
+		res = write_node(f, time, kid, path, len + 1 + name_len);
+		path[len] = '\0';
+		if (res < 0)
+			return res;
+	}
+	return 0;
+}
+
+/* Write t as a snapshot that began at start, replacing file in one step.
+   Leaves the written marks of t set; t is freed afterwards. */
+static int write_snapshot(const char *file, struct oplog_tree *t,
+			  int64_t start)
+{
+	struct file_header h = { SNAP_MAGIC, 1, start };
+	char tmp[PATH_MAX + 8];
+	char path[PATH_MAX] = "";
+	FILE *f;
+	int res;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	f = fopen(tmp, "w");
+	if (f == NULL)
+		return -errno;
+	res = fwrite(&h, sizeof(h), 1, f) == 1 ? 0 : -EIO;
+	if (res == 0)
+		res = write_node(f, start, &t->root, path, 0);
+	if (fflush(f) == EOF || fsync(fileno(f)) == -1)
+		res = res < 0 ? res : -errno;
+	if (fclose(f) == EOF && res == 0)
+		res = -errno;
+	if (res == 0 && rename(tmp, file) == -1)
+		res = -errno;
+	if (res < 0)
+		unlink(tmp);
+	return res;
+}
+
+/* Files with more than one link, by device and inode, while walking the
+   live tree. */
+struct seen {
+	dev_t dev;
+	ino_t ino;
+	struct inode *inode;
+	struct seen *next;
+};
+
+#define SEEN_BUCKETS 4096
+
+/* Add everything in the directory at path (whose node is dir) to t. */
+static int walk_live(struct oplog_tree *t, struct node *dir, char *path,
+		     size_t len, int top, struct seen **seen)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *dp;
+	int res = 0;
+
+	dp = opendir(path);
+	if (dp == NULL)
+		return -errno;
+	while (res == 0 && (de = readdir(dp)) != NULL) {
+		struct inode *ino = NULL;
+		struct seen *s = NULL;
+		struct node *n;
+		size_t name_len = strlen(de->d_name);
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+		    (top && strcmp(de->d_name, VSTORE_DIR + 1) == 0))
+			continue;
+		if (len + 1 + name_len >= PATH_MAX ||
+		    fstatat(dirfd(dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+			continue;
+
+		if (!S_ISDIR(st.st_mode) && st.st_nlink > 1) {
+			s = seen[st.st_ino % SEEN_BUCKETS];
+			while (s != NULL && (s->dev != st.st_dev || s->ino != st.st_ino))
+				s = s->next;
+			if (s != NULL) {
+				ino = s->inode;
+				ino->refs += 1;
+			}
+		}
+		if (ino == NULL) {
+			ino = calloc(1, sizeof(*ino));
+			if (ino == NULL) {
+				res = -ENOMEM;
+				break;
+			}
+			ino->mode = st.st_mode;
+			ino->uid = st.st_uid;
+			ino->gid = st.st_gid;
+			ino->refs = 1;
+			if (S_ISLNK(st.st_mode)) {
+				char target[PATH_MAX];
+				ssize_t n = readlinkat(dirfd(dp), de->d_name, target,
+						       sizeof(target) - 1);
+				target[n < 0 ? 0 : n] = '\0';
+				set_target(ino, target);
+			}
+			if (!S_ISDIR(st.st_mode) && st.st_nlink > 1 &&
+			    (s = malloc(sizeof(*s))) != NULL) {
+				s->dev = st.st_dev;
+				s->ino = st.st_ino;
+				s->inode = ino;
+				s->next = seen[st.st_ino % SEEN_BUCKETS];
+				seen[st.st_ino % SEEN_BUCKETS] = s;
+			}
+		}
+		n = node_new(de->d_name, name_len, ino);
+		if (n == NULL) {
+			inode_put(ino);
+			res = -ENOMEM;
+			break;
+		}
+		link_node(t, dir, n);
+
+		if (S_ISDIR(st.st_mode)) {
+			path[len] = '/';
+			memcpy(path + len + 1, de->d_name, name_len + 1);
+			res = walk_live(t, n, path, len + 1 + name_len, 0, seen);
+			path[len] = '\0';
+		}
+	}
+	closedir(dp);
+	return res;
+}
+
+/* The tree of the storage directory as it is now. */
+static int snapshot_live(const char *storage_dir, const char *file,
+			 int64_t start)
+{
+	struct oplog_tree *t = tree_new();
+	struct seen **seen = calloc(SEEN_BUCKETS, sizeof(*seen));
+	char path[PATH_MAX];
+	struct stat st;
+	int res, i;
+
+	if (t == NULL || seen == NULL) {
+		free(seen);
+		if (t != NULL)
+			oplog_tree_free(t);
+		return -ENOMEM;
+	}
+	res = lstat(storage_dir, &st) == -1 ? -errno : 0;
+	if (res == 0) {
+		t->root_ino.mode = st.st_mode;
+		t->root_ino.uid = st.st_uid;
+		t->root_ino.gid = st.st_gid;
+		snprintf(path, sizeof(path), "%s", storage_dir);
+		res = walk_live(t, &t->root, path, strlen(path), 1, seen);
+	}
+	if (res == 0)
+		res = write_snapshot(file, t, start);
+
+	for (i = 0; i < SEEN_BUCKETS; i += 1) {
+		while (seen[i] != NULL) {
+			struct seen *next = seen[i]->next;
+			free(seen[i]);
+			seen[i] = next;
+		}
+	}
+	free(seen);
+	oplog_tree_free(t);
+	return res;
+}
+
+/* Snapshot seq + 1 from snapshot and log seq. */
+static int compact(const char *dir, unsigned seq)
+{
+	char file[PATH_MAX];
+	struct oplog_tree *t;
+	int64_t start;
+	int res;
+
+	segment_file(file, dir, seq + 1, "log");
+	res = segment_start(file, LOG_MAGIC, &start);
+	if (res < 0)
+		return res;
+	t = tree_new();
+	if (t == NULL)
+		return -ENOMEM;
+	segment_file(file, dir, seq, "snap");
+	res = load_segment(t, file, SNAP_MAGIC, INT64_MAX, NULL, NULL);
+	if (res >= 0) {
+		segment_file(file, dir, seq, "log");
+		res = load_segment(t, file, LOG_MAGIC, INT64_MAX, NULL, NULL);
+	}
+	if (res >= 0) {
+		segment_file(file, dir, seq + 1, "snap");
+		res = write_snapshot(file, t, start);
+	}
+	oplog_tree_free(t);
+	return res;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Appending */
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static char      log_dir[PATH_MAX];
+static size_t    storage_len;
+static int       log_fd = -1;
+static off_t     log_end;
+static unsigned  log_seq;
+static unsigned  log_records;
+static unsigned  compact_after;
+
+/* The segment being compacted, if any.  Guarded by log_lock. */
+static int       compacting = 0;
+static int       compactor_started = 0;
+static pthread_t compactor;
+
+static int create_log(const char *file, int64_t start)
+{
+	struct file_header h = { LOG_MAGIC, 1, start };
+	int fd, res;
+
+	fd = open(file, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		return -errno;
+	if (write(fd, &h, sizeof(h)) != sizeof(h)) {
+		res = errno != 0 ? -errno : -EIO;
+		close(fd);
+		unlink(file);
+		return res;
+	}
+	return fd;
+}
+
+static void *compact_main(void *arg)
+{
+	unsigned seq = (uintptr_t) arg;
+	int res = compact(log_dir, seq);
+
+	if (res < 0)
+		fprintf(stderr, "ERROR: Cannot compact namespace log segment %u: %s\n",
+			seq, strerror(-res));
+	pthread_mutex_lock(&log_lock);
+	compacting = 0;
+	pthread_mutex_unlock(&log_lock);
+	return NULL;
+}
+
+/* Seal the current segment and start the next.  Called with log_lock held. */
+static void rotate(void)
+{
+	char file[PATH_MAX];
+	int fd;
+
+	// One compaction at a time: until it is done, the log grows on.
+	if (compacting)
+		return;
+	segment_file(file, log_dir, log_seq + 1, "log");
+	fd = create_log(file, now_ns());
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Cannot start namespace log segment %u: %s\n",
+			log_seq + 1, strerror(-fd));
+		return;
+	}
+	if (compactor_started)
+		pthread_join(compactor, NULL);
+	close(log_fd);
+	log_fd = fd;
+	log_end = sizeof(struct file_header);
+	log_seq += 1;
+	log_records = 0;
+
+	compacting = 1;
+	compactor_started = pthread_create(&compactor, NULL, compact_main,
+					   (void *) (uintptr_t) (log_seq - 1)) == 0;
+	if (!compactor_started) {
+		compact(log_dir, log_seq - 1);
+		compacting = 0;
+	}
+}
+
+int oplog_open(const char *storage_dir, unsigned compact_records)
+{
+	char file[PATH_MAX];
+	int64_t start;
+	int newest, res;
+
+	if (snprintf(log_dir, sizeof(log_dir), "%s" OPLOG_DIR, storage_dir) >=
+	    sizeof(log_dir))
+		return -ENAMETOOLONG;
+	snprintf(file, sizeof(file), "%s" VSTORE_DIR, storage_dir);
+	if ((mkdir(file, S_IRWXU) == -1 && errno != EEXIST) ||
+	    (mkdir(log_dir, S_IRWXU) == -1 && errno != EEXIST))
+		return -errno;
+	storage_len = strlen(storage_dir);
+	compact_after = compact_records;
+
+	newest = newest_segment(log_dir, "log");
+	if (newest < 0) {
+		// A new log begins with the tree as it stands.
+		start = now_ns();
+		segment_file(file, log_dir, 0, "snap");
+		res = snapshot_live(storage_dir, file, start);
+		if (res < 0)
+			return res;
+		segment_file(file, log_dir, 0, "log");
+		log_fd = create_log(file, start);
+		if (log_fd < 0)
+			return log_fd;
+		log_seq = 0;
+		log_end = sizeof(struct file_header);
+		log_records = 0;
+		return 0;
+	}
+
+	// Finish a compaction cut short.
+	segment_file(file, log_dir, newest, "snap");
+	if (newest > 0 && access(file, F_OK) == -1) {
+		res = compact(log_dir, newest - 1);
+		if (res < 0)
+			fprintf(stderr, "ERROR: Cannot compact namespace log segment %d: %s\n",
+				newest - 1, strerror(-res));
+	}
+
+	segment_file(file, log_dir, newest, "log");
+	res = load_segment(NULL, file, LOG_MAGIC, INT64_MAX, &log_records,
+			   &log_end);
+	if (res < 0)
+		return res;
+	log_fd = open(file, O_WRONLY | O_APPEND);
+	if (log_fd == -1)
+		return -errno;
+	// Drop a record cut short by a crash, so that later ones can be read.
+	if (ftruncate(log_fd, log_end) == -1) {
+		res = -errno;
+		close(log_fd);
+		log_fd = -1;
+		return res;
+	}
+	log_seq = newest;
+	return 0;
+}
+
+void oplog_close(void)
+{
+	if (compactor_started)
+		pthread_join(compactor, NULL);
+	compactor_started = 0;
+	if (log_fd != -1)
+		close(log_fd);
+	log_fd = -1;
+}
+
+void oplog_lock(void)
+{
+	pthread_mutex_lock(&log_lock);
+}
+
+void oplog_unlock(void)
+{
+	pthread_mutex_unlock(&log_lock);
+}
+
+static const char *mount_path(const char *path, size_t *len)
+{
+	path += storage_len;
+	if (path[0] == '\0')
+		path = "/";
+	*len = strlen(path);
+	return path;
+}
+
+void oplog_record(enum oplog_op op, const char *path, const char *arg)
+{
+	char buf[RECORD_MAX];
+	char target[PATH_MAX];
+	struct stat st;
+	size_t path_len, arg_len = 0;
+	ssize_t res;
+	size_t size;
+
+	if (log_fd == -1)
+		return;
+	memset(&st, 0, sizeof(st));
+	if (op != OPLOG_UNLINK && op != OPLOG_RMDIR && lstat(path, &st) == -1)
+		return;
+	if (op == OPLOG_SYMLINK) {
+		res = readlink(path, target, sizeof(target) - 1);
+		arg_len = res < 0 ? 0 : res;
+		arg = target;
+	} else if (arg != NULL) {
+		arg = mount_path(arg, &arg_len);
+	} else {
+		arg = "";
+	}
+	path = mount_path(path, &path_len);
+
+	size = encode_record(buf, op, now_ns(), st.st_mode, st.st_uid, st.st_gid,
+			     path, path_len, arg, arg_len);
+	res = write(log_fd, buf, size);
+	if (res != size) {
+		fprintf(stderr, "ERROR: Cannot append to the namespace log: %s\n",
+			res < 0 ? strerror(errno) : "short write");
+		if (ftruncate(log_fd, log_end) == -1)
+			fprintf(stderr, "ERROR: Namespace log segment %u is damaged\n",
+				log_seq);
+		return;
+	}
+	log_end += size;
+	if (compact_after > 0 && ++log_records >= compact_after)
+		rotate();
+}
+
+/* ------------------------------------------------------------------------ */
+/* Replay */
+
+struct oplog_tree *oplog_replay(const char *storage_dir, time_t when)
+{
+	char dir[PATH_MAX];
+	char file[PATH_MAX];
+	struct oplog_tree *t;
+	int64_t limit = ((int64_t) when + 1) * NS_PER_SEC - 1;
+	int64_t start;
+	int newest, base = -1, seq, res;
+
+	if (snprintf(dir, sizeof(dir), "%s" OPLOG_DIR, storage_dir) >=
+	    sizeof(dir)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	newest = newest_segment(dir, "log");
+
+	// The latest snapshot from before when, else the earliest there is.
+	for (seq = newest; seq >= 0; seq -= 1) {
+		segment_file(file, dir, seq, "snap");
+		if (segment_start(file, SNAP_MAGIC, &start) < 0)
+			continue;
+		base = seq;
+		if (start <= limit)
+			break;
+	}
+	if (base < 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	t = tree_new();
+	if (t == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	segment_file(file, dir, base, "snap");
+	res = load_segment(t, file, SNAP_MAGIC, INT64_MAX, NULL, NULL);
+	for (seq = base; res == 0 && seq <= newest; seq += 1) {
+		segment_file(file, dir, seq, "log");
+		res = load_segment(t, file, LOG_MAGIC, limit, NULL, NULL);
+	}
+	if (res < 0 && res != -ENOENT) {
+		oplog_tree_free(t);
+		errno = -res;
+		return NULL;
+	}
+	return t;
+}
+
+static int walk_node(struct node *n, char *path, size_t len, int post,
+		     oplog_walk_fn fn, void *arg)
+{
+	struct oplog_entry e = {
+		len == 0 ? "/" : path, n->ino->mode, n->ino->uid, n->ino->gid,
+		n->ino->target
+	};
+	struct node *kid;
+	int res;
+
+	if (!post && (res = fn(&e, arg)) != 0)
+		return res;
+	for (kid = n->kids; kid != NULL; kid = kid->next) {
+		size_t name_len = strlen(kid->name);
+
+		if (len + 1 + name_len >= PATH_MAX)
+			continue;
+		path[len] = '/';
+		memcpy(path + len + 1, kid->name, name_len + 1);
+		res = walk_node(kid, path, len + 1 + name_len, post, fn, arg);
+		path[len] = '\0';
+		if (res != 0)
+			return res;
+	}
+	return post ? fn(&e, arg) : 0;
+}
+
+int oplog_walk(struct oplog_tree *t, const char *path, int post,
+	       oplog_walk_fn fn, void *arg)
+{
+	char buf[PATH_MAX];
+	struct node *n = lookup(t, path, strlen(path));
+
+	if (n == NULL)
+		return -ENOENT;
+	return walk_node(n, buf, node_path(n, buf), post, fn, arg);
+}
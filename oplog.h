@@ -0,0 +1,77 @@
+/**
+ * \file oplog.h
+ * \date October 2026
+ *
+ * The namespace log of versfs.  File contents are versioned in the history
+ * (vstore.h); the rest of the tree -- which directories, files, symbolic
+ * links and hard links exist, with their permissions and owners -- is kept
+ * as an append-only log of the operations that changed it, in .versfs/oplog
+ * in the storage directory.
+ *
+ * The log is made of segments.  Segment S is a snapshot, S.snap, of the tree
+ * when the segment began, and a log, S.log, of the operations since.  Once a
+ * log holds a set number of records it is sealed and a new segment begun;
+ * the new snapshot is worked out in the background by replaying the sealed
+ * snapshot and log, never by walking the live tree.  The tree at any time is
+ * therefore rebuilt from one snapshot and about one segment of operations.
+ */
+
+#ifndef OPLOG_H
+#define OPLOG_H
+
+#include <sys/types.h>
+#include <time.h>
+
+enum oplog_op {
+	OPLOG_CREATE = 1,	/* regular file, fifo, device or socket */
+	OPLOG_MKDIR,
+	OPLOG_SYMLINK,
+	OPLOG_LINK,		/* a new hard link path to arg */
+	OPLOG_UNLINK,
+	OPLOG_RMDIR,
+	OPLOG_RENAME,		/* arg renamed to path */
+	OPLOG_SETATTR		/* a new mode or owner */
+};
+
+/* Open the log of the tree in storage_dir for appending, starting it with a
+   snapshot of the live tree if there is none.  A segment is sealed after
+   compact_records records; 0 keeps a single segment.  Returns 0 or -errno. */
+int oplog_open(const char *storage_dir, unsigned compact_records);
+
+/* Wait for any compaction to finish and close the log. */
+void oplog_close(void);
+
+/* Operations must be logged in the order they were done, so callers hold
+   this lock from the system call until oplog_record() returns. */
+void oplog_lock(void);
+void oplog_unlock(void);
+
+/* Log op, just done to path (a path in the storage directory; arg is the
+   source for OPLOG_LINK and OPLOG_RENAME).  The mode, owner and link target
+   are read back from path.  Does nothing if no log is open. */
+void oplog_record(enum oplog_op op, const char *path, const char *arg);
+
+/* The tree as it was at the end of second when, rebuilt from the log. */
+struct oplog_tree;
+
+struct oplog_entry {
+	const char *path;	/* in the mount point */
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	const char *target;	/* symbolic links only */
+};
+
+/* Returns NULL with errno set on failure.  Times before the log began give
+   the tree as the log first saw it. */
+struct oplog_tree *oplog_replay(const char *storage_dir, time_t when);
+void oplog_tree_free(struct oplog_tree *t);
+
+/* Call fn for path and everything below it in t, parents before children,
+   or children before parents if post.  Stops at, and returns, the first
+   non-zero result of fn.  Returns -ENOENT if t has no path. */
+typedef int (*oplog_walk_fn)(const struct oplog_entry *e, void *arg);
+int oplog_walk(struct oplog_tree *t, const char *path, int post,
+	       oplog_walk_fn fn, void *arg);
+
+#endif /* OPLOG_H */
@@ -0,0 +1,721 @@
+/**
+ * \file passthrough.h
+ * \date October 2026
+ *
+ * The passthrough operations that mirrorfs, caesarfs and versfs share: each
+ * passes an operation on a path in the mount point to the same path under
+ * the storage directory.  A file system defines the hooks it needs and then
+ * includes this file once, after <fuse.h>, and gets static pt_* operations
+ * built with its hooks in place: there are no function pointers, and a hook
+ * left at its default compiles to nothing.  Operations a file system does
+ * differently it writes itself, calling pt_* for the passthrough part.
+ *
+ *   PT_RESERVED(path)   non-zero for a path that is the file system's own
+ *                       rather than the storage tree's (versfs: /.versfs);
+ *                       changing it fails with EROFS
+ *   PT_CHANGED()        after anything that can change attributes
+ *   PT_ATTRCACHE        1 to serve getattr from the attribute cache of
+ *                       attrcache.h, filled by readdir
+ *   PT_NS_LOCK(), PT_NS_UNLOCK(), PT_NS_RECORD(op, path, arg)
+ *                       around and after a change to the namespace, with op
+ *                       one of CREATE, MKDIR, SYMLINK, LINK, UNLINK, RMDIR,
+ *                       RENAME or SETATTR and the storage paths of oplog.h
+ *   PT_OPEN_FLAGS(flags) the flags to open a storage file with
+ *   PT_READ(fd, buf, size, off), PT_WRITE(fd, buf, size, off)
+ *                       file data in and out, -errno on failure
+ *   PT_ZERO_COPY        1 to hand file data to libfuse as the storage file
+ *                       itself (pt_read_buf(), pt_write_buf()), for a file
+ *                       system that passes it through untouched
+ *
+ * PT_OPERATIONS fills in a struct fuse_operations with all of them.
+ */
+
+#ifndef PASSTHROUGH_H
+#define PASSTHROUGH_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "attrcache.h"
+#include "gsync.h"
+#include "iobackend.h"
+#ifdef HAVE_SETXATTR
+#include <sys/xattr.h>
+#endif
+
+#if defined(PT_ZERO_COPY) && PT_ZERO_COPY && (defined(PT_READ) || defined(PT_WRITE))
+#error "PT_ZERO_COPY passes file data through untouched"
+#endif
+
+#ifndef PT_RESERVED
+#define PT_RESERVED(path) 0
+#endif
+#ifndef PT_CHANGED
+#define PT_CHANGED() ((void) 0)
+#endif
+#ifndef PT_ATTRCACHE
+#define PT_ATTRCACHE 0
+#endif
+#ifndef PT_NS_LOCK
+#define PT_NS_LOCK() ((void) 0)
+#define PT_NS_UNLOCK() ((void) 0)
+#define PT_NS_RECORD(op, path, arg) ((void) 0)
+#endif
+#ifndef PT_OPEN_FLAGS
+#define PT_OPEN_FLAGS(flags) (flags)
+#endif
+#ifndef PT_READ
+#define PT_READ(fd, buf, size, off) iob_pread(fd, buf, size, off)
+#endif
+#ifndef PT_WRITE
+#define PT_WRITE(fd, buf, size, off) iob_pwrite(fd, buf, size, off)
+#endif
+#ifndef PT_ZERO_COPY
+#define PT_ZERO_COPY 0
+#endif
+
+/* read_buf and write_buf came with FUSE 2.9. */
+#if FUSE_VERSION >= 29
+#define PT_HAVE_BUF 1
+#else
+#define PT_HAVE_BUF 0
+#endif
+
+/* Every operation is defined whether or not the file system uses it. */
+#define PT_OP static __attribute__((unused))
+
+static char* storage_dir = NULL;
+
+/* Options placed ahead of the user's own, so that a later -o max_write=,
+   max_read= or max_readahead= on the command line overrides them.  libfuse
+   clamps max_write to the largest request the kernel can deliver. */
+#define DEFAULT_MOUNT_OPTS "-obig_writes,max_write=1048576,max_readahead=1048576"
+
+/* For the init callback: big writes are asked for here as well, which
+   covers mounts that override the default options.  The request size is
+   still capped by max_write and by what the kernel and libfuse support. */
+#define PT_WANT_BIG_WRITES(conn) ((conn)->want |= FUSE_CAP_BIG_WRITES)
+
+
+static char* prepend_storage_dir (char* pre_path, const char* path) {
+  strcpy(pre_path, storage_dir);
+  strcat(pre_path, path);
+  return pre_path;
+}
+
+
+PT_OP int pt_getattr(const char *path, struct stat *stbuf)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+#if PT_ATTRCACHE
+	if (attrcache_take(path, stbuf) == 0)
+		return 0;
+#endif
+
+	path = prepend_storage_dir(storage_path, path);
+	res = lstat(path, stbuf);
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_access(const char *path, int mask)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	path = prepend_storage_dir(storage_path, path);
+	res = access(path, mask);
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_readlink(const char *path, char *buf, size_t size)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EINVAL;
+
+	path = prepend_storage_dir(storage_path, path);
+	res = readlink(path, buf, size - 1);
+	if (res == -1)
+		return -errno;
+
+	buf[res] = '\0';
+	return 0;
+}
+
+
+PT_OP int pt_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+		     off_t offset, struct fuse_file_info *fi)
+{
+	char storage_path[PATH_MAX];
+	DIR *dp;
+	struct dirent *de;
+#if PT_ATTRCACHE
+	unsigned generation = attrcache_generation();
+	char entry_path[PATH_MAX];
+	size_t path_len = strcmp(path, "/") == 0 ? 0 : strlen(path);
+
+	memcpy(entry_path, path, path_len);
+	entry_path[path_len] = '/';
+#endif
+
+	(void) offset;
+	(void) fi;
+
+	path = prepend_storage_dir(storage_path, path);
+	dp = opendir(path);
+	if (dp == NULL)
+		return -errno;
+
+	while ((de = readdir(dp)) != NULL) {
+		struct stat st;
+
+#if PT_ATTRCACHE
+		// Full attributes, relative to the open directory rather than by
+		// path, and parked for the getattr that usually follows.
+		if (fstatat(dirfd(dp), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+			if (path_len + strlen(de->d_name) + 2 <= PATH_MAX &&
+			    strcmp(de->d_name, ".") != 0 &&
+			    strcmp(de->d_name, "..") != 0) {
+				strcpy(entry_path + path_len + 1, de->d_name);
+				attrcache_put(entry_path, &st, generation);
+			}
+		} else
+#endif
+		{
+			memset(&st, 0, sizeof(st));
+			st.st_ino = de->d_ino;
+			st.st_mode = de->d_type << 12;
+		}
+		if (filler(buf, de->d_name, &st, 0))
+			break;
+	}
+
+	closedir(dp);
+	return 0;
+}
+
+PT_OP int pt_mknod(const char *path, mode_t mode, dev_t rdev)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	/* On Linux this could just be 'mknod(path, mode, rdev)' but this
+	   is more portable */
+	path = prepend_storage_dir(storage_path, path);
+	PT_NS_LOCK();
+	if (S_ISREG(mode)) {
+		res = open(path, O_CREAT | O_EXCL | O_WRONLY, mode);
+		if (res >= 0)
+			res = close(res);
+	} else if (S_ISFIFO(mode))
+		res = mkfifo(path, mode);
+	else
+		res = mknod(path, mode, rdev);
+	if (res == 0)
+		PT_NS_RECORD(CREATE, path, NULL);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_mkdir(const char *path, mode_t mode)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	PT_NS_LOCK();
+	res = mkdir(path, mode);
+	if (res == 0)
+		PT_NS_RECORD(MKDIR, path, NULL);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_unlink(const char *path)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	PT_NS_LOCK();
+	res = unlink(path);
+	if (res == 0)
+		PT_NS_RECORD(UNLINK, path, NULL);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_rmdir(const char *path)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	PT_NS_LOCK();
+	res = rmdir(path);
+	if (res == 0)
+		PT_NS_RECORD(RMDIR, path, NULL);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_symlink(const char *from, const char *to)
+{
+	int res;
+	char storage_from[PATH_MAX];
+	char storage_to[PATH_MAX];
+
+	if (PT_RESERVED(to))
+		return -EROFS;
+
+	prepend_storage_dir(storage_from, from);
+	prepend_storage_dir(storage_to,   to  );
+	PT_NS_LOCK();
+	res = symlink(storage_from, storage_to);
+	if (res == 0)
+		PT_NS_RECORD(SYMLINK, storage_to, NULL);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_rename(const char *from, const char *to)
+{
+	int res;
+	char storage_from[PATH_MAX];
+	char storage_to[PATH_MAX];
+
+	if (PT_RESERVED(from) || PT_RESERVED(to))
+		return -EROFS;
+
+	prepend_storage_dir(storage_from, from);
+	prepend_storage_dir(storage_to,   to  );
+	PT_NS_LOCK();
+	res = rename(storage_from, storage_to);
+	if (res == 0)
+		PT_NS_RECORD(RENAME, storage_to, storage_from);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_link(const char *from, const char *to)
+{
+	int res;
+	char storage_from[PATH_MAX];
+	char storage_to[PATH_MAX];
+
+	if (PT_RESERVED(from) || PT_RESERVED(to))
+		return -EROFS;
+
+	prepend_storage_dir(storage_from, from);
+	prepend_storage_dir(storage_to,   to  );
+	PT_NS_LOCK();
+	res = link(storage_from, storage_to);
+	if (res == 0)
+		PT_NS_RECORD(LINK, storage_to, storage_from);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_chmod(const char *path, mode_t mode)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	PT_NS_LOCK();
+	res = chmod(path, mode);
+	if (res == 0)
+		PT_NS_RECORD(SETATTR, path, NULL);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_chown(const char *path, uid_t uid, gid_t gid)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	PT_NS_LOCK();
+	res = lchown(path, uid, gid);
+	if (res == 0)
+		PT_NS_RECORD(SETATTR, path, NULL);
+	PT_NS_UNLOCK();
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_truncate(const char *path, off_t size)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	res = truncate(path, size);
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+#ifdef HAVE_UTIMENSAT
+PT_OP int pt_utimens(const char *path, const struct timespec ts[2])
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	/* don't use utime/utimes since they follow symlinks */
+	path = prepend_storage_dir(storage_path, path);
+	res = utimensat(0, path, ts, AT_SYMLINK_NOFOLLOW);
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+#endif
+
+PT_OP int pt_open(const char *path, struct fuse_file_info *fi)
+{
+	char storage_path[PATH_MAX];
+	int res;
+	int flags;
+
+	// The kernel works out the offset of every write itself, O_APPEND
+	// included, so the storage file is opened without it; pwrite() would
+	// otherwise ignore the offset.
+	flags = PT_OPEN_FLAGS(fi->flags & ~O_APPEND);
+
+	path = prepend_storage_dir(storage_path, path);
+	res = open(path, flags);
+	if (res == -1)
+		return -errno;
+
+	// Kept open until release, so reads and writes need no open()/close().
+	fi->fh = res;
+
+	return 0;
+}
+
+PT_OP int pt_read(const char *path, char *buf, size_t size, off_t offset,
+		  struct fuse_file_info *fi)
+{
+	(void) path;
+
+	// Read straight into the provided buffer; with big writes enabled a
+	// request can be up to max_write bytes, too large for a stack copy.
+	return PT_READ(fi->fh, buf, size, offset);
+}
+
+PT_OP int pt_write(const char *path, const char *buf, size_t size,
+		   off_t offset, struct fuse_file_info *fi)
+{
+	int res;
+
+	(void) path;
+
+	res = PT_WRITE(fi->fh, buf, size, offset);
+	PT_CHANGED();
+	return res;
+}
+
+#if PT_HAVE_BUF
+/* A read answered with the storage file rather than its data.  Where the
+   connection allows splicing (FUSE_CAP_SPLICE_WRITE), libfuse moves the
+   bytes from the file to the kernel through a pipe, never copying them
+   into this process; otherwise it reads them itself. */
+PT_OP int pt_read_buf(const char *path, struct fuse_bufvec **bufp,
+		      size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec *src;
+
+	(void) path;
+	src = malloc(sizeof(*src));
+	if (src == NULL)
+		return -ENOMEM;
+	*src = FUSE_BUFVEC_INIT(size);
+	src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	src->buf[0].fd = fi->fh;
+	src->buf[0].pos = offset;
+	*bufp = src;
+	return 0;
+}
+
+/* A write whose data may still be in the pipe it was spliced into from the
+   kernel (FUSE_CAP_SPLICE_READ), spliced on into the storage file. */
+PT_OP int pt_write_buf(const char *path, struct fuse_bufvec *buf,
+		       off_t offset, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+	ssize_t res;
+
+	(void) path;
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = fi->fh;
+	dst.buf[0].pos = offset;
+	res = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+	PT_CHANGED();
+	return res;
+}
+#endif
+
+PT_OP int pt_statfs(const char *path, struct statvfs *stbuf)
+{
+	char storage_path[PATH_MAX];
+	int res;
+
+	if (PT_RESERVED(path))
+		path = "/";
+	path = prepend_storage_dir(storage_path, path);
+	res = statvfs(path, stbuf);
+	if (res == -1)
+		return -errno;
+
+	return 0;
+}
+
+PT_OP int pt_release(const char *path, struct fuse_file_info *fi)
+{
+	(void) path;
+	close(fi->fh);
+	return 0;
+}
+
+/* Concurrent fsync() calls are batched into group commits (gsync.h). */
+PT_OP int pt_fsync(const char *path, int isdatasync,
+		   struct fuse_file_info *fi)
+{
+	(void) path;
+	return gsync(fi->fh, isdatasync ? GSYNC_DATA : 0);
+}
+
+PT_OP int pt_fsyncdir(const char *path, int isdatasync,
+		      struct fuse_file_info *fi)
+{
+	char storage_path[PATH_MAX];
+	int fd;
+	int res;
+
+	(void) fi;
+	path = prepend_storage_dir(storage_path, path);
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return -errno;
+	res = gsync(fd, isdatasync ? GSYNC_DATA : 0);
+	close(fd);
+	return res;
+}
+
+#ifdef HAVE_POSIX_FALLOCATE
+PT_OP int pt_fallocate(const char *path, int mode,
+		       off_t offset, off_t length, struct fuse_file_info *fi)
+{
+	(void) path;
+
+	int res;
+
+	if (mode)
+		return -EOPNOTSUPP;
+
+	res = -posix_fallocate(fi->fh, offset, length);
+	PT_CHANGED();
+	return res;
+}
+#endif
+
+#ifdef HAVE_SETXATTR
+/* xattr operations are optional and can safely be left unimplemented */
+PT_OP int pt_setxattr(const char *path, const char *name, const char *value,
+		      size_t size, int flags)
+{
+	char storage_path[PATH_MAX];
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	int res = lsetxattr(path, name, value, size, flags);
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+	return 0;
+}
+
+PT_OP int pt_getxattr(const char *path, const char *name, char *value,
+		      size_t size)
+{
+	char storage_path[PATH_MAX];
+
+	if (PT_RESERVED(path))
+		return -ENODATA;
+
+	path = prepend_storage_dir(storage_path, path);
+	int res = lgetxattr(path, name, value, size);
+	if (res == -1)
+		return -errno;
+	return res;
+}
+
+PT_OP int pt_listxattr(const char *path, char *list, size_t size)
+{
+	char storage_path[PATH_MAX];
+
+	if (PT_RESERVED(path))
+		return 0;
+
+	path = prepend_storage_dir(storage_path, path);
+	int res = llistxattr(path, list, size);
+	if (res == -1)
+		return -errno;
+	return res;
+}
+
+PT_OP int pt_removexattr(const char *path, const char *name)
+{
+	char storage_path[PATH_MAX];
+
+	if (PT_RESERVED(path))
+		return -EROFS;
+
+	path = prepend_storage_dir(storage_path, path);
+	int res = lremovexattr(path, name);
+	PT_CHANGED();
+	if (res == -1)
+		return -errno;
+	return 0;
+}
+#endif /* HAVE_SETXATTR */
+
+#ifdef HAVE_UTIMENSAT
+#define PT_OPERATIONS_UTIMENS	.utimens	= pt_utimens,
+#else
+#define PT_OPERATIONS_UTIMENS
+#endif
+#ifdef HAVE_POSIX_FALLOCATE
+#define PT_OPERATIONS_FALLOCATE	.fallocate	= pt_fallocate,
+#else
+#define PT_OPERATIONS_FALLOCATE
+#endif
+#ifdef HAVE_SETXATTR
+#define PT_OPERATIONS_XATTR				\
+	.setxattr	= pt_setxattr,			\
+	.getxattr	= pt_getxattr,			\
+	.listxattr	= pt_listxattr,			\
+	.removexattr	= pt_removexattr,
+#else
+#define PT_OPERATIONS_XATTR
+#endif
+
+#if PT_ZERO_COPY && PT_HAVE_BUF
+#define PT_OPERATIONS_BUF				\
+	.read_buf	= pt_read_buf,			\
+	.write_buf	= pt_write_buf,
+#else
+#define PT_OPERATIONS_BUF
+#endif
+
+#define PT_OPERATIONS					\
+	.getattr	= pt_getattr,			\
+	.access		= pt_access,			\
+	.readlink	= pt_readlink,			\
+	.readdir	= pt_readdir,			\
+	.mknod		= pt_mknod,			\
+	.mkdir		= pt_mkdir,			\
+	.symlink	= pt_symlink,			\
+	.unlink		= pt_unlink,			\
+	.rmdir		= pt_rmdir,			\
+	.rename		= pt_rename,			\
+	.link		= pt_link,			\
+	.chmod		= pt_chmod,			\
+	.chown		= pt_chown,			\
+	.truncate	= pt_truncate,			\
+	PT_OPERATIONS_UTIMENS				\
+	.open		= pt_open,			\
+	.read		= pt_read,			\
+	.write		= pt_write,			\
+	PT_OPERATIONS_BUF				\
+	.statfs		= pt_statfs,			\
+	.release	= pt_release,			\
+	.fsync		= pt_fsync,			\
+	.fsyncdir	= pt_fsyncdir,			\
+	PT_OPERATIONS_FALLOCATE				\
+	PT_OPERATIONS_XATTR
+
+#endif /* PASSTHROUGH_H */
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Rename a directory while a write to a file below it is still buffered,
+# and check that the write is stored as a version under the new name.
+#
+# versfs is mounted with a long flush interval so that the write stays in
+# its buffer until the directory is renamed.  The file is closed after the
+# rename; its history must then be under the new name, hold the write, and
+# nothing may be left under the old one.
+#
+# USAGE: sh rename_check.sh
+
+STG=${PWD}/rename_stg
+MNT=${PWD}/rename_mnt
+FAILED=0
+
+fail () {
+  echo "FAIL $1"
+  FAILED=1
+}
+
+rm -rf "$STG" "$MNT"
+mkdir -p "$STG" "$MNT"
+./versfs "$STG" "$MNT" -o flush_ms=60000
+sleep 1
+
+mkdir "$MNT/d"
+exec 3> "$MNT/d/f"
+printf hello >&3
+mv "$MNT/d" "$MNT/e" || fail "rename"
+exec 3>&-
+
+[ "$(cat "$MNT/e/f")" = hello ] || fail "file reads back wrong"
+newest=$(ls "$MNT/.versfs/history/e/f" 2> /dev/null | sort -n | tail -n 1)
+if [ -z "$newest" ]; then
+  fail "no versions under the new name"
+elif [ "$(cat "$MNT/.versfs/history/e/f/$newest")" != hello ]; then
+  fail "newest version does not hold the write"
+fi
+[ -e "$STG/.versfs/history/d" ] && fail "history left under the old name"
+[ $FAILED = 0 ] && echo "ok   buffered write stored under the new name"
+
+fusermount -u "$MNT"
+rm -rf "$STG" "$MNT"
+exit $FAILED
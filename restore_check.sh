@@ -0,0 +1,48 @@
+#!/bin/sh
+# Append to a versfs file and restore it, and its directory, to the time
+# of the version before the append.
+#
+# An append adds its bytes to the base file of the version before it, so
+# the check is that the base keeps the time that version was made: a
+# restore by time picks versions by the time they were made, and must find
+# the first one again, both for the file and for a directory above it.
+#
+# USAGE: sh restore_check.sh
+
+STG=${PWD}/restore_stg
+MNT=${PWD}/restore_mnt
+FAILED=0
+
+check () {
+  what=$1
+  target=$2
+  printf 'again\n' >> "$MNT/d/f"
+  if ! setfattr -n user.versfs.restore -v "@$t1" "$target"; then
+    echo "FAIL $what: restore refused"
+    FAILED=1
+  elif [ "$(cat "$MNT/d/f")" != hello ]; then
+    echo "FAIL $what: file reads back wrong"
+    FAILED=1
+  else
+    echo "ok   $what"
+  fi
+}
+
+rm -rf "$STG" "$MNT"
+mkdir -p "$STG" "$MNT"
+./versfs "$STG" "$MNT"
+sleep 1
+
+mkdir "$MNT/d"
+printf 'hello\n' > "$MNT/d/f"
+sleep 1
+t1=$(date +%s)
+sleep 2
+printf 'world\n' >> "$MNT/d/f"
+
+check "file restore @t(v0)" "$MNT/d/f"
+check "directory restore @t(v0)" "$MNT/d"
+
+fusermount -u "$MNT"
+rm -rf "$STG" "$MNT"
+exit $FAILED
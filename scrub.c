@@ -0,0 +1,264 @@
+/**
+ * \file scrub.c
+ * \date October 2026
+ *
+ * The scrubber thread.  It paces itself against the clock: after each chunk
+ * it sleeps until the bytes read so far in the pass fit the rate, on a
+ * condition variable so that scrub_stop() need not wait for the sleep.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "scrub.h"
+#include "vstore.h"
+
+/* Bad versions listed in the stats, the latest found. */
+#define SCRUB_LIST 16
+
+static pthread_mutex_t scrub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  scrub_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t       scrubber;
+static int             scrubber_started = 0;
+static int             scrubber_stop = 0;
+
+static char           *root = NULL;
+static size_t          root_len = 0;
+static double          rate = 0;	/* bytes a second */
+static unsigned        interval = 0;
+
+/* Under scrub_lock. */
+static unsigned long long passes = 0;
+static unsigned long long versions = 0;
+static unsigned long long bytes = 0;
+static unsigned long long bad = 0;
+static char              *bad_list[SCRUB_LIST];
+static int                bad_next = 0;
+
+/* Of the pass under way; the scrubber's own. */
+static struct timespec    pass_start;
+static double             pass_bytes = 0;
+
+static void add_seconds(struct timespec *ts, double s)
+{
+	ts->tv_sec += (time_t) s;
+	ts->tv_nsec += (long) ((s - (time_t) s) * 1e9);
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* Sleep until deadline (CLOCK_REALTIME) or scrub_stop().  Returns non-zero
+   if stopping. */
+static int sleep_until(const struct timespec *deadline)
+{
+	int stop;
+
+	pthread_mutex_lock(&scrub_lock);
+	while (!scrubber_stop &&
+	       pthread_cond_timedwait(&scrub_wake, &scrub_lock, deadline) !=
+	       ETIMEDOUT)
+		;
+	stop = scrubber_stop;
+	pthread_mutex_unlock(&scrub_lock);
+	return stop;
+}
+
+static int pace(size_t n)
+{
+	struct timespec now, due = pass_start;
+
+	pass_bytes += n;
+	pthread_mutex_lock(&scrub_lock);
+	bytes += n;
+	pthread_mutex_unlock(&scrub_lock);
+
+	add_seconds(&due, pass_bytes / rate);
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (now.tv_sec > due.tv_sec ||
+	    (now.tv_sec == due.tv_sec && now.tv_nsec >= due.tv_nsec))
+		return __atomic_load_n(&scrubber_stop, __ATOMIC_RELAXED);
+	return sleep_until(&due);
+}
+
+static int is_version(const char *name)
+{
+	if (*name == '\0')
+		return 0;
+	while (*name >= '0' && *name <= '9')
+		name += 1;
+	return *name == '\0';
+}
+
+/* Check every version in the history directory dir and those below it.
+   Returns non-zero if stopping. */
+static int scrub_dir(const char *dir)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	DIR *dp = opendir(dir);
+	int stop = 0;
+
+	if (dp == NULL)
+		return __atomic_load_n(&scrubber_stop, __ATOMIC_RELAXED);
+	while (!stop && (de = readdir(dp)) != NULL) {
+		off_t bad_off;
+		int res;
+
+		if (de->d_name[0] == '.' ||
+		    snprintf(path, sizeof(path), "%s/%s", dir,
+			     de->d_name) >= (int) sizeof(path) ||
+		    lstat(path, &st) == -1)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			stop = scrub_dir(path);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode) || !is_version(de->d_name))
+			continue;
+
+		res = vstore_verify(path, pace, &bad_off);
+		if (res != -ENOENT) {
+			pthread_mutex_lock(&scrub_lock);
+			versions += 1;
+			pthread_mutex_unlock(&scrub_lock);
+		}
+		if (res == -EIO)
+			scrub_report(path, bad_off);
+		stop = __atomic_load_n(&scrubber_stop, __ATOMIC_RELAXED);
+	}
+	closedir(dp);
+	return stop;
+}
+
+static void *scrubber_main(void *arg)
+{
+	struct timespec next;
+
+	(void) arg;
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &pass_start);
+		pass_bytes = 0;
+		if (scrub_dir(root))
+			break;
+		pthread_mutex_lock(&scrub_lock);
+		passes += 1;
+		pthread_mutex_unlock(&scrub_lock);
+
+		next = pass_start;
+		add_seconds(&next, interval);
+		if (sleep_until(&next))
+			break;
+	}
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+int scrub_start(const char *history_root, unsigned mb_per_s,
+		unsigned interval_s)
+{
+	int res;
+
+	root = strdup(history_root);
+	if (root == NULL)
+		return -ENOMEM;
+	root_len = strlen(root);
+	rate = (double) mb_per_s * 1024 * 1024;
+	interval = interval_s;
+	if (mb_per_s == 0)
+		return 0;	/* Reads are still checked and reported. */
+
+	scrubber_stop = 0;
+	res = pthread_create(&scrubber, NULL, scrubber_main, NULL);
+	if (res != 0)
+		return -res;
+	scrubber_started = 1;
+	return 0;
+}
+
+void scrub_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&scrub_lock);
+	__atomic_store_n(&scrubber_stop, 1, __ATOMIC_RELAXED);
+	pthread_cond_signal(&scrub_wake);
+	pthread_mutex_unlock(&scrub_lock);
+	if (scrubber_started)
+		pthread_join(scrubber, NULL);
+	scrubber_started = 0;
+
+	pthread_mutex_lock(&scrub_lock);
+	for (i = 0; i < SCRUB_LIST; i += 1) {
+		free(bad_list[i]);
+		bad_list[i] = NULL;
+	}
+	pthread_mutex_unlock(&scrub_lock);
+	free(root);
+	root = NULL;
+}
+
+void scrub_report(const char *version_path, off_t off)
+{
+	const char *name = version_path;
+	char *copy;
+	int i;
+
+	// Named from the history root, where they lie under it.
+	if (root != NULL && strncmp(name, root, root_len) == 0 &&
+	    name[root_len] == '/')
+		name += root_len;
+
+	pthread_mutex_lock(&scrub_lock);
+	for (i = 0; i < SCRUB_LIST; i += 1) {
+		if (bad_list[i] != NULL && strcmp(bad_list[i], name) == 0) {
+			pthread_mutex_unlock(&scrub_lock);
+			return;
+		}
+	}
+	copy = strdup(name);
+	if (copy != NULL) {
+		free(bad_list[bad_next]);
+		bad_list[bad_next] = copy;
+		bad_next = (bad_next + 1) % SCRUB_LIST;
+	}
+	bad += 1;
+	pthread_mutex_unlock(&scrub_lock);
+
+	fprintf(stderr, "ERROR: %s: checksum mismatch at byte %lld\n",
+		version_path, (long long) off);
+}
+
+size_t scrub_stats(char *buf, size_t size)
+{
+	size_t len;
+	int i;
+
+	pthread_mutex_lock(&scrub_lock);
+	len = snprintf(buf, size,
+		       "scrub_passes %llu\n"
+		       "scrub_versions_checked %llu\n"
+		       "scrub_bytes_checked %llu\n"
+		       "bad_versions %llu\n",
+		       passes, versions, bytes, bad);
+	// Oldest first.
+	for (i = 0; i < SCRUB_LIST && len < size; i += 1) {
+		const char *name = bad_list[(bad_next + i) % SCRUB_LIST];
+		if (name != NULL)
+			len += snprintf(buf + len, size - len, "bad_version %s\n",
+					name);
+	}
+	pthread_mutex_unlock(&scrub_lock);
+	return len < size ? len : size - 1;
+}
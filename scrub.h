@@ -0,0 +1,37 @@
+/**
+ * \file scrub.h
+ * \date October 2026
+ *
+ * Background verification of stored versions.  A thread walks the history
+ * tree and checks every data file that has checksums (vstore.h), at a
+ * bounded rate so that it leaves the disk to the file system's own I/O, and
+ * starts over after an interval.  Bad versions it finds, or that reads
+ * through the history view run into, are counted, and the latest listed,
+ * for /.versfs/stats.
+ */
+
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Start scrubbing the histories under history_root, reading at most
+   mb_per_s MiB a second, with a pass at once and then every interval_s
+   seconds; with mb_per_s 0 there is no thread, and only reports are
+   counted.  Returns 0, or -errno if the thread cannot be started. */
+int scrub_start(const char *history_root, unsigned mb_per_s,
+		unsigned interval_s);
+
+/* Stop the thread, abandoning the pass under way. */
+void scrub_stop(void);
+
+/* Note that the data file version_path failed its checksum at off.  Each
+   file is counted once however often it is reported. */
+void scrub_report(const char *version_path, off_t off);
+
+/* Write the scrubber's counters and the bad versions found into buf, as
+   "name value" lines.  Returns their length. */
+size_t scrub_stats(char *buf, size_t size);
+
+#endif /* SCRUB_H */
@@ -0,0 +1,190 @@
+/**
+ * \file soak_bench.c
+ * \date October 2026
+ *
+ * Long-running churn against a mount point while watching the file system
+ * daemon's memory.  Threads loop over a few files each, writing chunks of
+ * 1 to 128 KiB at random offsets and now and then truncating, renaming or
+ * deleting them; deleting throws away the history too, so disk use stays
+ * bounded however long it runs.  Every few seconds the resident set size
+ * of the daemon (VmRSS of the given process) is printed, and at the end its
+ * growth since warm-up, which for a daemon that frees what it allocates
+ * stays close to zero.
+ *
+ * USAGE: soak_bench <directory> <daemon pid> [ seconds ] [ threads ]
+ *        e.g. ./soak_bench mnt $(pgrep -n versfs) 600
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILES_PER_THREAD 8
+#define MAX_CHUNK        (128 * 1024)
+#define MAX_FILE         (1024 * 1024)
+#define SAMPLE_SECONDS   5
+
+struct worker {
+  const char* dir;
+  int id;
+  unsigned seed;
+  long ops;			/* atomic */
+  int failed;
+};
+
+static volatile int stop = 0;
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* VmRSS of pid in KiB, or -1. */
+static long rss_kib (int pid) {
+  char path[64], line[256];
+  long kib = -1;
+  FILE* f;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (sscanf(line, "VmRSS: %ld", &kib) == 1)
+      break;
+  fclose(f);
+  return kib;
+}
+
+/* One operation on one of the worker's files.  Returns 0 or -errno; a
+   missing file (deleted or renamed away earlier) is not an error. */
+static int churn (struct worker* w, char* chunk) {
+  char path[4096], other[4096];
+  int file = rand_r(&w->seed) % FILES_PER_THREAD;
+  int what = rand_r(&w->seed) % 100;
+  int fd, res = 0;
+
+  snprintf(path, sizeof(path), "%s/soak.%d.%d", w->dir, w->id, file);
+  if (what < 80) {
+    size_t size = 1 + rand_r(&w->seed) % MAX_CHUNK;
+    off_t off = rand_r(&w->seed) % (MAX_FILE - MAX_CHUNK);
+    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd == -1)
+      return -errno;
+    if (pwrite(fd, chunk, size, off) != (ssize_t) size)
+      res = -errno;
+    if (close(fd) == -1 && res == 0)
+      res = -errno;
+  } else if (what < 88) {
+    if (truncate(path, rand_r(&w->seed) % MAX_FILE) == -1 && errno != ENOENT)
+      res = -errno;
+  } else if (what < 94) {
+    snprintf(other, sizeof(other), "%s/soak.%d.%d", w->dir, w->id,
+	     rand_r(&w->seed) % FILES_PER_THREAD);
+    if (rename(path, other) == -1 && errno != ENOENT)
+      res = -errno;
+  } else {
+    if (unlink(path) == -1 && errno != ENOENT)
+      res = -errno;
+  }
+  return res;
+}
+
+static void* worker_main (void* arg) {
+  struct worker* w = arg;
+  char* chunk = malloc(MAX_CHUNK);
+
+  if (chunk == NULL) {
+    w->failed = 1;
+    return NULL;
+  }
+  memset(chunk, 'a' + w->id % 26, MAX_CHUNK);
+  while (!stop) {
+    int res = churn(w, chunk);
+    if (res < 0) {
+      fprintf(stderr, "ERROR: worker %d: %s\n", w->id, strerror(-res));
+      w->failed = 1;
+      break;
+    }
+    __atomic_add_fetch(&w->ops, 1, __ATOMIC_RELAXED);
+  }
+  free(chunk);
+  return NULL;
+}
+
+int main (int argc, char* argv[]) {
+  const char* dir;
+  int pid, seconds, threads, failed = 0;
+  long rss, warm_rss = -1, max_rss = 0, last_rss = -1;
+  double start;
+
+  if (argc < 3 || argc > 5) {
+    fprintf(stderr,
+	    "USAGE: %s <directory> <daemon pid> [ seconds ] [ threads ]\n",
+	    argv[0]);
+    return 1;
+  }
+  dir = argv[1];
+  pid = atoi(argv[2]);
+  seconds = argc > 3 ? atoi(argv[3]) : 600;
+  threads = argc > 4 ? atoi(argv[4]) : 8;
+  if (rss_kib(pid) < 0) {
+    fprintf(stderr, "ERROR: Cannot read the memory use of process %d\n", pid);
+    return 1;
+  }
+  if (seconds < 1 || threads < 1) {
+    fprintf(stderr, "ERROR: seconds and threads must be positive\n");
+    return 1;
+  }
+
+  struct worker workers[threads];
+  pthread_t ids[threads];
+  for (int t = 0; t < threads; t += 1) {
+    workers[t] = (struct worker) { dir, t, (unsigned) t * 7919 + 1, 0, 0 };
+    if (pthread_create(&ids[t], NULL, worker_main, &workers[t]) != 0) {
+      fprintf(stderr, "ERROR: Cannot start thread %d\n", t);
+      exit(1);
+    }
+  }
+
+  printf("%8s %12s %12s\n", "seconds", "operations", "RSS (KiB)");
+  start = now();
+  while (now() - start < seconds) {
+    long ops = 0;
+    sleep(SAMPLE_SECONDS);
+    for (int t = 0; t < threads; t += 1)
+      ops += __atomic_load_n(&workers[t].ops, __ATOMIC_RELAXED);
+    rss = rss_kib(pid);
+    if (rss < 0) {
+      fprintf(stderr, "ERROR: Process %d is gone\n", pid);
+      failed = 1;
+      break;
+    }
+    // The first tenth of the run is warm-up: caches and arenas fill.
+    if (warm_rss < 0 && now() - start >= seconds / 10.0)
+      warm_rss = rss;
+    if (rss > max_rss)
+      max_rss = rss;
+    last_rss = rss;
+    printf("%8.0f %12ld %12ld\n", now() - start, ops, rss);
+    fflush(stdout);
+  }
+
+  stop = 1;
+  for (int t = 0; t < threads; t += 1) {
+    pthread_join(ids[t], NULL);
+    failed |= workers[t].failed;
+  }
+  if (warm_rss >= 0)
+    printf("RSS after warm-up %ld KiB, at the end %ld KiB (%+ld), peak %ld KiB\n",
+	   warm_rss, last_rss, last_rss - warm_rss, max_rss);
+  return failed;
+}
@@ -0,0 +1,215 @@
+/**
+ * \file stress_bench.c
+ * \date October 2026
+ *
+ * Many writers at once, run in a directory (normally a mount point):
+ *
+ *   private  Each thread rewrites a 64 KiB block of a file of its own.
+ *   shared   All threads rewrite blocks of one file, each its own block.
+ *
+ * Each runs with 1, 2, 4, ... up to the given number of threads, and reports
+ * writes per second and the speedup over one thread.  Private files should
+ * scale with the number of cores; the shared file shows what serialising
+ * one file's commits costs.  64 KiB writes are as large as versfs's default
+ * write buffer, so each goes straight through and makes a version.
+ *
+ * In a versfs mount the shared file's history (under /.versfs/history) is
+ * then checked: every write must have made exactly one version, numbered
+ * without gaps, and the newest must match the file.
+ *
+ * USAGE: stress_bench <directory> [ max threads ] [ writes per thread ]
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCK (64 * 1024)
+
+struct worker {
+  const char* path;		/* the file this thread writes */
+  int id;
+  int writes;
+  int failed;
+};
+
+static double now (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* worker_main (void* arg) {
+  struct worker* w = arg;
+  char* block = malloc(BLOCK);
+  off_t off = (off_t) w->id * BLOCK;
+  int fd;
+
+  fd = open(w->path, O_WRONLY);
+  if (block == NULL || fd == -1) {
+    fprintf(stderr, "ERROR: worker %d: %s\n", w->id, strerror(errno));
+    w->failed = 1;
+    free(block);
+    return NULL;
+  }
+  for (int i = 0; i < w->writes; i += 1) {
+    // Different contents every time, so that every version differs.
+    memset(block, 'a' + (w->id + i) % 26, BLOCK);
+    if (pwrite(fd, block, BLOCK, off) != BLOCK) {
+      fprintf(stderr, "ERROR: worker %d, write %d: %s\n", w->id, i,
+	      strerror(errno));
+      w->failed = 1;
+      break;
+    }
+  }
+  close(fd);
+  free(block);
+  return NULL;
+}
+
+/* Make path anew and empty.  Created rather than truncated, which in versfs
+   would make a version of its own. */
+static int fresh_file (const char* path) {
+  int fd;
+
+  if (unlink(path) == -1 && errno != ENOENT)
+    return -1;
+  fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd == -1)
+    return -1;
+  return close(fd);
+}
+
+/* Returns writes per second, or -1. */
+static double run (const char* dir, int shared, int threads, int writes) {
+  struct worker workers[threads];
+  pthread_t ids[threads];
+  char paths[threads][4096];
+  double start, elapsed;
+  int failed = 0;
+
+  for (int t = 0; t < threads; t += 1) {
+    if (shared)
+      snprintf(paths[t], sizeof(paths[t]), "%s/shared", dir);
+    else
+      snprintf(paths[t], sizeof(paths[t]), "%s/private.%d", dir, t);
+    if ((t == 0 || !shared) && fresh_file(paths[t]) == -1) {
+      fprintf(stderr, "ERROR: Cannot create %s: %s\n", paths[t],
+	      strerror(errno));
+      return -1;
+    }
+  }
+
+  start = now();
+  for (int t = 0; t < threads; t += 1) {
+    workers[t] = (struct worker) { paths[t], shared ? t : 0, writes, 0 };
+    if (pthread_create(&ids[t], NULL, worker_main, &workers[t]) != 0) {
+      fprintf(stderr, "ERROR: Cannot start thread %d\n", t);
+      exit(1);
+    }
+  }
+  for (int t = 0; t < threads; t += 1) {
+    pthread_join(ids[t], NULL);
+    failed |= workers[t].failed;
+  }
+  elapsed = now() - start;
+  return failed ? -1 : threads * writes / elapsed;
+}
+
+/* Check the versfs history of dir/shared after expected writes; skipped if
+   dir is not in a versfs mount.  Returns 0 if it is right or not there. */
+static int check_history (const char* dir, int expected) {
+  char hist[4096], path[4096 + 16];
+  char *newest, *live;
+  DIR* dp;
+  struct dirent* de;
+  int count = 0, max = -1, fd, res = 0;
+
+  snprintf(hist, sizeof(hist), "%s/.versfs/history/shared", dir);
+  dp = opendir(hist);
+  if (dp == NULL)
+    return 0;
+  while ((de = readdir(dp)) != NULL) {
+    if (de->d_name[0] == '.')
+      continue;
+    count += 1;
+    if (atoi(de->d_name) > max)
+      max = atoi(de->d_name);
+  }
+  closedir(dp);
+
+  if (count != expected || max != expected - 1) {
+    printf("history  %d versions, newest %d, for %d writes: WRONG\n",
+	   count, max, expected);
+    return 1;
+  }
+
+  // The newest version is the file as the last write left it.
+  newest = malloc(BLOCK * 64);
+  live = malloc(BLOCK * 64);
+  snprintf(path, sizeof(path), "%s/%d", hist, max);
+  if (newest != NULL && live != NULL && (fd = open(path, O_RDONLY)) != -1) {
+    ssize_t n = read(fd, newest, BLOCK * 64);
+    close(fd);
+    snprintf(path, sizeof(path), "%s/shared", dir);
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || read(fd, live, BLOCK * 64) != n ||
+	memcmp(newest, live, n) != 0)
+      res = 1;
+    if (fd != -1)
+      close(fd);
+  }
+  free(newest);
+  free(live);
+  printf("history  %d versions for %d writes, newest %s\n", count, expected,
+	 res ? "differs from the file: WRONG" : "matches the file");
+  return res;
+}
+
+int main (int argc, char* argv[]) {
+  const char* dir;
+  int max_threads, writes, threads, failed = 0;
+
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr,
+	    "USAGE: %s <directory> [ max threads ] [ writes per thread ]\n",
+	    argv[0]);
+    return 1;
+  }
+  dir = argv[1];
+  max_threads = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+  writes = argc > 3 ? atoi(argv[3]) : 100;
+  if (max_threads < 1 || max_threads > 64 || writes < 1) {
+    fprintf(stderr, "ERROR: threads must be 1 to 64, writes positive\n");
+    return 1;
+  }
+
+  for (int shared = 0; shared <= 1 && !failed; shared += 1) {
+    double base = 0;
+    for (threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 :
+	   max_threads) {
+      double rate = run(dir, shared, threads, writes);
+      if (rate < 0) {
+	failed = 1;
+	break;
+      }
+      if (threads == 1)
+	base = rate;
+      printf("%-8s %3d threads %9.0f writes/s   x%.2f\n",
+	     shared ? "shared" : "private", threads, rate, rate / base);
+      if (threads == max_threads)
+	break;
+    }
+  }
+  if (!failed)
+    failed = check_history(dir, max_threads * writes);
+  return failed;
+}
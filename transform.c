@@ -0,0 +1,339 @@
+/**
+ * \file transform.c
+ * \date October 2026
+ *
+ * The transform pipeline shared by caesarfs and versfs, plus the stages that
+ * can be named on the command line.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "caesar_shift.h"
+#include "iobackend.h"
+#include "transform.h"
+
+/* ------------------------------------------------------------------------ */
+/* Per-thread scratch space */
+
+/* Encoded data cannot be produced in the caller's (read-only) write buffer,
+   so each thread keeps one scratch buffer that grows to the largest request
+   it has seen.  It is freed when the thread exits. */
+static pthread_key_t  scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+struct scratch {
+	size_t size;
+	unsigned char data[];
+};
+
+static void scratch_key_create(void)
+{
+	pthread_key_create(&scratch_key, free);
+}
+
+static unsigned char *scratch_buffer(size_t size)
+{
+	struct scratch *scratch;
+
+	pthread_once(&scratch_once, scratch_key_create);
+	scratch = pthread_getspecific(scratch_key);
+	if (scratch == NULL || scratch->size < size) {
+		free(scratch);
+		scratch = malloc(sizeof(*scratch) + size);
+		if (scratch != NULL)
+			scratch->size = size;
+		pthread_setspecific(scratch_key, scratch);
+	}
+	return scratch == NULL ? NULL : scratch->data;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Stages */
+
+static void caesar_encode(void *state, unsigned char *dst,
+			  const unsigned char *src, size_t size, off_t off)
+{
+	(void) off;
+	caesar_shift_parallel(dst, src, size, (unsigned char) (intptr_t) state);
+}
+
+static void caesar_decode(void *state, unsigned char *buf, size_t size,
+			  off_t off)
+{
+	(void) off;
+	caesar_shift_parallel(buf, buf, size, (unsigned char) -(intptr_t) state);
+}
+
+void transform_caesar_stage(struct transform_stage *stage, int key)
+{
+	stage->name       = "caesar";
+	stage->block_size = 1;
+	stage->encode     = caesar_encode;
+	stage->decode     = caesar_decode;
+	stage->state      = (void *) (intptr_t) key;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Pipeline set-up */
+
+void transform_pipeline_init(struct transform_pipeline *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->block_size = 1;
+}
+
+int transform_pipeline_push(struct transform_pipeline *p,
+			    const struct transform_stage *stage)
+{
+	size_t a, b;
+
+	if (p->nstages == TRANSFORM_MAX_STAGES)
+		return -1;
+	p->stages[p->nstages++] = *stage;
+
+	// The pipeline works in blocks that every stage can handle: the least
+	// common multiple of the stage block sizes.
+	a = p->block_size;
+	b = stage->block_size;
+	while (b != 0) {
+		size_t t = a % b;
+		a = b;
+		b = t;
+	}
+	p->block_size = p->block_size / a * stage->block_size;
+	return 0;
+}
+
+int transform_pipeline_parse(struct transform_pipeline *p, const char *spec)
+{
+	char *copy = strdup(spec);
+	char *save = NULL;
+	char *item;
+	int res = 0;
+
+	if (copy == NULL)
+		return -1;
+
+	for (item = strtok_r(copy, ",", &save); item != NULL;
+	     item = strtok_r(NULL, ",", &save)) {
+		struct transform_stage stage;
+		char *arg = strchr(item, ':');
+		char *end;
+
+		if (arg != NULL)
+			*arg++ = '\0';
+
+		if (strcmp(item, "caesar") == 0) {
+			long key = arg == NULL ? -1 : strtol(arg, &end, 10);
+			if (arg == NULL || *arg == '\0' || *end != '\0') {
+				fprintf(stderr, "ERROR: caesar stage needs a key, e.g. caesar:3\n");
+				res = -1;
+				break;
+			}
+			transform_caesar_stage(&stage, (int) key);
+		} else {
+			fprintf(stderr, "ERROR: Unknown transform stage '%s'\n", item);
+			res = -1;
+			break;
+		}
+
+		if (transform_pipeline_push(p, &stage) == -1) {
+			fprintf(stderr, "ERROR: At most %d transform stages are supported\n",
+				TRANSFORM_MAX_STAGES);
+			res = -1;
+			break;
+		}
+	}
+
+	free(copy);
+	return res;
+}
+
+/* ------------------------------------------------------------------------ */
+/* I/O */
+
+static void encode_all(const struct transform_pipeline *p, unsigned char *dst,
+		       const unsigned char *src, size_t size, off_t off)
+{
+	int i;
+
+	for (i = 0; i < p->nstages; i += 1) {
+		const struct transform_stage *s = &p->stages[i];
+		s->encode(s->state, dst, i == 0 ? src : dst, size, off);
+	}
+}
+
+static void decode_all(const struct transform_pipeline *p, unsigned char *buf,
+		       size_t size, off_t off)
+{
+	int i;
+
+	for (i = p->nstages - 1; i >= 0; i -= 1) {
+		const struct transform_stage *s = &p->stages[i];
+		s->decode(s->state, buf, size, off);
+	}
+}
+
+ssize_t transform_pread(const struct transform_pipeline *p, int fd,
+			char *buf, size_t size, off_t off)
+{
+	size_t bs = p->block_size;
+	unsigned char *scratch;
+	off_t start;
+	ssize_t res;
+
+	if (bs == 1 || (off % bs == 0 && size % bs == 0)) {
+		// Aligned: decode in place, no copy.
+		res = iob_pread(fd, buf, size, off);
+		if (res < 0)
+			return res;
+		if (res > 0)
+			decode_all(p, (unsigned char *) buf, res, off);
+		return res;
+	}
+
+	// Decode the enclosing whole blocks, then hand back the requested part.
+	start = off - off % bs;
+	size_t span = ((off + size - start) + bs - 1) / bs * bs;
+	scratch = scratch_buffer(span);
+	if (scratch == NULL)
+		return -ENOMEM;
+	res = iob_pread(fd, scratch, span, start);
+	if (res < 0)
+		return res;
+	if (res <= off - start)
+		return 0;
+	decode_all(p, scratch, res, start);
+	res -= off - start;
+	if (res > size)
+		res = size;
+	memcpy(buf, scratch + (off - start), res);
+	return res;
+}
+
+int transform_open_flags(const struct transform_pipeline *p, int flags)
+{
+	if (p->block_size > 1 && (flags & O_ACCMODE) == O_WRONLY)
+		flags = (flags & ~O_ACCMODE) | O_RDWR;
+	return flags;
+}
+
+ssize_t transform_pwrite(const struct transform_pipeline *p, int fd,
+			 const char *buf, size_t size, off_t off)
+{
+	size_t bs = p->block_size;
+	unsigned char *scratch;
+	ssize_t res;
+
+	if (p->nstages == 0)
+		return iob_pwrite(fd, buf, size, off);
+
+	if (bs == 1 || (off % bs == 0 && size % bs == 0)) {
+		scratch = scratch_buffer(size);
+		if (scratch == NULL)
+			return -ENOMEM;
+		encode_all(p, scratch, (const unsigned char *) buf, size, off);
+		return iob_pwrite(fd, scratch, size, off);
+	}
+
+	// Partial blocks: read the enclosing blocks, decode them, patch in the
+	// new data and encode the whole span again.
+	off_t start = off - off % bs;
+	size_t head = off - start;
+	size_t span = (head + size + bs - 1) / bs * bs;
+	size_t len;
+
+	scratch = scratch_buffer(span);
+	if (scratch == NULL)
+		return -ENOMEM;
+	res = iob_pread(fd, scratch, span, start);
+	if (res < 0)
+		return res;
+	if (res > 0)
+		decode_all(p, scratch, res, start);
+	if (res < head)
+		memset(scratch + res, 0, head - res);
+	memcpy(scratch + head, buf, size);
+
+	// Never extend the file beyond the end of the new data.
+	len = head + size;
+	if (res > len)
+		len = res;
+	encode_all(p, scratch, scratch, len, start);
+	res = iob_pwrite(fd, scratch, len, start);
+	if (res < 0)
+		return res;
+	return res < head ? 0 : (res - head > size ? size : res - head);
+}
+
+ssize_t transform_mread(const struct transform_pipeline *p,
+			const unsigned char *src, size_t src_size,
+			char *buf, size_t size, off_t off)
+{
+	size_t bs = p->block_size;
+	unsigned char *scratch;
+	size_t len, head, span;
+	off_t start;
+
+	if (off >= src_size)
+		return 0;
+	len = src_size - off < size ? src_size - off : size;
+
+	if (bs == 1 || off % bs == 0) {
+		// Whole blocks from the start, bar perhaps a short last one.
+		size_t full = bs == 1 ? len : (len + bs - 1) / bs * bs;
+		if (full > src_size - off)
+			full = src_size - off;
+		if (full == len) {
+			memcpy(buf, src + off, len);
+			decode_all(p, (unsigned char *) buf, len, off);
+			return len;
+		}
+	}
+
+	start = off - off % bs;
+	head = off - start;
+	span = (head + len + bs - 1) / bs * bs;
+	if (span > src_size - start)
+		span = src_size - start;
+	scratch = scratch_buffer(span);
+	if (scratch == NULL)
+		return -ENOMEM;
+	memcpy(scratch, src + start, span);
+	decode_all(p, scratch, span, start);
+	memcpy(buf, scratch + head, len);
+	return len;
+}
+
+ssize_t transform_hole(const struct transform_pipeline *p,
+		       char *buf, size_t size, off_t off)
+{
+	size_t bs = p->block_size;
+	unsigned char *scratch;
+	size_t head, span;
+
+	if (bs == 1 || (off % bs == 0 && size % bs == 0)) {
+		memset(buf, 0, size);
+		decode_all(p, (unsigned char *) buf, size, off);
+		return size;
+	}
+
+	// Decoded a whole block at a time, as a read would be.
+	head = off % bs;
+	span = (head + size + bs - 1) / bs * bs;
+	scratch = scratch_buffer(span);
+	if (scratch == NULL)
+		return -ENOMEM;
+	memset(scratch, 0, span);
+	decode_all(p, scratch, span, off - head);
+	memcpy(buf, scratch + head, size);
+	return size;
+}
@@ -0,0 +1,83 @@
+/**
+ * \file transform.h
+ * \date October 2026
+ *
+ * A stack of data transforms applied between the mount point and the storage
+ * directory.  Each stage encodes data on its way to the storage directory and
+ * decodes it on the way back; stages run in order on write and in reverse
+ * order on read.  A file system that wants, say, versioning on top of the
+ * Caesar shift configures both in one daemon instead of stacking two mounts.
+ *
+ * Stages must preserve length: n bytes at offset off in the mount point are
+ * stored as n bytes at offset off in the storage directory.  A stage may ask
+ * to see whole, aligned blocks (block_size > 1), in which case partial-block
+ * writes are turned into read-modify-write cycles by transform_pwrite(); the
+ * last block of a file may be short.
+ */
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TRANSFORM_MAX_STAGES 8
+
+struct transform_stage {
+	const char *name;
+	size_t block_size;
+	/* Encode size bytes from src (destined for offset off) into dst.
+	   dst may equal src. */
+	void (*encode)(void *state, unsigned char *dst, const unsigned char *src,
+		       size_t size, off_t off);
+	/* Decode size bytes read from offset off, in place. */
+	void (*decode)(void *state, unsigned char *buf, size_t size, off_t off);
+	void *state;
+};
+
+struct transform_pipeline {
+	int nstages;
+	size_t block_size;
+	struct transform_stage stages[TRANSFORM_MAX_STAGES];
+};
+
+/* Set up an empty pipeline, which passes data through untouched. */
+void transform_pipeline_init(struct transform_pipeline *p);
+
+/* Append a stage.  Returns 0, or -1 if the pipeline is full. */
+int transform_pipeline_push(struct transform_pipeline *p,
+			    const struct transform_stage *stage);
+
+/* Append the stages named in a comma-separated spec such as "caesar:3".
+   Returns 0, or -1 (after printing why) for an unknown or malformed stage. */
+int transform_pipeline_parse(struct transform_pipeline *p, const char *spec);
+
+/* Build a stage that shifts every byte by key. */
+void transform_caesar_stage(struct transform_stage *stage, int key);
+
+/* pread()/pwrite() through the pipeline and the I/O backend of iobackend.h.
+   Both return the number of bytes transferred or -errno.  Reads are decoded
+   in place in buf; writes are encoded into a per-thread scratch buffer, or
+   written straight from buf when the pipeline is empty. */
+ssize_t transform_pread(const struct transform_pipeline *p, int fd,
+			char *buf, size_t size, off_t off);
+ssize_t transform_pwrite(const struct transform_pipeline *p, int fd,
+			 const char *buf, size_t size, off_t off);
+
+/* The open() flags for a storage file opened with flags in the mount point.
+   A pipeline that works in blocks reads back partial blocks when writing,
+   so it needs read access too. */
+int transform_open_flags(const struct transform_pipeline *p, int flags);
+
+/* Like transform_pread(), but from the encoded contents of a whole file
+   already in memory (src, src_size bytes long), e.g. a mapped version. */
+ssize_t transform_mread(const struct transform_pipeline *p,
+			const unsigned char *src, size_t src_size,
+			char *buf, size_t size, off_t off);
+
+/* What transform_pread() gives for size bytes of a hole at off: zeros, as
+   stored, decoded.  Returns size or -errno. */
+ssize_t transform_hole(const struct transform_pipeline *p,
+		       char *buf, size_t size, off_t off);
+
+#endif /* TRANSFORM_H */
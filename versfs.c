@@ -23,877 +23,1660 @@
 #ifdef linux
 /* For pread()/pwrite()/utimensat() */
 #define _XOPEN_SOURCE 700
+/* For SEEK_DATA/SEEK_HOLE, copy_file_range() and fallocate() */
+#define _GNU_SOURCE
+#define HAVE_FALLOCATE
 #endif
 
 #include <fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
-#include <libgen.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/time.h>
-#ifdef HAVE_SETXATTR
-#include <sys/xattr.h>
-#endif
+#include "arena.h"
+#include "attrcache.h"
+#include "crc32c.h"
+#include "filelock.h"
+#include "fingerprint.h"
+#include "gsync.h"
+#include "iobackend.h"
+#include "mapcache.h"
+#include "oplog.h"
+#include "scrub.h"
+#include "transform.h"
+#include "vstore.h"
+#include "vwindow.h"
+#include "wbuf.h"
+
+/* Transform stages (-o transform=...) applied to everything stored in the
+   storage directory, live files and versions alike.  Empty by default. */
+static struct transform_pipeline pipeline;
+
+/* What fsync() promises (-o durability=...).  Small writes are gathered in
+   the write buffers of wbuf.h either way, except with DURABLE_WRITE. */
+enum durability {
+	DURABLE_FSYNC,		/* fsync() flushes the buffer and syncs the store */
+	DURABLE_FLUSH,		/* fsync() only flushes the buffer */
+	DURABLE_WRITE		/* no buffering: every write is stored at once */
+};
+static enum durability durability = DURABLE_FSYNC;
+
+/* How fast, in MiB a second, and how often, in seconds, the scrubber of
+   scrub.h reads the history (-o scrub_mb=...,scrub_interval=...). */
+static unsigned scrub_mb;
+static unsigned scrub_interval;
+
+struct vers_options {
+	char *transform;
+	unsigned history_maps;
+	unsigned history_cache_mb;
+	unsigned oplog_compact;
+	unsigned write_buffer_kb;
+	unsigned flush_ms;
+	char *durability;
+	unsigned scrub_mb;
+	unsigned scrub_interval;
+	unsigned version_window_ms;
+};
 
-static char* storage_dir = NULL;
-static char  storage_path[256];
+static struct fuse_opt vers_opts[] = {
+	{ "transform=%s", offsetof(struct vers_options, transform), 0 },
+	{ "history_maps=%u", offsetof(struct vers_options, history_maps), 0 },
+	{ "history_cache_mb=%u", offsetof(struct vers_options, history_cache_mb), 0 },
+	{ "oplog_compact=%u", offsetof(struct vers_options, oplog_compact), 0 },
+	{ "write_buffer=%u", offsetof(struct vers_options, write_buffer_kb), 0 },
+	{ "flush_ms=%u", offsetof(struct vers_options, flush_ms), 0 },
+	{ "durability=%s", offsetof(struct vers_options, durability), 0 },
+	{ "scrub_mb=%u", offsetof(struct vers_options, scrub_mb), 0 },
+	{ "scrub_interval=%u", offsetof(struct vers_options, scrub_interval), 0 },
+	{ "version_window_ms=%u", offsetof(struct vers_options, version_window_ms), 0 },
+	FUSE_OPT_END
+};
 
+static int is_ctl_path(const char* path);
+
+/* The shared operations (passthrough.h) keep out of /.versfs, log changes
+   to the namespace (oplog.h), use the attribute cache and pass file data
+   through the transform pipeline.  Those that store versions are versfs's
+   own, below. */
+#define PT_RESERVED(path) is_ctl_path(path)
+#define PT_CHANGED() attrcache_invalidate()
+#define PT_ATTRCACHE 1
+#define PT_NS_LOCK() oplog_lock()
+#define PT_NS_UNLOCK() oplog_unlock()
+#define PT_NS_RECORD(op, path, arg) oplog_record(OPLOG_##op, path, arg)
+#define PT_OPEN_FLAGS(flags) transform_open_flags(&pipeline, flags)
+#define PT_READ(fd, buf, size, off) transform_pread(&pipeline, fd, buf, size, off)
+#define PT_WRITE(fd, buf, size, off) \
+	transform_pwrite(&pipeline, fd, buf, size, off)
+#include "passthrough.h"
+
+
+/*
+ * Version history, laid out as described in vstore.h.  Histories live
+ * outside the user's tree, under .versfs/history in the storage directory;
+ * /.versfs in the mount point is the read-only view of it (see below), so no
+ * user file can collide with it.
+ *
+ * The rest of the tree -- making, removing, renaming and linking entries,
+ * chmod and chown -- goes into the namespace log of oplog.h.  Each of those
+ * operations holds oplog_lock() until it is logged, so that the log has
+ * them in the order they happened.
+ */
 
-char* prepend_storage_dir (char* pre_path, const char* path) {
-  strcpy(pre_path, storage_dir);
-  strcat(pre_path, path);
-  return pre_path;
-}
+#define VERS_CTL_DIR     VSTORE_DIR
+#define VERS_HISTORY_DIR VSTORE_HISTORY_DIR
 
+static void versions_dir_of(char* out, const char* storage_file) {
+  vstore_history_dir(out, storage_dir, storage_file + strlen(storage_dir));
+}
 
-static int vers_getattr(const char *path, struct stat *stbuf)
-{
-	int res;
-	
-	path = prepend_storage_dir(storage_path, path);
-	res = lstat(path, stbuf);
-	if (res == -1)
-		return -errno;
+/* Create dir and any missing parents up to the storage directory. */
+static int make_dirs(const char* dir) {
+  char path[PATH_MAX];
+  char* slash;
+
+  if (strlen(dir) <= strlen(storage_dir))
+    return -ENAMETOOLONG;	/* See vstore_history_dir(). */
+  snprintf(path, PATH_MAX, "%s", dir);
+  for (slash = path + strlen(storage_dir) + 1; (slash = strchr(slash, '/'));
+       slash += 1) {
+    *slash = '\0';
+    if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 &&
+	errno != EEXIST)
+      return -errno;
+    *slash = '/';
+  }
+  if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 &&
+      errno != EEXIST)
+    return -errno;
+  return 0;
+}
 
-	return 0;
+/* Unlink the files in dir, emptying the directories in it the same way
+   down to depth more levels, then remove dir itself. */
+static int remove_dir(const char* dir, int depth) {
+  char entry_path[PATH_MAX];
+  DIR* dp;
+  struct dirent* de;
+
+  dp = opendir(dir);
+  if (dp == NULL)
+    return errno == ENOENT ? 0 : -errno;
+  while ((de = readdir(dp)) != NULL) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    snprintf(entry_path, PATH_MAX, "%s/%s", dir, de->d_name);
+    if (unlink(entry_path) == -1 && (errno == EISDIR || errno == EPERM) &&
+	depth > 0)
+      remove_dir(entry_path, depth - 1);
+  }
+  closedir(dp);
+  return rmdir(dir) == -1 ? -errno : 0;
 }
 
-static int vers_access(const char *path, int mask)
-{
-	int res;
+/* Delete the history of the storage file path, if it has one: its buckets
+   of versions, then the rest. */
+static int remove_history(const char* path) {
+  char versions_dir[PATH_MAX];
 
-	path = prepend_storage_dir(storage_path, path);
-	res = access(path, mask);
-	if (res == -1)
-		return -errno;
+  versions_dir_of(versions_dir, path);
+  return remove_dir(versions_dir, 1);
+}
 
-	return 0;
+/* Open the counter of the history in versions_dir, creating the history if
+   the file has none yet.  On success *vers_num is the newest version number,
+   or -1 for a new history. */
+static int open_counter(const char* versions_dir, int* vers_num) {
+  char path[PATH_MAX];
+  char num_str[16];
+  int fd;
+  ssize_t res;
+
+  vstore_counter_path(path, versions_dir);
+  fd = open(path, O_RDWR);
+  if (fd == -1 && errno == ENOENT) {
+    res = make_dirs(versions_dir);
+    if (res < 0)
+      return res;
+    fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+      return -errno;
+    *vers_num = -1;
+    return fd;
+  }
+  if (fd == -1)
+    return -errno;
+
+  memset(num_str, 0, sizeof(num_str));
+  res = iob_pread(fd, num_str, sizeof(num_str) - 1, 0);
+  if (res < 0) {
+    close(fd);
+    return res;
+  }
+  *vers_num = res == 0 ? -1 : atoi(num_str);
+  return fd;
 }
 
-static int vers_readlink(const char *path, char *buf, size_t size)
-{
-	int res;
+/* Files up to this size, without holes, are committed with one chain of
+   linked I/O operations rather than extent by extent. */
+#define VERS_CHAIN_MAX (256 * 1024)
+
+/* Copy the whole of in_fd into out_fd and then store the new version number,
+   as one submission: each step starts only if the one before it succeeded
+   in full.  Returns 0, or -EAGAIN if the file changed size underneath and
+   should be copied the slow way.  The copy is staged in the thread's arena
+   (arena.h), released by the caller. */
+static int commit_chained(int in_fd, int out_fd, off_t size,
+			  int counter_fd, char* num_str, size_t num_size) {
+  char* buf = arena_alloc(size);
+  int res = 0;
+  int i;
+
+  if (buf == NULL)
+    return -ENOMEM;
+
+  struct iob_op ops[3] = {
+    { IOB_READ,  in_fd,      buf,     size,     0, 1, 0 },
+    { IOB_WRITE, out_fd,     buf,     size,     0, 1, 0 },
+    { IOB_WRITE, counter_fd, num_str, num_size, 0, 0, 0 },
+  };
+  iob_submit(ops, 3);
+
+  for (i = 0; i < 3 && res == 0; i += 1) {
+    if (ops[i].res < 0)
+      res = ops[i].res == -ECANCELED ? -EAGAIN : ops[i].res;
+    else if (ops[i].res != ops[i].len)
+      res = -EAGAIN;
+  }
+  return res;
+}
 
-	path = prepend_storage_dir(storage_path, path);
-	res = readlink(path, buf, size - 1);
-	if (res == -1)
-		return -errno;
+/* Versions committed, how many of them were appends, and versions found
+   to be no change, for /.versfs/stats. */
+static unsigned long long versions_committed = 0;
+static unsigned long long versions_appended = 0;
+static unsigned long long versions_suppressed = 0;
 
-	buf[res] = '\0';
-	return 0;
+/* Remove the checksums (vstore.h) of a version about to be written, which
+   may be left from one that was never counted. */
+static void drop_sums(const char* vers_path) {
+  char sum_path[PATH_MAX];
+
+  vstore_sum_path(sum_path, vers_path);
+  unlink(sum_path);
 }
 
-static int vers_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-		       off_t offset, struct fuse_file_info *fi)
-{
-	printf("VERS_READDIR IS CALLED\n");
-	DIR *dp;
-	struct dirent *de;
+/* Store the checksums of the data file vers_path, which holds the first
+   size bytes of the file that fp (if not NULL) fingerprints, from the
+   chunk holding byte off on.  The fingerprint's blocks are the chunks, so
+   their CRCs are the checksums; without one the file is read back.  A
+   version without checksums is only unchecked, so errors are ignored. */
+static void store_sums(const char* vers_path, const struct fingerprint* fp,
+		       off_t size, off_t off) {
+  size_t mark = arena_mark();
+  size_t n = (size + VSTORE_CHUNK - 1) / VSTORE_CHUNK;
+  size_t i = off / VSTORE_CHUNK;
+  struct vstore_sum* sums = NULL;
+
+  _Static_assert(FP_BLOCK == VSTORE_CHUNK, "fingerprint blocks are chunks");
+  if (fp != NULL && fp_blocks(fp) == n)
+    sums = arena_alloc(n * sizeof(*sums));
+  if (sums == NULL) {
+    vstore_sum_file(vers_path, off);
+    arena_release(mark);
+    return;
+  }
+  for (; i < n; i += 1) {
+    sums[i].crc = fp_block_crc(fp, i);
+    sums[i].len = i + 1 < n ? VSTORE_CHUNK : size - (off_t) i * VSTORE_CHUNK;
+  }
+  vstore_write_sums(vers_path, sums, off / VSTORE_CHUNK, n);
+  arena_release(mark);
+}
 
-	(void) offset;
-	(void) fi;
+/* Record the file open as in_fd, which held version prev_vers_num up to
+   where it was appended to from off on, as version prev_vers_num + 1 by
+   adding the new bytes to the end of that version's base (see vstore.h),
+   and the checksums of the chunks they fall in from fp.  Returns 0, or
+   -EAGAIN if the file must be copied after all: the newest version ends in
+   a hole, the write began before its end, or its base has been added to or
+   linked elsewhere since. */
+static int commit_append(const char* versions_dir, int prev_vers_num,
+			 int in_fd, const struct stat* st, off_t off,
+			 const struct fingerprint* fp, int counter_fd,
+			 const char* num_str, size_t num_size) {
+  char base_path[PATH_MAX];
+  char new_vers_path[PATH_MAX];
+  struct vstore_record rec, base_rec;
+  struct stat base_st;
+  struct timespec times[2];
+  int base_fd, fd;
+  int res;
+
+  if (prev_vers_num < 0 ||
+      vstore_read_record(versions_dir, prev_vers_num, &rec) < 0 ||
+      rec.data_len != rec.length || off < rec.length ||
+      st->st_size <= rec.length ||
+      vstore_read_record(versions_dir, rec.base, &base_rec) < 0)
+    return -EAGAIN;
+  vstore_version_path(base_path, versions_dir, rec.base);
+  base_fd = open(base_path, O_WRONLY);
+  if (base_fd == -1)
+    return -EAGAIN;
+  if (fstat(base_fd, &base_st) == -1 || base_st.st_nlink > 1 ||
+      base_st.st_size != rec.data_len) {
+    close(base_fd);
+    return -EAGAIN;
+  }
+
+  // A full base is about to outgrow itself, so its length goes on record
+  // first.
+  res = 0;
+  if (base_rec.kind == VSTORE_FULL) {
+    base_rec.kind = VSTORE_APPEND;
+    res = vstore_write_record(versions_dir, rec.base, &base_rec);
+  }
+  if (res == 0) {
+    rec.kind = VSTORE_APPEND;
+    rec.data_len = rec.length = st->st_size;
+    res = vstore_write_record(versions_dir, prev_vers_num + 1, &rec);
+  }
+  if (res == 0)
+    res = vstore_copy_sparse_range(in_fd, base_fd, base_st.st_size,
+				   st->st_size);
+
+  // Then an empty <N> for the time, and the counter.
+  vstore_version_path(new_vers_path, versions_dir, prev_vers_num + 1);
+  if (res == 0) {
+    drop_sums(new_vers_path);
+    fd = vstore_create(new_vers_path, O_WRONLY | O_CREAT | O_TRUNC,
+		       S_IRUSR | S_IWUSR);
+    if (fd < 0)
+      res = fd;
+    else
+      close(fd);
+  }
+  if (res == 0) {
+    res = iob_pwrite(counter_fd, num_str, num_size, 0);
+    if (res > 0)
+      res = 0;
+    if (res < 0)
+      unlink(new_vers_path);
+  }
+  // Left longer than its record, the base would take no more appends.
+  if (res < 0 && ftruncate(base_fd, base_st.st_size) == -1)
+    res = -errno;
+  if (res == 0)
+    store_sums(base_path, fp, st->st_size, base_st.st_size);
+  // The base is a version too, whose <N> keeps the time it was made
+  // (restores by time go by it).  Best effort: the version is counted.
+  times[0] = base_st.st_atim;
+  times[1] = base_st.st_mtim;
+  futimens(base_fd, times);
+  close(base_fd);
+  return res;
+}
 
-	path = prepend_storage_dir(storage_path, path);
-	dp = opendir(path);
-	if (dp == NULL)
-		return -errno;
+/* Record the current contents of the storage file path as its newest
+   version, starting its history if it has none.  Besides its length, only
+   the bytes in [off, off + len) can have changed since the newest version
+   (len -1 if any can have); if the file's fingerprint (fingerprint.h) shows
+   that they did not, no version is made, and if they all lie past the end
+   of the newest version, only they are stored.  Called with the file's lock
+   (filelock.h) held, which keeps the counter and the copy of one file in
+   step however many threads write it. */
+static int vers_commit(const char* path, off_t off, off_t len) {
+  char versions_dir[PATH_MAX];
+  char new_vers_path[PATH_MAX];
+  char num_str[VSTORE_COUNTER_SIZE];
+  struct vstore_record full = { VSTORE_FULL, 0, 0, 0 };
+  struct fingerprint* fp;
+  struct stat st;
+  int prev_vers_num;
+  int counter_fd, in_fd, out_fd;
+  size_t mark = arena_mark();
+  int append;
+  int res;
+
+  versions_dir_of(versions_dir, path);
+  counter_fd = open_counter(versions_dir, &prev_vers_num);
+  if (counter_fd < 0)
+    return counter_fd;
+
+  in_fd = open(path, O_RDONLY);
+  if (in_fd == -1) {
+    res = -errno;
+    close(counter_fd);
+    return res;
+  }
+  if (fstat(in_fd, &st) == -1) {
+    res = -errno;
+    close(in_fd);
+    close(counter_fd);
+    return res;
+  }
+
+  // Compare against the newest version, if the fingerprint is of that
+  // one.  A file with other names may have changed through them, so it
+  // is not fingerprinted at all.
+  fp = fp_take(path);
+  if (fp != NULL && (fp_version(fp) != prev_vers_num || st.st_nlink > 1)) {
+    fp_free(fp);
+    fp = NULL;
+  }
+  // With a fingerprint, the file is known to have held the newest version
+  // before the write.
+  append = fp != NULL && len > 0;
+  if (st.st_nlink == 1) {
+    // A pipeline that works in blocks rewrites whole ones.
+    if (len > 0 && pipeline.block_size > 1) {
+      off_t end = (off + len + pipeline.block_size - 1) /
+	pipeline.block_size * pipeline.block_size;
+      off = off / pipeline.block_size * pipeline.block_size;
+      len = end - off;
+    }
+    if (fp_update(&fp, in_fd, &st, off, len) == 0 && prev_vers_num >= 0) {
+      fp_put(path, fp, prev_vers_num);
+      __atomic_add_fetch(&versions_suppressed, 1, __ATOMIC_RELAXED);
+      close(in_fd);
+      close(counter_fd);
+      return 0;
+    }
+  }
+  vstore_format_counter(num_str, sizeof(num_str), prev_vers_num + 1);
+
+  // An append need not copy what the newest version already has.
+  if (append) {
+    res = commit_append(versions_dir, prev_vers_num, in_fd, &st, off, fp,
+			counter_fd, num_str, sizeof(num_str));
+    if (res == 0) {
+      __atomic_add_fetch(&versions_committed, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&versions_appended, 1, __ATOMIC_RELAXED);
+    }
+    if (res != -EAGAIN)
+      goto out_in;
+  }
+
+  // The index may hold a record for this number from a length change or
+  // append that never got counted.
+  res = vstore_write_record(versions_dir, prev_vers_num + 1, &full);
+  if (res < 0)
+    goto out_in;
+
+  vstore_version_path(new_vers_path, versions_dir, prev_vers_num + 1);
+  drop_sums(new_vers_path);
+  out_fd = vstore_create(new_vers_path, O_WRONLY | O_CREAT | O_TRUNC,
+			 S_IRUSR | S_IWUSR);
+  if (out_fd < 0) {
+    res = out_fd;
+    goto out_in;
+  }
+
+  res = -EAGAIN;
+  if (st.st_size <= VERS_CHAIN_MAX && st.st_blocks * 512 >= st.st_size)
+    res = commit_chained(in_fd, out_fd, st.st_size,
+			 counter_fd, num_str, sizeof(num_str));
+  if (res == -EAGAIN) {
+    if (ftruncate(out_fd, 0) == -1)
+      res = -errno;
+    else
+      res = vstore_copy_sparse(in_fd, out_fd, st.st_size);
+    // Only count the version once its contents are in place.
+    if (res == 0)
+      res = iob_pwrite(counter_fd, num_str, sizeof(num_str), 0);
+    if (res > 0)
+      res = 0;
+  }
+  close(out_fd);
+  if (res < 0) {
+    unlink(new_vers_path);
+  } else {
+    __atomic_add_fetch(&versions_committed, 1, __ATOMIC_RELAXED);
+    store_sums(new_vers_path, fp, st.st_size, 0);
+  }
+
+ out_in:
+  // The fingerprint now describes the new version, if there is one.
+  if (fp != NULL && res == 0)
+    fp_put(path, fp, prev_vers_num + 1);
+  else
+    fp_free(fp);
+  close(in_fd);
+  close(counter_fd);
+  arena_release(mark);
+  return res;
+}
 
-	while ((de = readdir(dp)) != NULL) {
-		struct stat st;
-		memset(&st, 0, sizeof(st));
-		st.st_ino = de->d_ino;
-		st.st_mode = de->d_type << 12;
-		if (strstr(de->d_name, "__versions__") != NULL)
-			continue;
-		if (filler(buf, de->d_name, &st, 0))
-			break;
-	}
 
-	closedir(dp);
-	return 0;
+/* Record the storage file path, just truncated from old_size to new_size,
+   as its newest version.  If the newest version so far is known to be what
+   the file held before, because the file's fingerprint describes that
+   version and nothing has changed since, the new one is only a length
+   change against it (see vstore.h), however large the file; otherwise it
+   is a full copy.  A file with other names may have changed through them
+   without a version, so it is always copied.  Called with the file's lock
+   held. */
+static int vers_commit_resize(const char* path, const struct stat* before,
+			      off_t new_size) {
+  char versions_dir[PATH_MAX];
+  char new_vers_path[PATH_MAX];
+  char num_str[VSTORE_COUNTER_SIZE];
+  struct vstore_record rec;
+  struct fingerprint* fp;
+  struct stat st;
+  int prev_vers_num;
+  int counter_fd, fd;
+  int res;
+
+  versions_dir_of(versions_dir, path);
+  counter_fd = open_counter(versions_dir, &prev_vers_num);
+  if (counter_fd < 0)
+    return counter_fd;
+  if (prev_vers_num < 0 || before->st_nlink > 1 ||
+      vstore_read_record(versions_dir, prev_vers_num, &rec) < 0 ||
+      rec.length != before->st_size) {
+    close(counter_fd);
+    return vers_commit(path, 0, 0);
+  }
+
+  // The same length proves nothing about the bytes: a write whose commit
+  // failed, or that waits for a window, leaves it as it was.
+  fp = fp_take(path);
+  if (fp == NULL || fp_version(fp) != prev_vers_num || fp_dirty(fp)) {
+    fp_free(fp);
+    close(counter_fd);
+    return vers_commit(path, 0, 0);
+  }
+
+  // Truncating to the length the file had changes nothing.
+  if (new_size == before->st_size) {
+    fp_put(path, fp, prev_vers_num);
+    __atomic_add_fetch(&versions_suppressed, 1, __ATOMIC_RELAXED);
+    close(counter_fd);
+    return 0;
+  }
+
+  rec.kind = VSTORE_TRUNC;
+  if (rec.data_len > new_size)
+    rec.data_len = new_size;
+  rec.length = new_size;
+  res = vstore_write_record(versions_dir, prev_vers_num + 1, &rec);
+
+  // An empty <N> keeps the time; the counter goes last, as ever.
+  vstore_version_path(new_vers_path, versions_dir, prev_vers_num + 1);
+  if (res == 0) {
+    drop_sums(new_vers_path);
+    fd = vstore_create(new_vers_path, O_WRONLY | O_CREAT | O_TRUNC,
+		       S_IRUSR | S_IWUSR);
+    if (fd < 0)
+      res = fd;
+    else
+      close(fd);
+  }
+  if (res == 0) {
+    vstore_format_counter(num_str, sizeof(num_str), prev_vers_num + 1);
+    res = iob_pwrite(counter_fd, num_str, sizeof(num_str), 0);
+    if (res > 0)
+      res = 0;
+    if (res < 0)
+      unlink(new_vers_path);
+  }
+  if (res == 0) {
+    __atomic_add_fetch(&versions_committed, 1, __ATOMIC_RELAXED);
+    // Only the blocks around the old and new ends need hashing.
+    fd = open(path, O_RDONLY);
+    if (fd != -1) {
+      if (fstat(fd, &st) == 0 && fp_update(&fp, fd, &st, 0, 0) >= 0) {
+	fp_put(path, fp, prev_vers_num + 1);
+	fp = NULL;
+      }
+      close(fd);
+    }
+  }
+  fp_free(fp);
+  close(counter_fd);
+  return res;
 }
 
-static int vers_mknod(const char *path, mode_t mode, dev_t rdev)
-{
-	int res;
+/* Note a change to the bytes [off, off + len) of the storage file path (len
+   -1 for any) with its version window (vwindow.h).  Returns 1 if a version
+   is to be stored now, or else what vwin_change() did: the change waits,
+   and the file's fingerprint is behind it until it is stored. */
+static int note_change(const char* path, off_t off, off_t len) {
+  int res = vwin_change(path, off, len);
 
-	/* On Linux this could just be 'mknod(path, mode, rdev)' but this
-	   is more portable */
-	path = prepend_storage_dir(storage_path, path);
-	if (S_ISREG(mode)) {
-		res = open(path, O_CREAT | O_EXCL | O_WRONLY, mode);
-		if (res >= 0)
-			res = close(res);
-	} else if (S_ISFIFO(mode))
-		res = mkfifo(path, mode);
-	else
-		res = mknod(path, mode, rdev);
-	if (res == -1)
-		return -errno;
+  if (res <= 0)
+    fp_mark_dirty(path);
+  return res;
+}
 
-	return 0;
+/* Store what a write buffer gathered (see wbuf.h) as one write and one new
+   version, or a change to the version the file's window (vwindow.h) is
+   gathering. */
+static int flush_write(int fd, const char* path, const char* data,
+		       size_t size, off_t off) {
+  ssize_t res;
+
+  filelock_lock(path);
+  res = transform_pwrite(&pipeline, fd, data, size, off);
+  attrcache_invalidate();
+  if (res >= 0 && res != size)
+    res = -EIO;
+  if (res >= 0)
+    res = note_change(path, off, size);
+  else
+    fp_forget(path);	/* It may have been partly written. */
+  if (res > 0)
+    res = vers_commit(path, off, size);
+  filelock_unlock(path);
+  return res;
 }
 
-static int vers_mkdir(const char *path, mode_t mode)
-{
-	int res;
-	if (strstr(path, "__versions__") != NULL) {
-		fprintf(stderr, "ERROR: Directories cannot contain the string '__versions__'\n");
-		return 1;
-	}
 
-	path = prepend_storage_dir(storage_path, path);
-	res = mkdir(path, mode);
-	if (res == -1)
-		return -errno;
+/*
+ * The history view.  /.versfs/history in the mount point mirrors the tree,
+ * except that every file shows up as a read-only directory of its versions:
+ * /.versfs/history/a/foo/3 is version 3 of /a/foo.  All of it is read-only.
+ * Versions are immutable, so they are served from the mapping cache of
+ * mapcache.h, and checked against their checksums as they are read.  Next
+ * to it, /.versfs/stats counts what the mount has done, and lists versions
+ * found damaged, by those reads or by the scrubber of scrub.h.
+ */
 
-	return 0;
-}
+#define VERS_STATS_FILE VERS_CTL_DIR "/stats"
 
-static int vers_unlink(const char *path)
-{
-	int res;
+/* Room for the text of the stats file, bad versions listed included. */
+#define VERS_STATS_MAX 8192
 
-	// Keep track of the original path
-	char *orig_path = (char *)malloc(sizeof(char) * (strlen(path) + 1));
-	strcpy(orig_path, path);	
+enum hist_kind {
+  HIST_CTL,		/* /.versfs itself */
+  HIST_DIR,		/* a directory of the tree */
+  HIST_FILE,		/* a file, listed as the directory of its versions */
+  HIST_VERSION,		/* one version of a file */
+  HIST_STATS		/* /.versfs/stats */
+};
 
-	path = prepend_storage_dir(storage_path, path);
+struct hist_entry {
+  enum hist_kind kind;
+  char storage[PATH_MAX];	/* storage dir, storage file or version file */
+  struct stat st;
+  off_t data_len;		/* of a version: the bytes of storage it uses */
+};
 
-	// Construct versions directory
-	char *versions_dir_path = (char *)malloc(sizeof(char) * 256);
-	memset(versions_dir_path, 0, 256 * sizeof(char));
-	strcpy(versions_dir_path, path);
-	strcat(versions_dir_path, "__versions__");
-	
-	// Remove all files from the versions directory
-	DIR *dp;
-	struct dirent *de;
-	dp = opendir(versions_dir_path);
-	if (dp == NULL)
-		return -errno;
+/* An open version: the first data_len bytes of its mapped file, then a
+   hole up to length (see vstore.h), with the checksums of the file, if it
+   has any, and which chunks have been checked since the open.  The open
+   stats file has no mapping, but the text it had when opened. */
+struct hist_file {
+  struct mapping* m;
+  char* text;
+  off_t data_len;
+  off_t length;
+  char* storage;
+  struct vstore_sum* sums;
+  size_t nsums;
+  unsigned char* checked;
+};
 
-	// Iterate through the directory and remove all entries
-	while ((de = readdir(dp)) != NULL) {
-		char *file_name = (char *)malloc(sizeof(char) * (strlen(de->d_name)+1));
-		memset(file_name, 0, (strlen(de->d_name)+1) * sizeof(char));
-		strcpy(file_name, de->d_name);
-		char *file_path = (char *)malloc(sizeof(char) * 256);
-		memset(file_path, 0, 256 *sizeof(char));
-		strcpy(file_path, versions_dir_path);
-		strcat(file_path, "/");
-		strcat(file_path, file_name);
-		printf("Path of file is: %s\n", file_path);
-		if ((strcmp(file_name, "..") == 0) || (strcmp(file_name, ".") == 0)) {
-			continue;
-		} else {
-			unlink(file_path);
-		}
-	}
+static int under_dir(const char* path, const char* dir) {
+  size_t len = strlen(dir);
+  return strncmp(path, dir, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
 
-	// Remove the versions directory
-	res = rmdir(versions_dir_path);
-	if (res == -1)
-		return -errno;
+static int is_ctl_path(const char* path) {
+  return under_dir(path, VERS_CTL_DIR);
+}
 
-	// Remove the given file
-	res = unlink(path);
-	if (res == -1)
-		return -errno;
+/* Write the contents of the stats file into buf, returning their length. */
+static size_t stats_text(char* buf, size_t size) {
+  int n = snprintf(buf, size,
+		   "versions_committed %llu\n"
+		   "versions_appended %llu\n"
+		   "versions_suppressed %llu\n"
+		   "changes_coalesced %llu\n"
+		   "fingerprint_bytes_hashed %llu\n"
+		   "fingerprint_crc32c %s\n",
+		   __atomic_load_n(&versions_committed, __ATOMIC_RELAXED),
+		   __atomic_load_n(&versions_appended, __ATOMIC_RELAXED),
+		   __atomic_load_n(&versions_suppressed, __ATOMIC_RELAXED),
+		   vwin_coalesced(),
+		   fp_bytes_hashed(),
+		   crc32c_hardware() ? "hardware" : "table");
+
+  if (n < 0)
+    return 0;
+  if ((size_t) n >= size)
+    return size - 1;
+  return n + scrub_stats(buf + n, size - n);
+}
 
-	return 0;
+/* Work out what a path under /.versfs names. */
+static int hist_resolve(const char* path, struct hist_entry* he) {
+  const char* rel;
+  char parent[PATH_MAX];
+  char* slash;
+  char* end;
+  long vers_num;
+
+  if (strcmp(path, VERS_CTL_DIR) == 0 || strcmp(path, VERS_STATS_FILE) == 0) {
+    he->kind = path[strlen(VERS_CTL_DIR)] == '\0' ? HIST_CTL : HIST_STATS;
+    snprintf(he->storage, PATH_MAX, "%s", storage_dir);
+    return lstat(he->storage, &he->st) == -1 ? -errno : 0;
+  }
+  if (!under_dir(path, VERS_HISTORY_DIR))
+    return -ENOENT;
+
+  // Directories and files of the tree, which does not include the
+  // history itself.
+  rel = path + strlen(VERS_HISTORY_DIR);
+  if (under_dir(rel, VERS_CTL_DIR))
+    return -ENOENT;
+  snprintf(he->storage, PATH_MAX, "%s%s", storage_dir, rel);
+  if (lstat(he->storage, &he->st) == 0) {
+    if (S_ISDIR(he->st.st_mode)) {
+      he->kind = HIST_DIR;
+      return 0;
+    }
+    if (S_ISREG(he->st.st_mode)) {
+      he->kind = HIST_FILE;
+      return 0;
+    }
+    return -ENOENT;
+  }
+
+  // Otherwise <file>/<N>, a version.
+  snprintf(parent, PATH_MAX, "%s", he->storage);
+  slash = strrchr(parent, '/');
+  vers_num = strtol(slash + 1, &end, 10);
+  if (slash[1] == '\0' || *end != '\0' || vers_num < 0)
+    return -ENOENT;
+  *slash = '\0';
+  if (lstat(parent, &he->st) == -1 || !S_ISREG(he->st.st_mode))
+    return -ENOENT;
+
+  char versions_dir[PATH_MAX];
+  struct vstore_record rec;
+  struct stat live = he->st;
+  versions_dir_of(versions_dir, parent);
+  vstore_version_path(he->storage, versions_dir, vers_num);
+  if (lstat(he->storage, &he->st) == -1 ||
+      vstore_read_record(versions_dir, vers_num, &rec) < 0)
+    return -ENOENT;
+  // A length change or an append reads from its base.
+  vstore_version_path(he->storage, versions_dir, rec.base);
+  he->st.st_size = rec.length;
+  he->data_len = rec.data_len;
+  // Versions belong to whoever owns the file.
+  he->st.st_uid = live.st_uid;
+  he->st.st_gid = live.st_gid;
+  he->kind = HIST_VERSION;
+  return 0;
 }
 
-static int vers_rmdir(const char *path)
-{
-	int res;
+static int hist_getattr(const char* path, struct stat* stbuf) {
+  struct hist_entry he;
+  int res = hist_resolve(path, &he);
+
+  if (res < 0)
+    return res;
+  *stbuf = he.st;
+  if (he.kind == HIST_VERSION) {
+    stbuf->st_mode = S_IFREG | (he.st.st_mode & 0444);
+  } else if (he.kind == HIST_STATS) {
+    char text[VERS_STATS_MAX];
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+    stbuf->st_size = stats_text(text, sizeof(text));
+  } else {
+    stbuf->st_mode = S_IFDIR | 0555;
+    stbuf->st_nlink = 2;
+    if (he.kind == HIST_FILE)
+      stbuf->st_size = 0;
+  }
+  return 0;
+}
 
-	path = prepend_storage_dir(storage_path, path);
-	res = rmdir(path);
-	if (res == -1)
-		return -errno;
+static int hist_readdir(const char* path, void* buf, fuse_fill_dir_t filler) {
+  struct hist_entry he;
+  char versions_dir[PATH_MAX];
+  DIR* dp;
+  struct dirent* de;
+  int res = hist_resolve(path, &he);
+  int top = strcmp(path, VERS_HISTORY_DIR) == 0;
+  int full = 0;
+
+  if (res < 0)
+    return res;
+  if (he.kind == HIST_VERSION || he.kind == HIST_STATS)
+    return -ENOTDIR;
+
+  filler(buf, ".", NULL, 0);
+  filler(buf, "..", NULL, 0);
+  if (he.kind == HIST_CTL) {
+    filler(buf, "history", NULL, 0);
+    filler(buf, "stats", NULL, 0);
+    return 0;
+  }
+
+  if (he.kind == HIST_DIR) {
+    dp = opendir(he.storage);
+    if (dp == NULL)
+      return -errno;
+    while ((de = readdir(dp)) != NULL) {
+      struct stat st;
+      if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+	  (top && strcmp(de->d_name, VERS_CTL_DIR + 1) == 0))
+	continue;
+      // Only directories and regular files have a history; both are
+      // shown as directories.
+      if (de->d_type != DT_DIR && de->d_type != DT_REG &&
+	  de->d_type != DT_UNKNOWN)
+	continue;
+      memset(&st, 0, sizeof(st));
+      st.st_ino = de->d_ino;
+      st.st_mode = S_IFDIR;
+      if (filler(buf, de->d_name, &st, 0))
+	break;
+    }
+    closedir(dp);
+    return 0;
+  }
+
+  // A file: list the versions in each bucket of its history, bar the
+  // hidden files.
+  versions_dir_of(versions_dir, he.storage);
+  dp = opendir(versions_dir);
+  if (dp == NULL)
+    return errno == ENOENT ? 0 : -errno;
+  while (!full && (de = readdir(dp)) != NULL) {
+    char bucket[PATH_MAX];
+    struct dirent* ve;
+    DIR* bp;
+
+    if (de->d_name[0] == '.' ||
+	(de->d_type != DT_DIR && de->d_type != DT_UNKNOWN))
+      continue;
+    if (snprintf(bucket, PATH_MAX, "%s/%s", versions_dir,
+		 de->d_name) >= PATH_MAX)
+      continue;				/* Too long: names no bucket. */
+    bp = opendir(bucket);
+    if (bp == NULL)
+      continue;
+    while ((ve = readdir(bp)) != NULL) {
+      if (ve->d_name[0] == '.')
+	continue;
+      full = filler(buf, ve->d_name, NULL, 0);
+      if (full)
+	break;
+    }
+    closedir(bp);
+  }
+  closedir(dp);
+  return 0;
+}
 
-	return 0;
+static void hist_close(struct hist_file* f) {
+  if (f->m != NULL)
+    mapcache_put(f->m);
+  free(f->text);
+  free(f->storage);
+  free(f->sums);
+  free(f->checked);
+  free(f);
 }
 
-static int vers_symlink(const char *from, const char *to)
-{
-	int res;
-	char storage_from[256];
-	char storage_to[256];
+static int hist_open(const char* path, struct fuse_file_info* fi) {
+  struct hist_entry he;
+  struct hist_file* f;
+  int res = hist_resolve(path, &he);
+
+  if (res < 0)
+    return res;
+  if (he.kind != HIST_VERSION && he.kind != HIST_STATS)
+    return -EISDIR;
+  if ((fi->flags & O_ACCMODE) != O_RDONLY)
+    return -EROFS;
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL)
+    return -ENOMEM;
+  if (he.kind == HIST_STATS) {
+    // A snapshot, read past the kernel's idea of its size.
+    f->m = NULL;
+    f->text = malloc(VERS_STATS_MAX);
+    if (f->text == NULL) {
+      free(f);
+      return -ENOMEM;
+    }
+    f->length = f->data_len = stats_text(f->text, VERS_STATS_MAX);
+    fi->fh = (uintptr_t) f;
+    fi->direct_io = 1;
+    return 0;
+  }
+  f->m = mapcache_get(he.storage);
+  if (f->m == NULL) {
+    res = -errno;
+    free(f);
+    return res;
+  }
+  f->length = he.st.st_size;
+  f->data_len = he.data_len < (off_t) mapping_size(f->m) ?
+    he.data_len : (off_t) mapping_size(f->m);
+  // Versions from before checksums are read unchecked.
+  if (vstore_read_sums(he.storage, &f->sums, &f->nsums) == 0) {
+    f->checked = calloc(f->nsums + 1, 1);
+    f->storage = strdup(he.storage);
+    if (f->checked == NULL || f->storage == NULL) {
+      hist_close(f);
+      return -ENOMEM;
+    }
+  }
+  fi->fh = (uintptr_t) f;
+  // A version never changes, so the kernel may keep its pages across opens.
+  fi->keep_cache = 1;
+  return 0;
+}
 
-	prepend_storage_dir(storage_from, from);
-	prepend_storage_dir(storage_to,   to  );
-	res = symlink(storage_from, storage_to);
-	if (res == -1)
-		return -errno;
+/* Check the chunks that [offset, offset + size) of an open version's data
+   falls in, each the first time it is read.  A chunk longer than the
+   mapping was added to the base since it was mapped, and is left to later
+   opens.  Returns 0, or -EIO if a chunk does not match its checksum. */
+static int hist_check(struct hist_file* f, size_t size, off_t offset) {
+  const unsigned char* data = mapping_data(f->m);
+  size_t avail = mapping_size(f->m);
+  size_t i = offset / VSTORE_CHUNK;
+  size_t last = (offset + size - 1) / VSTORE_CHUNK;
+
+  if (f->sums == NULL || size == 0)
+    return 0;
+  for (; i <= last && i < f->nsums; i += 1) {
+    size_t start = i * (size_t) VSTORE_CHUNK;
+    if (__atomic_load_n(&f->checked[i], __ATOMIC_RELAXED) ||
+	start + f->sums[i].len > avail)
+      continue;
+    if (vstore_check_chunk(&f->sums[i], data + start, avail - start) < 0) {
+      scrub_report(f->storage, start);
+      return -EIO;
+    }
+    __atomic_store_n(&f->checked[i], 1, __ATOMIC_RELAXED);
+  }
+  return 0;
+}
 
-	return 0;
+static int hist_read(char* buf, size_t size, off_t offset,
+		     struct fuse_file_info* fi) {
+  struct hist_file* f = (struct hist_file*) (uintptr_t) fi->fh;
+  ssize_t res = 0;
+
+  if (offset >= f->length)
+    return 0;
+  if (size > f->length - offset)
+    size = f->length - offset;
+  if (f->m == NULL) {
+    memcpy(buf, f->text + offset, size);
+    return size;
+  }
+  if (offset < f->data_len) {
+    mapping_access(f->m, size, offset);
+    res = hist_check(f, size < f->data_len - offset ?
+		     size : f->data_len - offset, offset);
+    if (res < 0)
+      return res;
+    res = transform_mread(&pipeline, mapping_data(f->m), f->data_len,
+			  buf, size, offset);
+    if (res < 0)
+      return res;
+  }
+  // Past the data, a hole: zeros as stored.
+  if (res < size) {
+    ssize_t hole = transform_hole(&pipeline, buf + res, size - res,
+				  offset + res);
+    if (hole < 0)
+      return hole;
+    res += hole;
+  }
+  return res;
 }
 
-static int vers_rename(const char *from, const char *to)
+static int hist_access(const char* path, int mask) {
+  struct hist_entry he;
+
+  if (mask & W_OK)
+    return -EROFS;
+  return hist_resolve(path, &he);
+}
+
+
+static int vers_getattr(const char *path, struct stat *stbuf)
 {
-	printf("CALLING RENAME\n");
+	char storage_path[PATH_MAX];
 	int res;
-	char storage_from[256];
-	char storage_to[256];
 
-	// Keep track of the original path
-	char *orig_path = (char *)malloc(sizeof(char) * (strlen(from) + 1));
-	strcpy(orig_path, from);	
+	if (is_ctl_path(path))
+		return hist_getattr(path, stbuf);
 
-	// Keep track of the file name
-	char *placeholder = (char *)malloc(sizeof(char) * 50);
-	memset(placeholder, 0, sizeof(char) * 50);
-	strcpy(placeholder, to);
-	char *file_name = basename(placeholder);
+	// Buffered writes first, so that the size is right.
+	res = wbuf_flush_path(prepend_storage_dir(storage_path, path));
+	if (res < 0)
+		return res;
+	return pt_getattr(path, stbuf);
+}
 
-	prepend_storage_dir(storage_from, from);
-	prepend_storage_dir(storage_to,   to  );
+static int vers_access(const char *path, int mask)
+{
+	if (is_ctl_path(path))
+		return hist_access(path, mask);
+	return pt_access(path, mask);
+}
 
-	// Construct versions directory
-	char *versions_dir_path = (char *)malloc(sizeof(char) * 256);
-	memset(versions_dir_path, 0, 256 * sizeof(char));
-	strcpy(versions_dir_path, storage_from);
-	strcat(versions_dir_path, "__versions__");
-	
-	// Remove all files from the versions directory
+/* An open directory of the storage tree.  Listing resumes from the offset
+   FUSE passes back, so a large directory is read once across several
+   readdir calls rather than from the start on each. */
+struct vers_dirp {
 	DIR *dp;
-	struct dirent *de;
-	dp = opendir(versions_dir_path);
-	if (dp == NULL)
-		return -errno;
+	struct dirent *entry;
+	off_t offset;
+};
 
-	// Iterate through the directory and remove all entries
-	while ((de = readdir(dp)) != NULL) {
-		char *file_name = (char *)malloc(sizeof(char) * (strlen(de->d_name)+1));
-		memset(file_name, 0, (strlen(de->d_name)+1) * sizeof(char));
-		strcpy(file_name, de->d_name);
-		char *file_path = (char *)malloc(sizeof(char) * 256);
-		memset(file_path, 0, 256 *sizeof(char));
-		strcpy(file_path, versions_dir_path);
-		strcat(file_path, "/");
-		strcat(file_path, file_name);
-		printf("Path of file is: %s\n", file_path);
-		if ((strcmp(file_name, "..") == 0) || (strcmp(file_name, ".") == 0)) {
-			continue;
-		} else {
-			unlink(file_path);
-		}
+static int vers_opendir(const char *path, struct fuse_file_info *fi)
+{
+	char storage_path[PATH_MAX];
+	int res;
+	struct vers_dirp *d;
+
+	// The history view is listed in one go; no handle.
+	if (is_ctl_path(path)) {
+		fi->fh = 0;
+		return 0;
 	}
 
-	// Remove the versions directory
-	res = rmdir(versions_dir_path);
-	if (res == -1)
-		return -errno;
+	d = malloc(sizeof(struct vers_dirp));
+	if (d == NULL)
+		return -ENOMEM;
 
-	// Adjust the path a bit
-	memset(versions_dir_path, 0, sizeof(char) * 256);
-	strcpy(versions_dir_path, storage_to);
-	strcat(versions_dir_path, "__versions__");
-
-	// Add the versions directory of the new file
-	char *version_file_path = (char *)malloc(sizeof(char) * 256);
-	memset(version_file_path, 0, 256 * sizeof(char));
-	strcpy(version_file_path, versions_dir_path);
-	strcat(version_file_path, "/.version_file.txt");
-	
-	res = mkdir(versions_dir_path, S_IRWXU | S_IRGRP | S_IROTH);
-	if (res == -1)
-		return -errno;
-	char *version_file_buf = (char *)malloc(sizeof(char) * 2);
-	memset(version_file_buf, 0, sizeof(char) * 2);
-	*version_file_buf = '0';
-	*(version_file_buf+1) = '\0';
-	
-	int fd;
-	fd = open(version_file_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-	if (fd == -1)
-		return -errno;
-	res = pwrite(fd, version_file_buf, 2, 0);
-	if (res == -1)
-		return -errno;
-	close(fd);
+	path = prepend_storage_dir(storage_path, path);
+	d->dp = opendir(path);
+	if (d->dp == NULL) {
+		res = -errno;
+		free(d);
+		return res;
+	}
+	d->offset = 0;
+	d->entry = NULL;
 
-	char *reg_file_path = (char *)malloc(sizeof(char) * 256);
-	memset(reg_file_path, 0, 256 * sizeof(char));
-	strcpy(reg_file_path, versions_dir_path);
-	strcat(reg_file_path, "/");
-	strcat(reg_file_path, file_name);
-	strcat(reg_file_path, ",0");
+	fi->fh = (unsigned long) d;
+	return 0;
+}
 
-	struct stat st;
-	memset(&st, 0, sizeof(stat));
-	res = lstat(storage_from, &st);
-	if (res == -1)
-		return -errno;
-	off_t prev_vers_size = st.st_size;
+static int vers_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+		       off_t offset, struct fuse_file_info *fi)
+{
+	struct vers_dirp *d = (struct vers_dirp *) (uintptr_t) fi->fh;
+	unsigned generation = attrcache_generation();
+	char entry_path[PATH_MAX];
+	size_t path_len = strcmp(path, "/") == 0 ? 0 : strlen(path);
+
+	if (d == NULL)
+		return hist_readdir(path, buf, filler);
+
+	// Histories live outside the tree, so every entry is passed through.
+	if (offset != d->offset) {
+		seekdir(d->dp, offset);
+		d->entry = NULL;
+		d->offset = offset;
+	}
+	while (1) {
+		struct stat st;
+		off_t nextoff;
 
-	char prev_vers_buf[prev_vers_size]; 
-	fd = open(storage_from, O_RDONLY);
-	if (fd == -1)
-		return -errno;
-	res = pread(fd, prev_vers_buf, prev_vers_size, 0);
-	if (res == -1)
-		return -errno;
-	close(fd);
-		
-	// Add that to the new version first
-	fd = open(reg_file_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-	if (fd == -1)
-		return -errno;
-	res = pwrite(fd, prev_vers_buf, prev_vers_size, 0);
-	if (res == -1)
-		return -errno;
-	close(fd);
+		if (!d->entry) {
+			d->entry = readdir(d->dp);
+			if (!d->entry)
+				break;
+		}
 
-	res = rename(storage_from, storage_to);
-	if (res == -1)
-		return -errno;
+		// Full attributes, relative to the open directory rather than
+		// by path, and parked for the getattr that usually follows.
+		if (fstatat(dirfd(d->dp), d->entry->d_name, &st,
+			    AT_SYMLINK_NOFOLLOW) == 0) {
+			if (path_len + strlen(d->entry->d_name) + 2 <= PATH_MAX &&
+			    strcmp(d->entry->d_name, ".") != 0 &&
+			    strcmp(d->entry->d_name, "..") != 0 &&
+			    !(path_len == 0 &&
+			      strcmp(d->entry->d_name, VERS_CTL_DIR + 1) == 0)) {
+				memcpy(entry_path, path, path_len);
+				entry_path[path_len] = '/';
+				strcpy(entry_path + path_len + 1, d->entry->d_name);
+				attrcache_put(entry_path, &st, generation);
+			}
+		} else {
+			memset(&st, 0, sizeof(st));
+			st.st_ino = d->entry->d_ino;
+			st.st_mode = d->entry->d_type << 12;
+		}
+		nextoff = telldir(d->dp);
+		if (filler(buf, d->entry->d_name, &st, nextoff))
+			break;
+
+		d->entry = NULL;
+		d->offset = nextoff;
+	}
 
 	return 0;
 }
 
-static int vers_link(const char *from, const char *to)
+static int vers_releasedir(const char *path, struct fuse_file_info *fi)
 {
-	int res;
-	char storage_from[256];
-	char storage_to[256];
-
-	prepend_storage_dir(storage_from, from);
-	prepend_storage_dir(storage_to,   to  );
-	res = link(storage_from, storage_to);
-	if (res == -1)
-		return -errno;
+	struct vers_dirp *d = (struct vers_dirp *) (uintptr_t) fi->fh;
 
+	(void) path;
+	if (d != NULL) {
+		closedir(d->dp);
+		free(d);
+	}
 	return 0;
 }
 
-static int vers_chmod(const char *path, mode_t mode)
+static int vers_unlink(const char *path)
 {
+	char storage_path[PATH_MAX];
 	int res;
 
+	if (is_ctl_path(path))
+		return -EROFS;
+
 	path = prepend_storage_dir(storage_path, path);
-	res = chmod(path, mode);
+
+	// Remove the history, then the file
+	res = wbuf_flush_path(path);
+	if (res < 0)
+		return res;
+	filelock_lock(path);
+	res = remove_history(path);
+	if (res < 0) {
+		filelock_unlock(path);
+		return res;
+	}
+	fp_forget(path);
+	vwin_forget(path);
+
+	// Remove the given file
+	oplog_lock();
+	res = unlink(path);
+	if (res == 0)
+		oplog_record(OPLOG_UNLINK, path, NULL);
+	oplog_unlock();
+	filelock_unlock(path);
+	attrcache_invalidate();
 	if (res == -1)
 		return -errno;
 
 	return 0;
 }
 
-static int vers_chown(const char *path, uid_t uid, gid_t gid)
+static int vers_rmdir(const char *path)
 {
+	char storage_path[PATH_MAX];
+	char versions_dir[PATH_MAX];
 	int res;
 
-	path = prepend_storage_dir(storage_path, path);
-	res = lchown(path, uid, gid);
-	if (res == -1)
-		return -errno;
+	res = pt_rmdir(path);
+	if (res < 0)
+		return res;
+
+	// Its part of the history tree is empty by now, if it exists at all.
+	versions_dir_of(versions_dir, prepend_storage_dir(storage_path, path));
+	rmdir(versions_dir);
 
 	return 0;
 }
 
-static int vers_truncate(const char *path, off_t size)
+static int vers_rename(const char *from, const char *to)
 {
-	printf("\nCALLING VERS_TRUNCATE\n");
-	int fd;
 	int res;
-
-	// Keep track of the original path
-	char *orig_path = (char *)malloc(sizeof(char) * (strlen(path) + 1));
-	strcpy(orig_path, path);	
-	//printf("original path is: %s\n", orig_path);
-
-	// Keep track of the file name
-	char *file_name = basename(orig_path);
-	//printf("Base name is %s\n", file_name);
-
-	path = prepend_storage_dir(storage_path, path);
-
-	// Keep track of size of previous file
-	off_t prev_file_size;
+	char storage_from[PATH_MAX];
+	char storage_to[PATH_MAX];
+	char history_from[PATH_MAX];
+	char history_to[PATH_MAX];
+	char history_parent[PATH_MAX];
 	struct stat st;
-	memset(&st, 0, sizeof(stat));
-	res = lstat(path, &st);
-	if (res == -1)
-		return -errno;
-	prev_file_size = st.st_size;
-	//printf("Prev file size is %ld\n", prev_file_size);
-
-	// Construct path for versions directory
-	char *versions_dir_path = (char *)malloc(sizeof(char) * 256);
-	memset(versions_dir_path, 0, 256 * sizeof(char));
-	strcpy(versions_dir_path, path);
-	strcat(versions_dir_path, "__versions__");
-
-	// Construct path for versions file
-	char *version_file_path = (char *)malloc(sizeof(char) * 256);
-	memset(version_file_path, 0, 256 * sizeof(char));
-	strcpy(version_file_path, versions_dir_path);
-	strcat(version_file_path, "/.version_file.txt");
-	
-	// Perform the truncate
-	res = truncate(path, size);
-	if (res == -1)
-		return -errno;
 
-	// Just debugging code
-	if (prev_file_size < size) {
-		printf("INCREASING SIZE OF FILE\n");
-	} else {
-		printf("DECREASING SIZE OF FILE\n");
-	}
+	if (is_ctl_path(from) || is_ctl_path(to))
+		return -EROFS;
 
-	// Add a new version of the file
-	DIR *dir = opendir(versions_dir_path);
-	if (dir == NULL) {
-		printf("ERROR. TRYING TO TRUNCATE A FILE THAT DOESN'T EXIST.\n");
+	prepend_storage_dir(storage_from, from);
+	prepend_storage_dir(storage_to,   to  );
+	res = wbuf_flush_path(storage_from);
+	if (res == 0)
+		res = wbuf_flush_path(storage_to);
+	if (res < 0)
+		return res;
+	if (lstat(storage_from, &st) == -1)
 		return -errno;
-	}
 
-	// Useful variables
-	int prev_vers_num;
-	char *prev_vers_num_str = (char *)malloc(sizeof(char) * 5);
-	memset(prev_vers_num_str, 0, 5 * sizeof(char));
+	if (S_ISDIR(st.st_mode)) {
+		// Writes buffered for files below, and versions still being
+		// gathered, are stored under the old names: a buffer keeps the
+		// path it was written through.
+		res = wbuf_flush_all();
+		if (res == 0)
+			res = vwin_settle_tree(storage_from);
+		if (res == 0)
+			res = pt_rename(from, to);
+		if (res < 0)
+			return res;
+
+		// The histories of the files below move with the directory.
+		versions_dir_of(history_from, storage_from);
+		versions_dir_of(history_to, storage_to);
+		strcpy(history_parent, history_to);
+		*strrchr(history_parent, '/') = '\0';
+		if (make_dirs(history_parent) == 0)
+			rename(history_from, history_to);
+		fp_forget_tree(storage_from);
+		return 0;
+	}
 
-	// Read previous version number
-	fd = open(version_file_path, O_RDONLY);
-	if (fd == -1)
-		return -errno;
-	res = pread(fd, prev_vers_num_str, 5, 0);
-	if (res == -1)
-		return -errno;
-	prev_vers_num = atoi(prev_vers_num_str);
-	close(fd);
-
-	// Get current version number
-	int curr_vers_num = prev_vers_num + 1;
-	char *curr_vers_num_str = (char *)malloc(sizeof(char) * 5);
-	memset(curr_vers_num_str, 0, 5 * sizeof(char));
-	res = sprintf(curr_vers_num_str, "%d", curr_vers_num);
-	if (res == -1)
-		return -errno;
-	//printf("Previous version number is: %s\n", prev_vers_num_str);
-	//printf("Current version number is: %s\n", curr_vers_num_str);
+	if (!S_ISREG(st.st_mode))
+		return pt_rename(from, to);
+
+	// A file renamed over keeps its history, with what it last held.
+	res = vwin_settle(storage_to);
+	if (res < 0)
+		return res;
+	filelock_lock2(storage_from, storage_to);
+	res = remove_history(storage_from);
+	if (res < 0)
+		goto out;
+	fp_forget(storage_from);
+	vwin_forget(storage_from);
+
+	oplog_lock();
+	res = rename(storage_from, storage_to);
+	if (res == 0)
+		oplog_record(OPLOG_RENAME, storage_to, storage_from);
+	oplog_unlock();
+	attrcache_invalidate();
 
-	// Update version file
-	fd = open(version_file_path, O_WRONLY);
-	if (fd == -1)
-		return -errno;
-	res = pwrite(fd, curr_vers_num_str, 5, 0);
-	if (res == -1)
-		return -errno;
-	close(fd);
-
-	// Add the corresponding version of the file
-	char *reg_file_path = (char *)malloc(sizeof(char) * 256);	
-	memset(reg_file_path, 0, 256 * sizeof(char));
-	char *prev_vers_file_path = (char *)malloc(sizeof(char) * 256);
-	memset(reg_file_path, 0, 256 * sizeof(char));
-	
-	strcpy(reg_file_path, versions_dir_path);
-	strcat(reg_file_path, "/");
-	strcat(reg_file_path, file_name);
-	strcat(reg_file_path, ",");
-
-	strcpy(prev_vers_file_path, reg_file_path);
-	strcat(reg_file_path, curr_vers_num_str);
-	strcat(prev_vers_file_path, prev_vers_num_str);
-	//printf("Regular file path is: %s\n", reg_file_path);
-	//printf("Prev vers file path is: %s\n", prev_vers_file_path);
-
-	char prev_vers_buf[prev_file_size]; 
-	fd = open(prev_vers_file_path, O_RDONLY);
-	if (fd == -1)
-		return -errno;
-	res = pread(fd, prev_vers_buf, prev_file_size, 0);
+	// The renamed file starts a history of its own, its current contents
+	// being the first version.
 	if (res == -1)
-		return -errno;
-	close(fd);
-	
-	// Add that to the new version
-	//printf("Opening the reg_file_path: %s\n", reg_file_path);
-	fd = open(reg_file_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-	if (fd == -1)
-		return -errno;
-	res = pwrite(fd, prev_vers_buf, size, 0);
-	if (res == -1)
-		return -errno;
-	close(fd);
-
-	printf("VERS_TRUNCATE SUCCESSFUL\n\n");
-	return 0;
+		res = -errno;
+	else
+		res = vers_commit(storage_to, 0, -1);
+ out:
+	filelock_unlock2(storage_from, storage_to);
+	return res;
 }
 
-#ifdef HAVE_UTIMENSAT
-static int vers_utimens(const char *path, const struct timespec ts[2])
+static int vers_link(const char *from, const char *to)
 {
 	int res;
+	char storage_from[PATH_MAX];
+	char storage_to[PATH_MAX];
 
-	/* don't use utime/utimes since they follow symlinks */
-	path = prepend_storage_dir(storage_path, path);
-	res = utimensat(0, path, ts, AT_SYMLINK_NOFOLLOW);
+	if (is_ctl_path(from) || is_ctl_path(to))
+		return -EROFS;
+
+	prepend_storage_dir(storage_from, from);
+	prepend_storage_dir(storage_to,   to  );
+
+	// Once linked, the file can change through the other name without a
+	// version under this one, so its fingerprint is no longer to be
+	// trusted, even should the link go again.
+	filelock_lock(storage_from);
+	oplog_lock();
+	res = link(storage_from, storage_to);
+	if (res == 0)
+		oplog_record(OPLOG_LINK, storage_to, storage_from);
+	oplog_unlock();
+	fp_forget(storage_from);
+	filelock_unlock(storage_from);
+	attrcache_invalidate();
 	if (res == -1)
 		return -errno;
 
 	return 0;
 }
-#endif
 
-static int vers_open(const char *path, struct fuse_file_info *fi)
+static int vers_truncate(const char *path, off_t size)
 {
-	printf("\nCALLING VERS_OPEN\n");
+	char storage_path[PATH_MAX];
+	struct stat before;
 	int res;
 
+	if (is_ctl_path(path))
+		return -EROFS;
+
 	path = prepend_storage_dir(storage_path, path);
-	printf("Trying to open up the file at: %s\n", path);
-	res = open(path, fi->flags);
+	res = wbuf_flush_path(path);
+	if (res < 0)
+		return res;
+
+	// Perform the truncate.  Growing the file leaves a hole, not zeroes,
+	// and the new version keeps that hole.
+	filelock_lock(path);
+	res = lstat(path, &before);
+	if (res == 0)
+		res = truncate(path, size);
+	attrcache_invalidate();
 	if (res == -1)
-		return -errno;
+		res = -errno;
+	else if (size < before.st_size)
+		res = note_change(path, size, before.st_size - size);
+	else
+		res = note_change(path, before.st_size, size - before.st_size);
+	if (res > 0)
+		res = vers_commit_resize(path, &before, size);
+	filelock_unlock(path);
 
-	close(res);
+	return res;
+}
 
-	printf("VERS_OPEN SUCCESSFUL\n\n");
-	return 0;
+static int vers_open(const char *path, struct fuse_file_info *fi)
+{
+	if (is_ctl_path(path))
+		return hist_open(path, fi);
+	return pt_open(path, fi);
 }
 
 static int vers_read(const char *path, char *buf, size_t size, off_t offset,
 		    struct fuse_file_info *fi)
 {
-	printf("CALLING VERS_READ\n");
-	int fd;
 	int res;
-	int i;
-	char temp_buf[size];
 
-	(void) fi;
-	path = prepend_storage_dir(storage_path, path);
-	fd = open(path, O_RDONLY);
-	if (fd == -1)
-		return -errno;
+	if (is_ctl_path(path))
+		return hist_read(buf, size, offset, fi);
 
-	res = pread(fd, temp_buf, size, offset);
-	if (res == -1)
-		res = -errno;
+	res = wbuf_flush_fd(fi->fh);
+	if (res < 0)
+		return res;
+	return pt_read(path, buf, size, offset, fi);
+}
 
-	// Move data from temporary buffer into provided one.
-	for (i = 0; i < size; i += 1) {
-	  buf[i] = temp_buf[i];
+#if PT_HAVE_BUF
+/* A file opened read-only, stored as it reads, is answered with the storage
+   file itself, for libfuse to splice to the kernel (see pt_read_buf()).
+   Everything else is read into memory as by vers_read(). */
+static int vers_read_buf(const char *path, struct fuse_bufvec **bufp,
+			 size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec *buf;
+	char *mem;
+	int res;
+
+	if (!is_ctl_path(path) && pipeline.nstages == 0 &&
+	    (fi->flags & O_ACCMODE) == O_RDONLY) {
+		res = wbuf_flush_fd(fi->fh);
+		if (res < 0)
+			return res;
+		return pt_read_buf(path, bufp, size, offset, fi);
 	}
 
-	close(fd);
-	return res;
+	buf = malloc(sizeof(*buf));
+	mem = malloc(size);
+	if (buf == NULL || mem == NULL) {
+		free(buf);
+		free(mem);
+		return -ENOMEM;
+	}
+	res = vers_read(path, mem, size, offset, fi);
+	if (res < 0) {
+		free(buf);
+		free(mem);
+		return res;
+	}
+	// libfuse frees both once the reply is sent.
+	*buf = FUSE_BUFVEC_INIT(res);
+	buf->buf[0].mem = mem;
+	*bufp = buf;
+	return 0;
 }
+#endif
 
 static int vers_write(const char *path, const char *buf, size_t size,
 		     off_t offset, struct fuse_file_info *fi)
 {
-	printf("\nCALLING VERS_WRITE\n");
-	int fd;
+	char storage_path[PATH_MAX];
 	int res;
-	int i;
-	char temp_buf[size];
-
-	(void) fi;
-
-	// Keep track of the original path
-	char *orig_path = (char *)malloc(sizeof(char) * (strlen(path) + 1));
-	memset(orig_path, 0, (strlen(path) + 1) * sizeof(char));
-	strcpy(orig_path, path);	
+	int vres;
 
-	// Keep track of the name of file
-	char *file_name = basename(orig_path);
+	if (is_ctl_path(path))
+		return -EROFS;
 
 	path = prepend_storage_dir(storage_path, path);
 
-	// Actually write to file
-	fd = open(path, O_WRONLY);
-	if (fd == -1)
-		return -errno;
-	for (i = 0; i < size; i += 1) {
-		temp_buf[i] = buf[i];
+	// Small writes are gathered and stored (as one version) together.
+	res = wbuf_write(fi->fh, path, buf, size, offset);
+	if (res != 0) {
+		attrcache_invalidate();
+		return res;
 	}
-	res = pwrite(fd, temp_buf, size, offset);
-	if (res == -1)
-		res = -errno;
-	close(fd);
-
-	// Versions directory path
-	char *versions_dir_path = (char *)malloc(sizeof(char) * 256);
-	memset(versions_dir_path, 0, 256 * sizeof(char));
-	strcpy(versions_dir_path, path);
-	strcat(versions_dir_path, "__versions__");
-	//printf("Versions directory is: %s\n", versions_dir_path);
-
-	char *version_file_path = (char *)malloc(sizeof(char) * 256);
-	memset(version_file_path, 0, 256 * sizeof(char));
-	strcpy(version_file_path, versions_dir_path);
-	strcat(version_file_path, "/.version_file.txt");
-	//printf("Versions file path is: %s\n", version_file_path);
-	
-	DIR *dir = opendir(versions_dir_path);
-	if (dir) {
-
-		printf("NOT THE FIRST VERSION OF THE FILE\n");
-		// Variables
-		int prev_vers_num;
-		char *prev_vers_num_str = (char *)malloc(sizeof(char) * 5);
-		memset(prev_vers_num_str, 0, 5 * sizeof(char));
-
-		// Read the previous version number
-		fd = open(version_file_path, O_RDONLY);
-		if (fd == -1)
-			return -errno;
-		res = pread(fd, prev_vers_num_str, 5, 0);
-		if (res == -1)
-			return -errno;
-		prev_vers_num = atoi(prev_vers_num_str);
-		close(fd);
-
-		// Get current version number
-		int curr_vers_num = prev_vers_num + 1;
-		char *curr_vers_num_str = (char *)malloc(sizeof(char) * 5);
-		memset(curr_vers_num_str, 0, 5 * sizeof(char));
-		res = sprintf(curr_vers_num_str, "%d", curr_vers_num);
-		if (res == -1)
-			return -errno;
-		//printf("Previous version number is: %s\n", prev_vers_num_str);
-		//printf("Current version number is: %s\n", curr_vers_num_str);
-
-		// Update version file
-		fd = open(version_file_path, O_WRONLY);
-		if (fd == -1)
-			return -errno;
-		res = pwrite(fd, curr_vers_num_str, 5, 0);
-		if (res == -1)
-			return -errno;
-		close(fd);
-
-		// Add the corresponding version of the file
-		char *reg_file_path = (char *)malloc(sizeof(char) * 256);	
-		memset(reg_file_path, 0, 256 * sizeof(char));
-		char *prev_vers_file_path = (char *)malloc(sizeof(char) * 256);
-		memset(reg_file_path, 0, 256 * sizeof(char));
-		
-		strcpy(reg_file_path, versions_dir_path);
-		strcat(reg_file_path, "/");
-		strcat(reg_file_path, file_name);
-		strcat(reg_file_path, ",");
-
-		strcpy(prev_vers_file_path, reg_file_path);
-		strcat(reg_file_path, curr_vers_num_str);
-		strcat(prev_vers_file_path, prev_vers_num_str);
-		//printf("Regular file path is: %s\n", reg_file_path);
-		//printf("Prev vers file path is: %s\n", prev_vers_file_path);
 
-		struct stat st;
-		memset(&st, 0, sizeof(stat));
-		res = lstat(prev_vers_file_path, &st);
-		if (res == -1)
-			return -errno;
-		off_t prev_vers_size = st.st_size;
-		//printf("Size of previous file is %ld\n", prev_vers_size);
-
-		char prev_vers_buf[prev_vers_size]; 
-		fd = open(prev_vers_file_path, O_RDONLY);
-		if (fd == -1)
-			return -errno;
-		res = pread(fd, prev_vers_buf, prev_vers_size, 0);
-		if (res == -1)
-			return -errno;
-		close(fd);
-		
-		// Add that to the new version first
-		//printf("Opening the reg_file_path: %s\n", reg_file_path);
-		fd = open(reg_file_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-		if (fd == -1)
-			return -errno;
-		// Then add what's actually being written
-		res = pwrite(fd, prev_vers_buf, offset, 0);
-		if (res == -1)
-			return -errno;
-		res = pwrite(fd, buf, size, offset);
-		if (res == -1)
-			return -errno;
-		close(fd);
-
-	} else if (ENOENT == errno) {
-		
-		printf("FIRST VERSION OF THE FILE\n");
-		
-		res = mkdir(versions_dir_path, S_IRWXU | S_IRGRP | S_IROTH);
-		if (res == -1)
-			return -errno;
-		char *version_file_buf = (char *)malloc(sizeof(char) * 2);
-		memset(version_file_buf, 0, sizeof(char) * 2);
-		*version_file_buf = '0';
-		*(version_file_buf+1) = '\0';
-		
-		fd = open(version_file_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-		if (fd == -1)
-			return -errno;
-		res = pwrite(fd, version_file_buf, 2, 0);
-		if (res == -1)
-			return -errno;
-		close(fd);
-
-		char *reg_file_path = (char *)malloc(sizeof(char) * 256);
-		memset(reg_file_path, 0, 256 * sizeof(char));
-		strcpy(reg_file_path, versions_dir_path);
-		strcat(reg_file_path, "/");
-		strcat(reg_file_path, file_name);
-		strcat(reg_file_path, ",0");
-		fd = open(reg_file_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-		if (fd == -1)
-			return -errno;
-		res = pwrite(fd, buf, size, offset);
-		if (res == -1)
-			return -errno;
-		close(fd);
-		
-
-	} 
-
-	printf("VERS_WRITE SUCCESSFUL\n\n");
+	// Actually write to file, and store the result before any other
+	// write to it does, so that its versions come in the order written.
+	filelock_lock(path);
+	res = transform_pwrite(&pipeline, fi->fh, buf, size, offset);
+	attrcache_invalidate();
+
+	// The new version is a copy of the whole file as it now stands, made
+	// now or when the file's version window closes.
+	if (res < 0)
+		fp_forget(path);
+	vres = res < 0 ? 0 : note_change(path, offset, size);
+	if (vres > 0)
+		vres = vers_commit(path, offset, size);
+	filelock_unlock(path);
+	if (vres < 0)
+		return vres;
+
 	return res;
 }
 
-static int vers_statfs(const char *path, struct statvfs *stbuf)
+/* Called on every close() of the file, which gets its result. */
+static int vers_flush(const char *path, struct fuse_file_info *fi)
 {
-	int res;
-
-	path = prepend_storage_dir(storage_path, path);
-	res = statvfs(path, stbuf);
-	if (res == -1)
-		return -errno;
-
-	return 0;
+	if (is_ctl_path(path))
+		return 0;
+	return wbuf_flush_fd(fi->fh);
 }
 
 static int vers_release(const char *path, struct fuse_file_info *fi)
 {
-	/* Just a stub.	 This method is optional and can safely be left
-	   unimplemented */
-
-	(void) path;
-	(void) fi;
+	if (is_ctl_path(path)) {
+		hist_close((struct hist_file *) (uintptr_t) fi->fh);
+	} else {
+		// The buffer may use this descriptor, so it goes first.
+		wbuf_flush_fd(fi->fh);
+		close(fi->fh);
+	}
 	return 0;
 }
 
 static int vers_fsync(const char *path, int isdatasync,
 		     struct fuse_file_info *fi)
 {
-	/* Just a stub.	 This method is optional and can safely be left
-	   unimplemented */
+	int res;
+
+	if (is_ctl_path(path))
+		return 0;
+
+	res = wbuf_flush_fd(fi->fh);
+	if (res < 0 || durability == DURABLE_FLUSH)
+		return res;
+
+	// The versions, counters and namespace log written for this file
+	// are all over the storage directory, so the whole file system is
+	// synced; concurrent calls share one sync (gsync.h).
+	return gsync(fi->fh, (isdatasync ? GSYNC_DATA : 0) | GSYNC_FS);
+}
+
+static int vers_fsyncdir(const char *path, int isdatasync,
+			struct fuse_file_info *fi)
+{
+	struct vers_dirp *d = (struct vers_dirp *) (uintptr_t) fi->fh;
 
 	(void) path;
-	(void) isdatasync;
-	(void) fi;
-	return 0;
+	if (d == NULL || durability == DURABLE_FLUSH)
+		return 0;
+	return gsync(dirfd(d->dp), (isdatasync ? GSYNC_DATA : 0) | GSYNC_FS);
 }
 
-#ifdef HAVE_POSIX_FALLOCATE
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
 static int vers_fallocate(const char *path, int mode,
 			off_t offset, off_t length, struct fuse_file_info *fi)
 {
+	char storage_path[PATH_MAX];
 	int fd;
 	int res;
-
-	(void) fi;
-
-	if (mode)
+	struct stat before, after;
+
+	if (is_ctl_path(path))
+		return -EROFS;
+#ifdef HAVE_FALLOCATE
+	// Punching, zeroing, collapsing and inserting leave raw zero bytes
+	// in the storage file, which a transform would decode to something
+	// else; only allocating, which leaves the bytes alone, goes through.
+	if (pipeline.nstages > 0 && (mode & ~FALLOC_FL_KEEP_SIZE))
 		return -EOPNOTSUPP;
+#endif
 
 	path = prepend_storage_dir(storage_path, path);
-	fd = open(path, O_WRONLY);
-	if (fd == -1)
-		return -errno;
+	fd = fi->fh;
+
+	res = wbuf_flush_fd(fd);
+	if (res < 0)
+		return res;
 
-	res = -posix_fallocate(fd, offset, length);
+	filelock_lock(path);
+	if (fstat(fd, &before) == -1) {
+		res = -errno;
+		goto out;
+	}
 
-	close(fd);
+#ifdef HAVE_FALLOCATE
+	// Plain allocation, FALLOC_FL_KEEP_SIZE, FALLOC_FL_PUNCH_HOLE and
+	// FALLOC_FL_ZERO_RANGE all go straight to the storage file, so holes
+	// punched here are holes in the storage file and in its versions.
+	res = fallocate(fd, mode, offset, length) == -1 ? -errno : 0;
+#else
+	if (mode)
+		res = -EOPNOTSUPP;
+	else
+		res = -posix_fallocate(fd, offset, length);
+#endif
+	attrcache_invalidate();
+	if (res == 0 && fstat(fd, &after) == -1)
+		res = -errno;
+	if (res < 0)
+		goto out;
+
+	// Reserving space changes nothing a reader can see unless it grows
+	// the file; punching holes and zeroing ranges always changes content.
+#ifdef HAVE_FALLOCATE
+	if (!(mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) &&
+	    after.st_size == before.st_size)
+		goto out;
+#else
+	if (after.st_size == before.st_size)
+		goto out;
+#endif
+
+	res = note_change(path, 0, -1);
+	if (res > 0)
+		res = vers_commit(path, 0, -1);
+ out:
+	filelock_unlock(path);
 	return res;
 }
 #endif
 
-#ifdef HAVE_SETXATTR
-/* xattr operations are optional and can safely be left unimplemented */
-static int vers_setxattr(const char *path, const char *name, const char *value,
-			size_t size, int flags)
+/* Setting this attribute on a file or directory restores it to an earlier
+   version instead of storing anything: the value is a version number, or
+   @<Unix time> for the version current at that time (see vstore_restore()).
+   For example: setfattr -n user.versfs.restore -v 3 foo.txt */
+#define VERS_RESTORE_XATTR "user.versfs.restore"
+
+static int vers_restore(const char *path, const char *value, size_t size)
 {
-	path = prepend_storage_dir(storage_path, path);
-	int res = lsetxattr(path, name, value, size, flags);
-	if (res == -1)
-		return -errno;
-	return 0;
+	char spec[64];
+	int res;
+
+	if (size == 0 || size >= sizeof(spec))
+		return -EINVAL;
+	memcpy(spec, value, size);
+	spec[size] = '\0';
+
+	// Anything buffered belongs before the restore.  Each restored file's
+	// new version is ordered like any other commit, under its lock, which
+	// vstore_restore() takes file by file below a directory.
+	res = wbuf_flush_all();
+	if (res == 0)
+		res = vwin_settle_all();
+	if (res == 0)
+		res = vstore_restore(storage_dir, path, spec, filelock_lock,
+				     filelock_unlock);
+	attrcache_invalidate();
+	return res;
 }
 
-static int vers_getxattr(const char *path, const char *name, char *value,
-			size_t size)
+/* Always registered, for the restore trigger; other attributes are passed
+   through only when the platform has xattrs. */
+static int vers_setxattr(const char *path, const char *name, const char *value,
+			size_t size, int flags)
 {
-	path = prepend_storage_dir(storage_path, path);
-	int res = lgetxattr(path, name, value, size);
-	if (res == -1)
-		return -errno;
-	return res;
+	if (is_ctl_path(path))
+		return -EROFS;
+	if (strcmp(name, VERS_RESTORE_XATTR) == 0)
+		return vers_restore(path, value, size);
+
+#ifdef HAVE_SETXATTR
+	return pt_setxattr(path, name, value, size, flags);
+#else
+	(void) flags;
+	return -ENOTSUP;
+#endif
 }
 
-static int vers_listxattr(const char *path, char *list, size_t size)
+static void *vers_init(struct fuse_conn_info *conn)
 {
-	path = prepend_storage_dir(storage_path, path);
-	int res = llistxattr(path, list, size);
-	if (res == -1)
-		return -errno;
-	return res;
+	PT_WANT_BIG_WRITES(conn);
+#if PT_HAVE_BUF
+	// Replies to reads answered with a storage file are spliced from it.
+	conn->want |= conn->capable & FUSE_CAP_SPLICE_WRITE;
+#endif
+
+	// Started here rather than in main(), which runs before fuse_main()
+	// forks into the background.
+	iob_init();
+	char history_root[PATH_MAX];
+	snprintf(history_root, PATH_MAX, "%s" VERS_HISTORY_DIR, storage_dir);
+	if (scrub_start(history_root, scrub_mb, scrub_interval) < 0)
+		fprintf(stderr, "WARNING: No scrubber; versions are checked as "
+			"they are read only\n");
+	return NULL;
 }
 
-static int vers_removexattr(const char *path, const char *name)
+static void vers_destroy(void *private_data)
 {
-	path = prepend_storage_dir(storage_path, path);
-	int res = lremovexattr(path, name);
-	if (res == -1)
-		return -errno;
-	return 0;
+	(void) private_data;
+	scrub_stop();
+	wbuf_shutdown();
+	vwin_shutdown();
+	oplog_close();
+	iob_shutdown();
 }
-#endif /* HAVE_SETXATTR */
 
 static struct fuse_operations vers_oper = {
+	.init		= vers_init,
+	.destroy	= vers_destroy,
 	.getattr	= vers_getattr,
 	.access		= vers_access,
-	.readlink	= vers_readlink,
+	.readlink	= pt_readlink,
+	.opendir	= vers_opendir,
 	.readdir	= vers_readdir,
-	.mknod		= vers_mknod,
-	.mkdir		= vers_mkdir,
-	.symlink	= vers_symlink,
+	.releasedir	= vers_releasedir,
+	.mknod		= pt_mknod,
+	.mkdir		= pt_mkdir,
+	.symlink	= pt_symlink,
 	.unlink		= vers_unlink,
 	.rmdir		= vers_rmdir,
 	.rename		= vers_rename,
 	.link		= vers_link,
-	.chmod		= vers_chmod,
-	.chown		= vers_chown,
+	.chmod		= pt_chmod,
+	.chown		= pt_chown,
 	.truncate	= vers_truncate,
 #ifdef HAVE_UTIMENSAT
-	.utimens	= vers_utimens,
+	.utimens	= pt_utimens,
 #endif
 	.open		= vers_open,
 	.read		= vers_read,
+#if PT_HAVE_BUF
+	.read_buf	= vers_read_buf,
+#endif
 	.write		= vers_write,
-	.statfs		= vers_statfs,
+	.statfs		= pt_statfs,
+	.flush		= vers_flush,
 	.release	= vers_release,
 	.fsync		= vers_fsync,
-#ifdef HAVE_POSIX_FALLOCATE
+	.fsyncdir	= vers_fsyncdir,
+#if defined(HAVE_FALLOCATE) || defined(HAVE_POSIX_FALLOCATE)
 	.fallocate	= vers_fallocate,
 #endif
-#ifdef HAVE_SETXATTR
 	.setxattr	= vers_setxattr,
-	.getxattr	= vers_getxattr,
-	.listxattr	= vers_listxattr,
-	.removexattr	= vers_removexattr,
+#ifdef HAVE_SETXATTR
+	.getxattr	= pt_getxattr,
+	.listxattr	= pt_listxattr,
+	.removexattr	= pt_removexattr,
 #endif
 };
 
@@ -901,7 +1684,12 @@ int main(int argc, char *argv[])
 {
 	umask(0);
 	if (argc < 3) {
-	  fprintf(stderr, "USAGE: %s <storage directory> <mount point> [ -d | -f | -s ]\n", argv[0]);
+	  fprintf(stderr,
+		  "USAGE: %s <storage directory> <mount point> [ -d | -f | -s ] [ -o max_write=N,max_read=N,max_readahead=N ]\n"
+		  "       [ -o transform=caesar:<shift>[,...] ] [ -o history_maps=N,history_cache_mb=N ]\n"
+		  "       [ -o oplog_compact=N ] [ -o write_buffer=KiB,flush_ms=N,durability=fsync|flush|write ]\n"
+		  "       [ -o scrub_mb=N,scrub_interval=S ] [ -o version_window_ms=N ]\n",
+		  argv[0]);
 	  return 1;
 	}
 	storage_dir = argv[1];
@@ -911,11 +1699,65 @@ int main(int argc, char *argv[])
 	  return 1;
 	}
 	fprintf(stderr, "DEBUG: Mounting %s at %s\n", storage_dir, argv[2]);
+	// Create the history tree up front, so that /.versfs is always listed.
+	char history_root[PATH_MAX];
+	snprintf(history_root, PATH_MAX, "%s" VERS_HISTORY_DIR, storage_dir);
+	if (make_dirs(history_root) < 0) {
+	  fprintf(stderr, "ERROR: Cannot create %s\n", history_root);
+	  return 1;
+	}
+	int layout = vstore_check_layout(storage_dir);
+	if (layout == -EPROTO) {
+	  fprintf(stderr, "ERROR: %s holds histories in an older layout; "
+		  "convert it with verstool migrate first\n", storage_dir);
+	  return 1;
+	} else if (layout < 0) {
+	  fprintf(stderr, "ERROR: Cannot check the layout of %s: %s\n",
+		  storage_dir, strerror(-layout));
+	  return 1;
+	}
 	int short_argc = argc - 1;
 	char* short_argv[short_argc];
 	short_argv[0] = argv[0];
 	for (int i = 2; i < argc; i += 1) {
 	  short_argv[i - 1] = argv[i];
 	}
-	return fuse_main(short_argc, short_argv, &vers_oper, NULL);
+	struct fuse_args args = FUSE_ARGS_INIT(short_argc, short_argv);
+	int res;
+	struct vers_options options = { NULL, 64, 1024, 65536, 64, 1000, NULL,
+					8, 86400, 0 };
+	if (fuse_opt_parse(&args, &options, vers_opts, NULL) == -1)
+	  return 1;
+	res = oplog_open(storage_dir, options.oplog_compact);
+	if (res < 0) {
+	  fprintf(stderr, "ERROR: Cannot open the namespace log of %s: %s\n",
+		  storage_dir, strerror(-res));
+	  return 1;
+	}
+	if (options.durability == NULL || strcmp(options.durability, "fsync") == 0)
+	  durability = DURABLE_FSYNC;
+	else if (strcmp(options.durability, "flush") == 0)
+	  durability = DURABLE_FLUSH;
+	else if (strcmp(options.durability, "write") == 0)
+	  durability = DURABLE_WRITE;
+	else {
+	  fprintf(stderr, "ERROR: durability must be fsync, flush or write\n");
+	  return 1;
+	}
+	wbuf_configure(durability == DURABLE_WRITE ? 0 :
+		       (size_t) options.write_buffer_kb << 10,
+		       options.flush_ms, flush_write);
+	mapcache_configure(options.history_maps,
+			   (size_t) options.history_cache_mb << 20);
+	scrub_mb = options.scrub_mb;
+	scrub_interval = options.scrub_interval;
+	vwin_configure(options.version_window_ms, vers_commit);
+	transform_pipeline_init(&pipeline);
+	if (options.transform != NULL &&
+	    transform_pipeline_parse(&pipeline, options.transform) == -1)
+	  return 1;
+	fuse_opt_insert_arg(&args, 1, DEFAULT_MOUNT_OPTS);
+	res = fuse_main(args.argc, args.argv, &vers_oper, NULL);
+	fuse_opt_free_args(&args);
+	return res;
 }
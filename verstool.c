@@ -0,0 +1,1021 @@
+/**
+ * \file verstool.c
+ * \date October 2026
+ *
+ * Offline tools for versfs storage directories.  They read the history tree
+ * directly (see vstore.h), so the file system need not be mounted.
+ *
+ * export copies the history of every file at or below <path> (a path in the
+ * mount point, e.g. / or /some_files) to <destination>/<path>/<N>, one file
+ * per version.  Versions are copied by a pool of worker threads with
+ * copy_file_range(), holes preserved.  A manifest in the destination records,
+ * per file, the newest version exported; with -i only versions newer than
+ * that are copied, so repeated exports are incremental.  A history that was
+ * deleted and started again since the last export is exported in full.
+ *
+ * diff reports the byte ranges that differ between two versions of a file
+ * (or a version and the live file), one "<offset> <length>" line each,
+ * without copying either: both are mapped and compared block by block, and
+ * runs that are holes in both are skipped.  It exits with 0 if the two are
+ * the same, 1 if they differ and 2 on error, as diff(1) does.  Versions are
+ * compared as stored, so with a transform the ranges are those of the
+ * encoded data (the same ranges, for the byte-wise caesar stage).
+ *
+ * restore does what setting the user.versfs.restore attribute does in a
+ * mounted versfs (see vstore_restore()), for a storage directory that is not
+ * mounted.  What it changes is added to the namespace log.
+ *
+ * tree lists the directories, files and links at or below <path> as they
+ * were at a time (by default, now), rebuilt from the namespace log (see
+ * oplog.h): one "<mode> <uid> <gid> <path>" line each, in octal, with
+ * " -> <target>" after symbolic links.
+ *
+ * migrate converts a storage directory that is not mounted to the current
+ * layout in place: <file>__versions__ directories in the tree move into the
+ * history tree, and versions move into their buckets, by rename().  An
+ * interrupted migration can be run again; the storage directory is marked
+ * converted, and mounts, only once every history is.
+ *
+ * USAGE: verstool export [ -j workers ] [ -r first:last ] [ -i ]
+ *                        <storage directory> <path> <destination>
+ *        verstool diff <storage directory> <path> <version> <version | live>
+ *        verstool restore <storage directory> <path> <version | @time>
+ *        verstool tree <storage directory> <path> [ @time ]
+ *        verstool migrate <storage directory>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "oplog.h"
+#include "vstore.h"
+
+#define MANIFEST_NAME ".verstool-manifest"
+
+/* Versions are looked for in their buckets, where a storage directory that
+   is not converted yet has none. */
+static int check_layout (const char* prog, const char* storage_dir) {
+  int res = vstore_check_layout(storage_dir);
+
+  if (res == -EPROTO)
+    fprintf(stderr, "ERROR: %s holds histories in an older layout; convert "
+	    "it with %s migrate first\n", storage_dir, prog);
+  else if (res < 0)
+    fprintf(stderr, "ERROR: Cannot check the layout of %s: %s\n",
+	    storage_dir, strerror(-res));
+  return res;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Manifest */
+
+/* One line per file: <newest exported version> <history inode> <path>. */
+struct manifest_entry {
+  char* path;
+  int watermark;
+  unsigned long long ino;
+};
+
+struct manifest {
+  struct manifest_entry* entries;
+  size_t count;
+  size_t capacity;
+};
+
+static int compare_entries (const void* a, const void* b) {
+  return strcmp(((const struct manifest_entry*) a)->path,
+		((const struct manifest_entry*) b)->path);
+}
+
+static int manifest_add (struct manifest* m, const char* path, int watermark,
+			 unsigned long long ino) {
+  if (m->count == m->capacity) {
+    size_t capacity = m->capacity == 0 ? 64 : m->capacity * 2;
+    struct manifest_entry* entries =
+      realloc(m->entries, capacity * sizeof(*entries));
+    if (entries == NULL)
+      return -ENOMEM;
+    m->entries = entries;
+    m->capacity = capacity;
+  }
+  m->entries[m->count].path = strdup(path);
+  if (m->entries[m->count].path == NULL)
+    return -ENOMEM;
+  m->entries[m->count].watermark = watermark;
+  m->entries[m->count].ino = ino;
+  m->count += 1;
+  return 0;
+}
+
+static int manifest_load (struct manifest* m, const char* file) {
+  char line[PATH_MAX + 64];
+  FILE* in = fopen(file, "r");
+
+  if (in == NULL)
+    return errno == ENOENT ? 0 : -errno;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    int watermark, skip;
+    unsigned long long ino;
+    size_t len = strlen(line);
+
+    if (len > 0 && line[len - 1] == '\n')
+      line[len - 1] = '\0';
+    if (sscanf(line, "%d %llu %n", &watermark, &ino, &skip) < 2)
+      continue;
+    if (manifest_add(m, line + skip, watermark, ino) < 0) {
+      fclose(in);
+      return -ENOMEM;
+    }
+  }
+  fclose(in);
+  qsort(m->entries, m->count, sizeof(*m->entries), compare_entries);
+  return 0;
+}
+
+static struct manifest_entry* manifest_find (const struct manifest* m,
+					     const char* path) {
+  struct manifest_entry key = { (char*) path, 0, 0 };
+  return m->count == 0 ? NULL :
+    bsearch(&key, m->entries, m->count, sizeof(*m->entries), compare_entries);
+}
+
+/* Write the manifest next to its final name and rename it into place, so an
+   interrupted export leaves the previous manifest intact. */
+static int manifest_save (const struct manifest* m, const char* file) {
+  char tmp[PATH_MAX + 8];
+  FILE* out;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+  out = fopen(tmp, "w");
+  if (out == NULL)
+    return -errno;
+  for (size_t i = 0; i < m->count; i += 1) {
+    fprintf(out, "%d %llu %s\n", m->entries[i].watermark, m->entries[i].ino,
+	    m->entries[i].path);
+  }
+  if (fflush(out) != 0 || fsync(fileno(out)) == -1) {
+    int res = -errno;
+    fclose(out);
+    return res;
+  }
+  fclose(out);
+  return rename(tmp, file) == -1 ? -errno : 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Planning */
+
+/* A file whose history is being exported. */
+struct export_file {
+  char* path;
+  unsigned long long ino;
+  int last;			/* Newest version being exported */
+  int failed;
+};
+
+/* One version to copy. */
+struct export_job {
+  char src[PATH_MAX];		/* history directory */
+  int vers_num;
+  char dst[PATH_MAX + 16];
+  size_t file;
+};
+
+struct export_plan {
+  const char* storage_dir;
+  const char* dest_dir;
+  int first, last;		/* -r, last < 0 for the newest */
+  int incremental;
+  struct manifest old;
+
+  struct export_file* files;
+  size_t nfiles, files_capacity;
+  struct export_job* jobs;
+  size_t njobs, jobs_capacity;
+};
+
+/* Create dir and any missing parents. */
+static int make_path (const char* dir) {
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s", dir);
+  for (char* slash = strchr(path + 1, '/'); slash != NULL;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+      return -errno;
+    *slash = '/';
+  }
+  if (mkdir(path, 0755) == -1 && errno != EEXIST)
+    return -errno;
+  return 0;
+}
+
+static int plan_file (struct export_plan* plan, const char* history_dir,
+		      const char* path, const struct stat* st) {
+  char dst_dir[PATH_MAX];
+  int newest, first, last, res;
+  struct manifest_entry* seen;
+
+  res = vstore_read_counter(history_dir, &newest);
+  if (res < 0)
+    return res;
+
+  first = plan->first;
+  last = plan->last < 0 || plan->last > newest ? newest : plan->last;
+  seen = manifest_find(&plan->old, path);
+  if (plan->incremental && seen != NULL && seen->ino == st->st_ino &&
+      seen->watermark >= first)
+    first = seen->watermark + 1;
+
+  if (plan->nfiles == plan->files_capacity) {
+    size_t capacity = plan->files_capacity == 0 ? 64 : plan->files_capacity * 2;
+    struct export_file* files = realloc(plan->files, capacity * sizeof(*files));
+    if (files == NULL)
+      return -ENOMEM;
+    plan->files = files;
+    plan->files_capacity = capacity;
+  }
+  plan->files[plan->nfiles].path = strdup(path);
+  if (plan->files[plan->nfiles].path == NULL)
+    return -ENOMEM;
+  plan->files[plan->nfiles].ino = st->st_ino;
+  plan->files[plan->nfiles].failed = 0;
+  // Nothing new keeps the old watermark.
+  plan->files[plan->nfiles].last =
+    first > last ? (seen != NULL && seen->ino == st->st_ino ? seen->watermark : -1)
+		 : last;
+  plan->nfiles += 1;
+  if (first > last)
+    return 0;
+
+  snprintf(dst_dir, sizeof(dst_dir), "%s%s", plan->dest_dir, path);
+  res = make_path(dst_dir);
+  if (res < 0)
+    return res;
+
+  for (int n = first; n <= last; n += 1) {
+    if (plan->njobs == plan->jobs_capacity) {
+      size_t capacity = plan->jobs_capacity == 0 ? 256 : plan->jobs_capacity * 2;
+      struct export_job* jobs = realloc(plan->jobs, capacity * sizeof(*jobs));
+      if (jobs == NULL)
+	return -ENOMEM;
+      plan->jobs = jobs;
+      plan->jobs_capacity = capacity;
+    }
+    struct export_job* job = &plan->jobs[plan->njobs];
+    snprintf(job->src, sizeof(job->src), "%s", history_dir);
+    job->vers_num = n;
+    snprintf(job->dst, sizeof(job->dst), "%s/%d", dst_dir, n);
+    job->file = plan->nfiles - 1;
+    plan->njobs += 1;
+  }
+  return 0;
+}
+
+/* Walk the history tree below history_dir, the history of path.  A directory
+   holding a counter is the history of a file; any other is the history of
+   a directory, with one subdirectory per file or directory in it. */
+static int plan_tree (struct export_plan* plan, const char* history_dir,
+		      const char* path) {
+  char counter[PATH_MAX];
+  char child_dir[PATH_MAX];
+  char child_path[PATH_MAX];
+  struct stat st;
+  struct dirent* de;
+  DIR* dp;
+  int res = 0;
+
+  if (stat(history_dir, &st) == -1)
+    return -errno;
+  vstore_counter_path(counter, history_dir);
+  if (access(counter, F_OK) == 0)
+    return plan_file(plan, history_dir, path, &st);
+
+  dp = opendir(history_dir);
+  if (dp == NULL)
+    return -errno;
+  while ((de = readdir(dp)) != NULL && res == 0) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+      continue;
+    snprintf(child_dir, sizeof(child_dir), "%s/%s", history_dir, de->d_name);
+    snprintf(child_path, sizeof(child_path), "%s/%s", path, de->d_name);
+    if (de->d_type == DT_UNKNOWN &&
+	(lstat(child_dir, &st) == -1 || !S_ISDIR(st.st_mode)))
+      continue;
+    res = plan_tree(plan, child_dir, child_path);
+  }
+  closedir(dp);
+  return res;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Copying */
+
+struct export_pool {
+  struct export_plan* plan;
+  size_t next;			/* Next job to take, atomically */
+  unsigned long long bytes;	/* Bytes copied, atomically */
+};
+
+/* Copy version vers_num of the history in history_dir, in full whichever
+   way it is stored (see vstore.h). */
+static int copy_version (const char* history_dir, int vers_num,
+			 const char* dst, unsigned long long* bytes) {
+  struct stat st;
+  int in_fd, out_fd, res;
+
+  in_fd = vstore_open_version(history_dir, vers_num, &st);
+  if (in_fd < 0)
+    return in_fd;
+  out_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out_fd == -1) {
+    res = -errno;
+    close(in_fd);
+    return res;
+  }
+
+  res = vstore_copy_sparse(in_fd, out_fd, st.st_size);
+  // Keep the time the version was made.
+  if (res == 0) {
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    futimens(out_fd, times);
+  }
+  if (close(out_fd) == -1 && res == 0)
+    res = -errno;
+  close(in_fd);
+  if (res == 0)
+    *bytes = st.st_size;
+  return res;
+}
+
+static void* export_worker (void* arg) {
+  struct export_pool* pool = arg;
+  struct export_plan* plan = pool->plan;
+
+  for (;;) {
+    size_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    unsigned long long bytes = 0;
+    int res;
+
+    if (i >= plan->njobs)
+      return NULL;
+    res = copy_version(plan->jobs[i].src, plan->jobs[i].vers_num,
+		       plan->jobs[i].dst, &bytes);
+    // A version missing from the middle of a history is not an error.
+    if (res < 0 && res != -ENOENT) {
+      fprintf(stderr, "ERROR: Cannot export %s/%d: %s\n", plan->jobs[i].src,
+	      plan->jobs[i].vers_num, strerror(-res));
+      __atomic_store_n(&plan->files[plan->jobs[i].file].failed, 1,
+		       __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&pool->bytes, bytes, __ATOMIC_RELAXED);
+  }
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------ */
+/* Diff */
+
+/* Versions are compared a block at a time; ranges are exact at their ends,
+   but an unchanged run shorter than a block inside a range is not split
+   out of it. */
+#define DIFF_BLOCK 4096
+
+struct diff_ranges {
+  off_t start, end;		/* The range being built, if any */
+  int open;
+  unsigned long long count, bytes;
+};
+
+static void diff_flush (struct diff_ranges* d) {
+  if (!d->open)
+    return;
+  printf("%lld %lld\n", (long long) d->start, (long long) (d->end - d->start));
+  d->count += 1;
+  d->bytes += d->end - d->start;
+  d->open = 0;
+}
+
+static void diff_add (struct diff_ranges* d, off_t off, off_t len) {
+  if (d->open && off <= d->end) {
+    if (off + len > d->end)
+      d->end = off + len;
+    return;
+  }
+  diff_flush(d);
+  d->start = off;
+  d->end = off + len;
+  d->open = 1;
+}
+
+/* Offset of the first byte that differs between a and b, a word at a time. */
+static size_t first_difference (const unsigned char* a, const unsigned char* b,
+				size_t len) {
+  size_t i = 0;
+  uint64_t x, y;
+
+  for (; i + 8 <= len; i += 8) {
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    if (x != y)
+      break;
+  }
+  while (i < len && a[i] == b[i])
+    i += 1;
+  return i;
+}
+
+/* One past the offset of the last byte that differs. */
+static size_t last_difference (const unsigned char* a, const unsigned char* b,
+			       size_t len) {
+  size_t i = len;
+  uint64_t x, y;
+
+  for (; i >= 8; i -= 8) {
+    memcpy(&x, a + i - 8, 8);
+    memcpy(&y, b + i - 8, 8);
+    if (x != y)
+      break;
+  }
+  while (i > 0 && a[i - 1] == b[i - 1])
+    i -= 1;
+  return i;
+}
+
+/* The offset at which fd next switches between data and hole after off, so
+   that runs which are holes in both files are skipped unread. */
+static off_t extent_end (int fd, off_t off, off_t size) {
+  off_t data = lseek(fd, off, SEEK_DATA);
+  off_t end;
+
+  if (data == -1)
+    return size;		/* A hole to the end, or no SEEK_DATA. */
+  end = data > off ? data : lseek(fd, off, SEEK_HOLE);
+  return end == -1 || end > size ? size : end;
+}
+
+static int is_hole (int fd, off_t off) {
+  off_t data = lseek(fd, off, SEEK_DATA);
+  return data == -1 ? errno == ENXIO : data > off;
+}
+
+static void diff_span (struct diff_ranges* d, const unsigned char* a,
+		       const unsigned char* b, off_t start, off_t end) {
+  for (off_t off = start; off < end; off += DIFF_BLOCK) {
+    size_t len = end - off < DIFF_BLOCK ? end - off : DIFF_BLOCK;
+    size_t first, last;
+
+    // memcmp() is vectorised; only a block that differs is looked at
+    // byte by byte.
+    if (memcmp(a + off, b + off, len) == 0)
+      continue;
+    first = first_difference(a + off, b + off, len);
+    last = last_difference(a + off, b + off, len);
+    diff_add(d, off + first, last - first);
+  }
+}
+
+static int open_version (const char* storage_dir, const char* path,
+			 const char* which, struct stat* st) {
+  char history_dir[PATH_MAX];
+  char file[PATH_MAX];
+  char* end;
+  long n;
+  int fd;
+
+  if (strcmp(which, "live") == 0) {
+    snprintf(file, sizeof(file), "%s%s", storage_dir, path);
+    fd = open(file, O_RDONLY);
+    if (fd != -1 && fstat(fd, st) == -1) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  n = strtol(which, &end, 10);
+  if (*which == '\0' || *end != '\0' || n < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  // A version made by truncate comes back as a temporary file with its
+  // contents in full, holes included.
+  vstore_history_dir(history_dir, storage_dir, path);
+  fd = vstore_open_version(history_dir, n, st);
+  if (fd < 0) {
+    errno = -fd;
+    return -1;
+  }
+  return fd;
+}
+
+static const unsigned char* map_version (int fd, off_t size) {
+  void* addr;
+
+  if (size == 0)
+    return (const unsigned char*) "";
+  addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED)
+    return NULL;
+  madvise(addr, size, MADV_SEQUENTIAL);
+  return addr;
+}
+
+static int diff_usage (const char* prog) {
+  fprintf(stderr,
+	  "USAGE: %s diff <storage directory> <path> <version> <version | live>\n",
+	  prog);
+  return 2;
+}
+
+static int cmd_diff (const char* prog, int argc, char* argv[]) {
+  const char* storage_dir;
+  char path[PATH_MAX];
+  const unsigned char* map[2];
+  struct stat st[2];
+  struct diff_ranges d = { 0, 0, 0, 0, 0 };
+  int fd[2];
+  off_t common;
+
+  if (argc != 5)
+    return diff_usage(prog);
+  storage_dir = argv[1];
+  if (check_layout(prog, storage_dir) < 0)
+    return 2;
+  snprintf(path, sizeof(path), "%s%s", argv[2][0] == '/' ? "" : "/", argv[2]);
+
+  for (int i = 0; i < 2; i += 1) {
+    fd[i] = open_version(storage_dir, path, argv[3 + i], &st[i]);
+    if (fd[i] == -1) {
+      fprintf(stderr, "ERROR: Cannot open version %s of %s: %s\n",
+	      argv[3 + i], path, strerror(errno));
+      return 2;
+    }
+    map[i] = map_version(fd[i], st[i].st_size);
+    if (map[i] == NULL) {
+      fprintf(stderr, "ERROR: Cannot map version %s of %s: %s\n",
+	      argv[3 + i], path, strerror(errno));
+      return 2;
+    }
+  }
+
+  printf("# %s: version %s, %lld bytes; version %s, %lld bytes\n", path,
+	 argv[3], (long long) st[0].st_size, argv[4], (long long) st[1].st_size);
+
+  // Walk the common part extent by extent: a run that is a hole in both
+  // versions is equal without reading it.
+  common = st[0].st_size < st[1].st_size ? st[0].st_size : st[1].st_size;
+  for (off_t off = 0; off < common; ) {
+    off_t end0 = extent_end(fd[0], off, common);
+    off_t end1 = extent_end(fd[1], off, common);
+    off_t end = end0 < end1 ? end0 : end1;
+
+    if (end <= off)
+      end = common;
+    if (!(is_hole(fd[0], off) && is_hole(fd[1], off)))
+      diff_span(&d, map[0], map[1], off, end);
+    off = end;
+  }
+  // Whatever one version has beyond the end of the other is a change.
+  if (st[0].st_size != st[1].st_size)
+    diff_add(&d, common, (st[0].st_size > st[1].st_size ? st[0].st_size
+			  : st[1].st_size) - common);
+  diff_flush(&d);
+
+  printf("# %llu ranges, %llu bytes changed\n", d.count, d.bytes);
+  return d.count > 0 ? 1 : 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Migration */
+
+struct migration {
+  const char* storage_dir;
+  unsigned long long versions;	/* Moved into buckets */
+  unsigned long long histories;	/* Moved out of the tree */
+  int failed;
+};
+
+/* The version number in the name of a file in a history directory: <N>,
+   or <file>,<N> from before the history tree.  *sum is set for .<N>.sum.
+   Returns -1 for any other file. */
+static long version_number (const char* name, int* sum) {
+  const char* digits = strrchr(name, ',');
+  char* end;
+  long n;
+
+  *sum = digits == NULL && name[0] == '.';
+  digits = digits != NULL ? digits + 1 : *sum ? name + 1 : name;
+  if (*digits < '0' || *digits > '9')
+    return -1;
+  n = strtol(digits, &end, 10);
+  if (n > INT_MAX || strcmp(end, *sum ? ".sum" : "") != 0)
+    return -1;
+  return n;
+}
+
+/* Move the versions of the history in history_dir that are not in their
+   buckets yet, each with its checksums, into them. */
+static void migrate_history (struct migration* m, const char* history_dir) {
+  char from[PATH_MAX];
+  char to[PATH_MAX];
+  char version[PATH_MAX];
+  struct dirent* de;
+  DIR* dp;
+  int sum;
+
+  dp = opendir(history_dir);
+  if (dp == NULL) {
+    fprintf(stderr, "ERROR: Cannot read %s: %s\n", history_dir,
+	    strerror(errno));
+    m->failed = 1;
+    return;
+  }
+  while ((de = readdir(dp)) != NULL) {
+    long n = version_number(de->d_name, &sum);
+    struct stat st;
+    int res;
+
+    // Buckets are directories, and are skipped here.
+    if (n < 0 || (de->d_type != DT_REG && de->d_type != DT_UNKNOWN))
+      continue;
+    snprintf(from, sizeof(from), "%s/%s", history_dir, de->d_name);
+    if (de->d_type == DT_UNKNOWN &&
+	(lstat(from, &st) == -1 || !S_ISREG(st.st_mode)))
+      continue;
+    vstore_version_path(version, history_dir, (int) n);
+    if (sum)
+      vstore_sum_path(to, version);
+    else
+      snprintf(to, sizeof(to), "%s", version);
+    res = vstore_make_bucket(version);
+    if (res == 0 && rename(from, to) == -1)
+      res = -errno;
+    if (res < 0) {
+      fprintf(stderr, "ERROR: Cannot move %s to %s: %s\n", from, to,
+	      strerror(-res));
+      m->failed = 1;
+    } else if (!sum) {
+      m->versions += 1;
+    }
+  }
+  closedir(dp);
+}
+
+/* Walk the history tree below history_dir, converting the history of each
+   file in it (a directory holding a counter, as in plan_tree()). */
+static void migrate_tree (struct migration* m, const char* history_dir) {
+  char counter[PATH_MAX];
+  char child_dir[PATH_MAX];
+  struct stat st;
+  struct dirent* de;
+  DIR* dp;
+
+  vstore_counter_path(counter, history_dir);
+  if (access(counter, F_OK) == 0) {
+    migrate_history(m, history_dir);
+    return;
+  }
+
+  dp = opendir(history_dir);
+  if (dp == NULL)
+    return;
+  while ((de = readdir(dp)) != NULL) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+      continue;
+    snprintf(child_dir, sizeof(child_dir), "%s/%s", history_dir, de->d_name);
+    if (de->d_type == DT_UNKNOWN &&
+	(lstat(child_dir, &st) == -1 || !S_ISDIR(st.st_mode)))
+      continue;
+    migrate_tree(m, child_dir);
+  }
+  closedir(dp);
+}
+
+/* Move the <file>__versions__ directories below dir, the storage directory
+   of path, to the history tree, where migrate_tree() finds them. */
+static void migrate_legacy (struct migration* m, const char* dir,
+			    const char* path) {
+  char entry[PATH_MAX];
+  char entry_path[PATH_MAX];
+  char history_dir[PATH_MAX];
+  size_t len, suffix = strlen(VSTORE_LEGACY_SUFFIX);
+  struct stat st;
+  int res;
+  struct dirent* de;
+  DIR* dp;
+
+  dp = opendir(dir);
+  if (dp == NULL)
+    return;
+  while ((de = readdir(dp)) != NULL) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+	(path[0] == '\0' && strcmp(de->d_name, VSTORE_DIR + 1) == 0))
+      continue;
+    if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+      continue;
+    snprintf(entry, sizeof(entry), "%s/%s", dir, de->d_name);
+    if (de->d_type == DT_UNKNOWN &&
+	(lstat(entry, &st) == -1 || !S_ISDIR(st.st_mode)))
+      continue;
+
+    len = strlen(de->d_name);
+    if (len <= suffix ||
+	strcmp(de->d_name + len - suffix, VSTORE_LEGACY_SUFFIX) != 0) {
+      snprintf(entry_path, sizeof(entry_path), "%s/%s", path, de->d_name);
+      migrate_legacy(m, entry, entry_path);
+      continue;
+    }
+
+    snprintf(entry_path, sizeof(entry_path), "%s/%.*s", path,
+	     (int) (len - suffix), de->d_name);
+    vstore_history_dir(history_dir, m->storage_dir, entry_path);
+    if (lstat(history_dir, &st) == 0) {
+      // Mounted since without being migrated: the file has a newer
+      // history, which is kept.
+      fprintf(stderr, "ERROR: Cannot migrate %s: %s already has a history\n",
+	      entry, entry_path);
+      m->failed = 1;
+      continue;
+    }
+    // Its parents in the history tree, then the directory itself.
+    *strrchr(history_dir, '/') = '\0';
+    res = make_path(history_dir);
+    if (res < 0) {
+      fprintf(stderr, "ERROR: Cannot create %s: %s\n", history_dir,
+	      strerror(-res));
+      m->failed = 1;
+      continue;
+    }
+    vstore_history_dir(history_dir, m->storage_dir, entry_path);
+    if (rename(entry, history_dir) == -1) {
+      fprintf(stderr, "ERROR: Cannot move %s to %s: %s\n", entry,
+	      history_dir, strerror(errno));
+      m->failed = 1;
+      continue;
+    }
+    m->histories += 1;
+  }
+  closedir(dp);
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int usage (const char* prog) {
+  fprintf(stderr,
+	  "USAGE: %s export [ -j workers ] [ -r first:last ] [ -i ]\n"
+	  "       <storage directory> <path> <destination>\n"
+	  "       %s diff <storage directory> <path> <version> <version | live>\n"
+	  "       %s restore <storage directory> <path> <version | @time>\n"
+	  "       %s tree <storage directory> <path> [ @time ]\n"
+	  "       %s migrate <storage directory>\n",
+	  prog, prog, prog, prog, prog);
+  return 1;
+}
+
+static int cmd_export (const char* prog, int argc, char* argv[]) {
+  struct export_plan plan;
+  struct manifest updated = { NULL, 0, 0 };
+  char history_dir[PATH_MAX];
+  char manifest_file[PATH_MAX];
+  char path[PATH_MAX];
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt, res, failed = 0;
+
+  memset(&plan, 0, sizeof(plan));
+  plan.last = -1;
+  while ((opt = getopt(argc, argv, "j:r:i")) != -1) {
+    switch (opt) {
+    case 'j':
+      workers = atol(optarg);
+      break;
+    case 'r': {
+      // first:last, either side optional.
+      char* colon = strchr(optarg, ':');
+      plan.first = atoi(optarg);
+      plan.last = colon == NULL ? plan.first :
+	(colon[1] == '\0' ? -1 : atoi(colon + 1));
+      break;
+    }
+    case 'i':
+      plan.incremental = 1;
+      break;
+    default:
+      return usage(prog);
+    }
+  }
+  if (argc - optind != 3 || workers < 1 || plan.first < 0)
+    return usage(prog);
+  plan.storage_dir = argv[optind];
+  plan.dest_dir = argv[optind + 2];
+  if (check_layout(prog, plan.storage_dir) < 0)
+    return 1;
+
+  // The subtree as a path in the mount point: "" for the root, else "/...".
+  snprintf(path, sizeof(path), "%s%s", argv[optind + 1][0] == '/' ? "" : "/",
+	   argv[optind + 1]);
+  while (strlen(path) > 0 && path[strlen(path) - 1] == '/')
+    path[strlen(path) - 1] = '\0';
+
+  res = make_path(plan.dest_dir);
+  if (res < 0) {
+    fprintf(stderr, "ERROR: Cannot create %s: %s\n", plan.dest_dir,
+	    strerror(-res));
+    return 1;
+  }
+  snprintf(manifest_file, sizeof(manifest_file), "%s/" MANIFEST_NAME,
+	   plan.dest_dir);
+  res = manifest_load(&plan.old, manifest_file);
+  if (res < 0) {
+    fprintf(stderr, "ERROR: Cannot read %s: %s\n", manifest_file,
+	    strerror(-res));
+    return 1;
+  }
+
+  vstore_history_dir(history_dir, plan.storage_dir, path);
+  res = plan_tree(&plan, history_dir, path);
+  if (res < 0) {
+    fprintf(stderr, "ERROR: Cannot read the history of %s: %s\n",
+	    path[0] == '\0' ? "/" : path, strerror(-res));
+    return 1;
+  }
+
+  // Copy.
+  struct export_pool pool = { &plan, 0, 0 };
+  if (workers > (long) plan.njobs)
+    workers = plan.njobs > 0 ? plan.njobs : 1;
+  pthread_t threads[workers];
+  long started = 0;
+  for (; started < workers; started += 1) {
+    if (pthread_create(&threads[started], NULL, export_worker, &pool) != 0)
+      break;
+  }
+  if (started == 0)
+    export_worker(&pool);
+  for (long i = 0; i < started; i += 1) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // The new manifest: every file exported now, plus those outside this
+  // export that the old manifest knew about.
+  for (size_t i = 0; i < plan.nfiles; i += 1) {
+    struct export_file* f = &plan.files[i];
+    struct manifest_entry* seen = manifest_find(&plan.old, f->path);
+    if (f->failed) {
+      failed = 1;
+      if (seen != NULL)
+	manifest_add(&updated, seen->path, seen->watermark, seen->ino);
+    } else if (f->last >= 0) {
+      manifest_add(&updated, f->path, f->last, f->ino);
+    }
+    if (seen != NULL)
+      seen->watermark = INT_MIN;	/* Superseded */
+  }
+  for (size_t i = 0; i < plan.old.count; i += 1) {
+    if (plan.old.entries[i].watermark != INT_MIN)
+      manifest_add(&updated, plan.old.entries[i].path,
+		   plan.old.entries[i].watermark, plan.old.entries[i].ino);
+  }
+  qsort(updated.entries, updated.count, sizeof(*updated.entries),
+	compare_entries);
+  res = manifest_save(&updated, manifest_file);
+  if (res < 0) {
+    fprintf(stderr, "ERROR: Cannot write %s: %s\n", manifest_file,
+	    strerror(-res));
+    failed = 1;
+  }
+
+  printf("exported %zu versions of %zu files, %llu bytes, with %ld workers\n",
+	 plan.njobs, plan.nfiles, pool.bytes, started > 0 ? started : 1);
+  return failed;
+}
+
+static int cmd_restore (const char* prog, int argc, char* argv[]) {
+  char path[PATH_MAX];
+  int res;
+
+  if (argc != 4)
+    return usage(prog);
+  if (check_layout(prog, argv[1]) < 0)
+    return 1;
+  snprintf(path, sizeof(path), "%s%s", argv[2][0] == '/' ? "" : "/", argv[2]);
+  res = oplog_open(argv[1], 0);
+  if (res < 0)
+    fprintf(stderr, "WARNING: Cannot open the namespace log of %s: %s\n",
+	    argv[1], strerror(-res));
+  res = vstore_restore(argv[1], path, argv[3], NULL, NULL);
+  oplog_close();
+  if (res < 0) {
+    fprintf(stderr, "ERROR: Cannot restore %s to %s: %s\n", path, argv[3],
+	    strerror(-res));
+    return 1;
+  }
+  return 0;
+}
+
+static int print_entry (const struct oplog_entry* e, void* arg) {
+  (void) arg;
+  printf("%06o %u %u %s", (unsigned) e->mode, (unsigned) e->uid,
+	 (unsigned) e->gid, e->path);
+  if (e->target != NULL)
+    printf(" -> %s", e->target);
+  printf("\n");
+  return 0;
+}
+
+static int cmd_tree (const char* prog, int argc, char* argv[]) {
+  char path[PATH_MAX];
+  struct oplog_tree* tree;
+  time_t when = time(NULL);
+  char* end;
+  int res;
+
+  if (argc != 3 && argc != 4)
+    return usage(prog);
+  if (argc == 4) {
+    when = strtoll(argv[3] + 1, &end, 10);
+    if (argv[3][0] != '@' || argv[3][1] == '\0' || *end != '\0')
+      return usage(prog);
+  }
+  snprintf(path, sizeof(path), "%s%s", argv[2][0] == '/' ? "" : "/", argv[2]);
+
+  tree = oplog_replay(argv[1], when);
+  if (tree == NULL) {
+    fprintf(stderr, "ERROR: Cannot read the namespace log of %s: %s\n",
+	    argv[1], strerror(errno));
+    return 1;
+  }
+  res = oplog_walk(tree, path, 0, print_entry, NULL);
+  oplog_tree_free(tree);
+  if (res < 0) {
+    fprintf(stderr, "ERROR: %s did not exist then\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+static int cmd_migrate (const char* prog, int argc, char* argv[]) {
+  struct migration m = { NULL, 0, 0, 0 };
+  char history_root[PATH_MAX];
+  int res;
+
+  if (argc != 2)
+    return usage(prog);
+  m.storage_dir = argv[1];
+  vstore_history_dir(history_root, m.storage_dir, "");
+  res = make_path(history_root);
+  if (res < 0) {
+    fprintf(stderr, "ERROR: Cannot create %s: %s\n", history_root,
+	    strerror(-res));
+    return 1;
+  }
+
+  migrate_legacy(&m, m.storage_dir, "");
+  migrate_tree(&m, history_root);
+  // Left unmarked, the storage directory is not mounted half converted.
+  if (!m.failed) {
+    res = vstore_mark_layout(m.storage_dir);
+    if (res < 0) {
+      fprintf(stderr, "ERROR: Cannot mark %s converted: %s\n",
+	      m.storage_dir, strerror(-res));
+      m.failed = 1;
+    }
+  }
+  printf("moved %llu histories out of the tree and %llu versions into "
+	 "buckets\n", m.histories, m.versions);
+  return m.failed;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc < 2)
+    return usage(argv[0]);
+  if (strcmp(argv[1], "export") == 0)
+    return cmd_export(argv[0], argc - 1, argv + 1);
+  if (strcmp(argv[1], "diff") == 0)
+    return cmd_diff(argv[0], argc - 1, argv + 1);
+  if (strcmp(argv[1], "restore") == 0)
+    return cmd_restore(argv[0], argc - 1, argv + 1);
+  if (strcmp(argv[1], "tree") == 0)
+    return cmd_tree(argv[0], argc - 1, argv + 1);
+  if (strcmp(argv[1], "migrate") == 0)
+    return cmd_migrate(argv[0], argc - 1, argv + 1);
+  return usage(argv[0]);
+}
@@ -0,0 +1,905 @@
+/**
+ * \file vstore.c
+ * \date October 2026
+ *
+ * Paths, counters, checksums and copying for the versfs history layout.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef linux
+#include <linux/fs.h>
+#endif
+#include "arena.h"
+#include "crc32c.h"
+#include "oplog.h"
+#include "vstore.h"
+
+void vstore_history_dir(char *out, const char *storage_dir, const char *path)
+{
+	if (snprintf(out, PATH_MAX, "%s" VSTORE_HISTORY_DIR "%s", storage_dir,
+		     path) >= PATH_MAX)
+		out[0] = '\0';	/* Too long: names no file. */
+}
+
+void vstore_version_path(char *out, const char *history_dir, int vers_num)
+{
+	// The bucket is named for its versions' common digits, 123xxx for
+	// 123000 to 123999: never a version number itself, even in a history
+	// that migrate is converting.
+	if (snprintf(out, PATH_MAX, "%s/%dxxx/%d", history_dir,
+		     vers_num / VSTORE_FANOUT, vers_num) >= PATH_MAX)
+		out[0] = '\0';	/* Too long: names no file. */
+}
+
+int vstore_create(const char *version_path, int flags, mode_t mode)
+{
+	int fd = open(version_path, flags, mode);
+
+	// The first version of a bucket makes it.
+	if (fd == -1 && errno == ENOENT && vstore_make_bucket(version_path) == 0)
+		fd = open(version_path, flags, mode);
+	return fd == -1 ? -errno : fd;
+}
+
+int vstore_make_bucket(const char *version_path)
+{
+	char dir[PATH_MAX];
+	char *slash;
+
+	snprintf(dir, sizeof(dir), "%s", version_path);
+	slash = strrchr(dir, '/');
+	if (slash == NULL)
+		return -EINVAL;
+	*slash = '\0';
+	if (mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 &&
+	    errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+/* Whether there is a <file>VSTORE_LEGACY_SUFFIX directory at or below dir,
+   the storage directory of the tree or of a directory in it (top, for the
+   tree itself, whose VSTORE_DIR is not looked in).  Returns 1, 0 or
+   -errno. */
+static int has_legacy(const char *dir, int top)
+{
+	char entry[PATH_MAX];
+	size_t len, suffix = strlen(VSTORE_LEGACY_SUFFIX);
+	struct dirent *de;
+	struct stat st;
+	DIR *dp;
+	int res = 0;
+
+	dp = opendir(dir);
+	if (dp == NULL)
+		return -errno;
+	while (res == 0 && (de = readdir(dp)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+		    (top && strcmp(de->d_name, VSTORE_DIR + 1) == 0))
+			continue;
+		if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+			continue;
+		if (snprintf(entry, sizeof(entry), "%s/%s", dir,
+			     de->d_name) >= sizeof(entry))
+			continue;	/* Too long: names no file. */
+		if (de->d_type == DT_UNKNOWN &&
+		    (lstat(entry, &st) == -1 || !S_ISDIR(st.st_mode)))
+			continue;
+		len = strlen(de->d_name);
+		if (len > suffix &&
+		    strcmp(de->d_name + len - suffix, VSTORE_LEGACY_SUFFIX) == 0)
+			res = 1;
+		else
+			res = has_legacy(entry, 0);
+	}
+	closedir(dp);
+	return res;
+}
+
+int vstore_check_layout(const char *storage_dir)
+{
+	char path[PATH_MAX];
+	char text[16];
+	struct dirent *de;
+	ssize_t len;
+	DIR *dp;
+	int fd, res, empty = 1;
+
+	snprintf(path, sizeof(path), "%s" VSTORE_LAYOUT, storage_dir);
+	fd = open(path, O_RDONLY);
+	if (fd != -1) {
+		memset(text, 0, sizeof(text));
+		len = read(fd, text, sizeof(text) - 1);
+		close(fd);
+		if (len == -1)
+			return -errno;
+		return atoi(text) == VSTORE_LAYOUT_VERSION ? 0 : -EPROTO;
+	}
+	if (errno != ENOENT)
+		return -errno;
+
+	// Unmarked: new, or from before the buckets.  Only an empty history
+	// tree can be taken for new, and only if there are no histories from
+	// before the history tree either, in <file>__versions__ directories.
+	snprintf(path, sizeof(path), "%s" VSTORE_HISTORY_DIR, storage_dir);
+	dp = opendir(path);
+	if (dp == NULL && errno != ENOENT)
+		return -errno;
+	if (dp != NULL) {
+		while (empty && (de = readdir(dp)) != NULL)
+			empty = strcmp(de->d_name, ".") == 0 ||
+				strcmp(de->d_name, "..") == 0;
+		closedir(dp);
+	}
+	if (!empty)
+		return -EPROTO;
+	res = has_legacy(storage_dir, 1);
+	if (res != 0)
+		return res > 0 ? -EPROTO : res;
+	return dp != NULL ? vstore_mark_layout(storage_dir) : 0;
+}
+
+int vstore_mark_layout(const char *storage_dir)
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 8];
+	char text[16];
+	int fd, len, res = 0;
+
+	snprintf(path, sizeof(path), "%s" VSTORE_LAYOUT, storage_dir);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	len = snprintf(text, sizeof(text), "%d\n", VSTORE_LAYOUT_VERSION);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		return -errno;
+	if (write(fd, text, len) == -1 || fsync(fd) == -1)
+		res = -errno;
+	close(fd);
+	if (res == 0 && rename(tmp, path) == -1)
+		res = -errno;
+	if (res < 0)
+		unlink(tmp);
+	return res;
+}
+
+void vstore_counter_path(char *out, const char *history_dir)
+{
+	if (snprintf(out, PATH_MAX, "%s/" VSTORE_COUNTER, history_dir) >= PATH_MAX)
+		out[0] = '\0';	/* Too long: names no file. */
+}
+
+int vstore_read_counter(const char *history_dir, int *vers_num)
+{
+	char path[PATH_MAX];
+	char num_str[16];
+	ssize_t res;
+	int fd;
+
+	vstore_counter_path(path, history_dir);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -errno;
+	memset(num_str, 0, sizeof(num_str));
+	res = pread(fd, num_str, sizeof(num_str) - 1, 0);
+	close(fd);
+	if (res == -1)
+		return -errno;
+	*vers_num = res == 0 ? -1 : atoi(num_str);
+	return 0;
+}
+
+void vstore_format_counter(char *num_str, size_t size, int vers_num)
+{
+	memset(num_str, 0, size);
+	snprintf(num_str, size, "%d", vers_num);
+}
+
+int vstore_write_counter(const char *history_dir, int vers_num)
+{
+	char path[PATH_MAX];
+	char num_str[VSTORE_COUNTER_SIZE];
+	ssize_t res;
+	int fd;
+
+	vstore_counter_path(path, history_dir);
+	fd = open(path, O_WRONLY);
+	if (fd == -1)
+		return -errno;
+	vstore_format_counter(num_str, sizeof(num_str), vers_num);
+	res = pwrite(fd, num_str, sizeof(num_str), 0);
+	if (res == -1)
+		res = -errno;
+	close(fd);
+	return res < 0 ? res : 0;
+}
+
+void vstore_index_path(char *out, const char *history_dir)
+{
+	if (snprintf(out, PATH_MAX, "%s/" VSTORE_INDEX, history_dir) >= PATH_MAX)
+		out[0] = '\0';	/* Too long: names no file. */
+}
+
+int vstore_read_record(const char *history_dir, int vers_num,
+		       struct vstore_record *r)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	ssize_t res = 0;
+	int fd;
+
+	vstore_index_path(path, history_dir);
+	fd = open(path, O_RDONLY);
+	if (fd != -1) {
+		res = pread(fd, r, sizeof(*r), (off_t) vers_num * sizeof(*r));
+		close(fd);
+	}
+	if (res == sizeof(*r) &&
+	    (r->kind == VSTORE_TRUNC || r->kind == VSTORE_APPEND))
+		return 0;
+
+	// No record: a full copy.
+	vstore_version_path(path, history_dir, vers_num);
+	if (stat(path, &st) == -1)
+		return -errno;
+	r->kind = VSTORE_FULL;
+	r->base = vers_num;
+	r->data_len = r->length = st.st_size;
+	return 0;
+}
+
+int vstore_write_record(const char *history_dir, int vers_num,
+			const struct vstore_record *r)
+{
+	char path[PATH_MAX];
+	struct vstore_record none;
+	struct stat st;
+	off_t off = (off_t) vers_num * sizeof(*r);
+	ssize_t res;
+	int fd;
+
+	vstore_index_path(path, history_dir);
+	if (r->kind == VSTORE_FULL) {
+		fd = open(path, O_WRONLY);
+		if (fd == -1)
+			return errno == ENOENT ? 0 : -errno;
+		// Past the end of the index every version is full already.
+		memset(&none, 0, sizeof(none));
+		res = 0;
+		if (fstat(fd, &st) == -1)
+			res = -errno;
+		else if (st.st_size > off)
+			res = pwrite(fd, &none, sizeof(none), off);
+	} else {
+		fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+		if (fd == -1)
+			return -errno;
+		res = pwrite(fd, r, sizeof(*r), off);
+	}
+	if (res == -1)
+		res = -errno;
+	else if (res > 0 && res != sizeof(*r))
+		res = -EIO;
+	close(fd);
+	return res < 0 ? res : 0;
+}
+
+void vstore_sum_path(char *out, const char *version_path)
+{
+	const char *slash = strrchr(version_path, '/');
+	int dir_len = slash == NULL ? 0 : slash - version_path + 1;
+
+	if (snprintf(out, PATH_MAX, "%.*s.%s.sum", dir_len, version_path,
+		     version_path + dir_len) >= PATH_MAX)
+		out[0] = '\0';	/* Too long: names no file. */
+}
+
+int vstore_read_sums(const char *version_path, struct vstore_sum **sums,
+		     size_t *n)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	ssize_t res;
+	int fd;
+
+	vstore_sum_path(path, version_path);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -errno;
+	if (fstat(fd, &st) == -1) {
+		res = -errno;
+		close(fd);
+		return res;
+	}
+	*n = st.st_size / sizeof(**sums);
+	*sums = malloc(*n * sizeof(**sums) + 1);
+	if (*sums == NULL) {
+		close(fd);
+		return -ENOMEM;
+	}
+	res = pread(fd, *sums, *n * sizeof(**sums), 0);
+	if (res == -1)
+		res = -errno;
+	close(fd);
+	if (res >= 0 && res != *n * sizeof(**sums))
+		*n = res / sizeof(**sums);	/* Shrunk meanwhile. */
+	if (res < 0) {
+		free(*sums);
+		return res;
+	}
+	return 0;
+}
+
+int vstore_write_sums(const char *version_path, const struct vstore_sum *sums,
+		      size_t from, size_t n)
+{
+	char path[PATH_MAX];
+	ssize_t res, want = (n - from) * sizeof(*sums);
+	int fd;
+
+	vstore_sum_path(path, version_path);
+	fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		return -errno;
+	res = pwrite(fd, sums + from, want, from * sizeof(*sums));
+	if (res == -1)
+		res = -errno;
+	else if (res != want)
+		res = -EIO;
+	else if (ftruncate(fd, n * sizeof(*sums)) == -1)
+		res = -errno;
+	close(fd);
+	return res < 0 ? res : 0;
+}
+
+int vstore_sum_file(const char *version_path, off_t off)
+{
+	size_t mark = arena_mark();
+	struct vstore_sum *sums;
+	unsigned char *buf = arena_alloc(VSTORE_CHUNK);
+	struct stat st;
+	size_t from = off / VSTORE_CHUNK, n, i;
+	int fd, res = 0;
+
+	fd = open(version_path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		res = -errno;
+		goto out;
+	}
+	n = (st.st_size + VSTORE_CHUNK - 1) / VSTORE_CHUNK;
+	sums = arena_alloc(n * sizeof(*sums));
+	if (buf == NULL || sums == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	for (i = from; i < n && res == 0; i += 1) {
+		ssize_t len = pread(fd, buf, VSTORE_CHUNK, (off_t) i * VSTORE_CHUNK);
+		if (len <= 0) {
+			res = len == 0 ? -EIO : -errno;
+			break;
+		}
+		sums[i].crc = crc32c(0, buf, len);
+		sums[i].len = len;
+	}
+	if (res == 0 && from < n)
+		res = vstore_write_sums(version_path, sums, from, n);
+ out:
+	if (fd != -1)
+		close(fd);
+	arena_release(mark);
+	return res;
+}
+
+int vstore_check_chunk(const struct vstore_sum *sum, const void *data,
+		       size_t avail)
+{
+	if (sum->len == 0)
+		return 0;
+	if (avail < sum->len || crc32c(0, data, sum->len) != sum->crc)
+		return -EIO;
+	return 0;
+}
+
+int vstore_verify(const char *version_path, int (*pace)(size_t bytes),
+		  off_t *bad_off)
+{
+	size_t mark = arena_mark();
+	unsigned char *buf = arena_alloc(VSTORE_CHUNK);
+	struct vstore_sum *sums;
+	size_t n, i;
+	int fd, res;
+
+	if (buf == NULL)
+		return -ENOMEM;
+	res = vstore_read_sums(version_path, &sums, &n);
+	if (res < 0) {
+		arena_release(mark);
+		return res;
+	}
+	fd = open(version_path, O_RDONLY);
+	if (fd == -1)
+		res = -errno;
+	for (i = 0; i < n && res == 0; i += 1) {
+		ssize_t len;
+		if (sums[i].len == 0)
+			continue;
+		len = pread(fd, buf, sums[i].len, (off_t) i * VSTORE_CHUNK);
+		if (len == -1) {
+			res = -errno;
+			break;
+		}
+		if (vstore_check_chunk(&sums[i], buf, len) < 0) {
+			*bad_off = (off_t) i * VSTORE_CHUNK;
+			res = -EIO;
+			break;
+		}
+		if (pace != NULL && pace(len) != 0)
+			break;
+	}
+	if (fd != -1)
+		close(fd);
+	free(sums);
+	arena_release(mark);
+	return res;
+}
+
+/* Copy a byte range the slow way, for when copy_file_range() is unavailable
+   between the two files. */
+static int copy_range_rw(int in_fd, int out_fd, off_t off, off_t end)
+{
+	size_t chunk = 1024 * 1024;
+	size_t mark = arena_mark();
+	char *buf = arena_alloc(chunk);
+	int res = 0;
+
+	if (buf == NULL)
+		return -ENOMEM;
+	while (off < end) {
+		ssize_t n = pread(in_fd, buf,
+				  end - off < chunk ? end - off : chunk, off);
+		if (n <= 0) {
+			res = n == 0 ? 0 : -errno;
+			break;
+		}
+		if (pwrite(out_fd, buf, n, off) != n) {
+			res = -errno;
+			break;
+		}
+		off += n;
+	}
+	arena_release(mark);
+	return res;
+}
+
+int vstore_copy_sparse(int in_fd, int out_fd, off_t size)
+{
+	return vstore_copy_sparse_range(in_fd, out_fd, 0, size);
+}
+
+int vstore_copy_sparse_range(int in_fd, int out_fd, off_t off, off_t size)
+{
+	off_t data = off;
+
+	while (data < size) {
+		off_t hole, in_off, out_off;
+
+		data = lseek(in_fd, data, SEEK_DATA);
+		if (data == -1) {
+			if (errno == ENXIO)
+				break;		/* Only a hole is left. */
+			return -errno;
+		}
+		if (data >= size)
+			break;
+		hole = lseek(in_fd, data, SEEK_HOLE);
+		if (hole == -1)
+			return -errno;
+		if (hole > size)
+			hole = size;
+
+		in_off = out_off = data;
+		while (in_off < hole) {
+			ssize_t n = copy_file_range(in_fd, &in_off, out_fd,
+						    &out_off, hole - in_off, 0);
+			if (n == -1 && (errno == EXDEV || errno == ENOSYS ||
+					errno == EINVAL || errno == EOPNOTSUPP)) {
+				int res = copy_range_rw(in_fd, out_fd, in_off, hole);
+				if (res < 0)
+					return res;
+				break;
+			}
+			if (n == -1)
+				return -errno;
+			if (n == 0)
+				break;
+		}
+		data = hole;
+	}
+
+	// Trailing holes (and a file that is all hole) only need the length.
+	if (ftruncate(out_fd, size) == -1)
+		return -errno;
+	return 0;
+}
+
+int vstore_open_version(const char *history_dir, int vers_num, struct stat *st)
+{
+	char path[PATH_MAX];
+	struct vstore_record r;
+	int in_fd, fd, res;
+
+	vstore_version_path(path, history_dir, vers_num);
+	if (stat(path, st) == -1)
+		return -errno;
+	res = vstore_read_record(history_dir, vers_num, &r);
+	if (res < 0)
+		return res;
+	if (r.kind == VSTORE_FULL) {
+		fd = open(path, O_RDONLY);
+		return fd == -1 ? -errno : fd;
+	}
+
+	// Put together next to the history, so that the data can be shared
+	// with the base rather than copied where the file system allows.
+	vstore_version_path(path, history_dir, r.base);
+	in_fd = open(path, O_RDONLY);
+	if (in_fd == -1)
+		return -errno;
+#ifdef O_TMPFILE
+	fd = open(history_dir, O_RDWR | O_TMPFILE, S_IRUSR | S_IWUSR);
+#else
+	fd = -1;
+	errno = EOPNOTSUPP;
+#endif
+	if (fd == -1 && (errno == EOPNOTSUPP || errno == EISDIR ||
+			 errno == EINVAL)) {
+		snprintf(path, sizeof(path), "%s/.tmpXXXXXX", history_dir);
+		fd = mkstemp(path);
+		if (fd != -1)
+			unlink(path);
+	}
+	if (fd == -1) {
+		res = -errno;
+		close(in_fd);
+		return res;
+	}
+	res = vstore_copy_sparse(in_fd, fd, r.data_len);
+	if (res == 0 && ftruncate(fd, r.length) == -1)
+		res = -errno;
+	close(in_fd);
+	if (res < 0) {
+		close(fd);
+		return res;
+	}
+	st->st_size = r.length;
+	return fd;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Restore */
+
+/* Make dst a file with the contents of src: sharing src's extents if the
+   file system can clone them, or else a sparse copy. */
+static int clone_file(const char *src, const char *dst, mode_t mode)
+{
+	struct stat st;
+	int in_fd, out_fd, res;
+
+	in_fd = open(src, O_RDONLY);
+	if (in_fd == -1)
+		return -errno;
+	out_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (out_fd == -1) {
+		res = -errno;
+		close(in_fd);
+		return res;
+	}
+
+#ifdef FICLONE
+	res = ioctl(out_fd, FICLONE, in_fd) == -1 ? -errno : 0;
+#else
+	res = -EOPNOTSUPP;
+#endif
+	if (res < 0) {
+		if (fstat(in_fd, &st) == -1)
+			res = -errno;
+		else
+			res = vstore_copy_sparse(in_fd, out_fd, st.st_size);
+	}
+	if (close(out_fd) == -1 && res == 0)
+		res = -errno;
+	close(in_fd);
+	if (res < 0)
+		unlink(dst);
+	return res;
+}
+
+/* The version of the history in history_dir that was current at time when:
+   the last one made at or before it.  Versions are numbered in the order
+   they were made, so the scan stops at the first one made later. */
+static int version_at(const char *history_dir, int newest, time_t when)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int found = -ENOENT;
+	int n;
+
+	for (n = 0; n <= newest; n += 1) {
+		vstore_version_path(path, history_dir, n);
+		if (stat(path, &st) == -1)
+			continue;
+		if (st.st_mtime > when)
+			break;
+		found = n;
+	}
+	return found;
+}
+
+/* restore_file(), with the file's lock held. */
+static int restore_locked(const char *storage_dir, const char *path,
+			  const char *spec)
+{
+	char live[PATH_MAX];
+	char history_dir[PATH_MAX];
+	char src[PATH_MAX];
+	char dst[PATH_MAX];
+	char tmp[PATH_MAX + 16];
+	struct vstore_record r;
+	struct stat st;
+	char *end;
+	int newest, n, fd, res;
+
+	snprintf(live, sizeof(live), "%s%s", storage_dir, path);
+	if (lstat(live, &st) == -1)
+		return -errno;
+	if (!S_ISREG(st.st_mode))
+		return -EINVAL;
+
+	vstore_history_dir(history_dir, storage_dir, path);
+	res = vstore_read_counter(history_dir, &newest);
+	if (res < 0)
+		return res;
+
+	if (spec[0] == '@') {
+		long long when = strtoll(spec + 1, &end, 10);
+		if (spec[1] == '\0' || *end != '\0')
+			return -EINVAL;
+		n = version_at(history_dir, newest, (time_t) when);
+		if (n < 0)
+			return n;
+	} else {
+		n = strtol(spec, &end, 10);
+		if (spec[0] == '\0' || *end != '\0' || n < 0 || n > newest)
+			return -EINVAL;
+	}
+	res = vstore_read_record(history_dir, n, &r);
+	if (res < 0)
+		return res;
+	vstore_version_path(src, history_dir, r.base);
+
+	// The new contents are put together next to the history, on the same
+	// file system as the live file, and renamed over it in one step.  A
+	// length change or an append is its base cut to length.
+	snprintf(tmp, sizeof(tmp), "%s/.restore", history_dir);
+	unlink(tmp);
+	res = clone_file(src, tmp, st.st_mode & 07777);
+	if (res == 0 && r.kind != VSTORE_FULL &&
+	    (truncate(tmp, r.data_len) == -1 || truncate(tmp, r.length) == -1)) {
+		res = -errno;
+		unlink(tmp);
+	}
+	if (res < 0)
+		return res;
+	// Best effort: only a privileged daemon can give files away.
+	chown(tmp, st.st_uid, st.st_gid);
+	if (rename(tmp, live) == -1) {
+		res = -errno;
+		unlink(tmp);
+		return res;
+	}
+
+	// Record the restore as the newest version: the same record, if the
+	// version has one, or else a reference to the whole of the full
+	// version, so that no data is copied.  Its <N> is a new, empty
+	// placeholder, which keeps the time of the restore rather than that of
+	// the version.
+	if (r.kind == VSTORE_FULL)
+		r.kind = VSTORE_TRUNC;
+	vstore_version_path(dst, history_dir, newest + 1);
+	unlink(dst);
+	vstore_sum_path(tmp, dst);
+	unlink(tmp);
+	res = vstore_write_record(history_dir, newest + 1, &r);
+	if (res < 0)
+		return res;
+	fd = vstore_create(dst, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return fd;
+	close(fd);
+	return vstore_write_counter(history_dir, newest + 1);
+}
+
+/* Restore the file path to the version given by spec, with the file's lock
+   held from reading its counter to counting the restore as a version. */
+static int restore_file(const char *storage_dir, const char *path,
+			const char *spec, vstore_lock_fn lock,
+			vstore_lock_fn unlock)
+{
+	char live[PATH_MAX];
+	int res;
+
+	snprintf(live, sizeof(live), "%s%s", storage_dir, path);
+	if (lock != NULL)
+		lock(live);
+	res = restore_locked(storage_dir, path, spec);
+	if (unlock != NULL)
+		unlock(live);
+	return res;
+}
+
+/* Restore every file with a history below history_dir (the history of the
+   directory path) to the version current at the time in spec. */
+static int restore_tree(const char *storage_dir, const char *history_dir,
+			const char *path, const char *spec,
+			vstore_lock_fn lock, vstore_lock_fn unlock)
+{
+	char counter[PATH_MAX];
+	char child_dir[PATH_MAX];
+	char child_path[PATH_MAX];
+	struct dirent *de;
+	DIR *dp;
+	int res = 0;
+
+	vstore_counter_path(counter, history_dir);
+	if (access(counter, F_OK) == 0) {
+		res = restore_file(storage_dir, path, spec, lock, unlock);
+		// Files made after that time, or since deleted, stay as they are.
+		return res == -ENOENT ? 0 : res;
+	}
+
+	dp = opendir(history_dir);
+	if (dp == NULL)
+		return -errno;
+	while ((de = readdir(dp)) != NULL) {
+		int child_res;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+			continue;
+		snprintf(child_dir, sizeof(child_dir), "%s/%s", history_dir,
+			 de->d_name);
+		snprintf(child_path, sizeof(child_path), "%s/%s", path, de->d_name);
+		child_res = restore_tree(storage_dir, child_dir, child_path, spec,
+					 lock, unlock);
+		// Carry on with the rest, reporting the first failure.
+		if (child_res < 0 && res == 0)
+			res = child_res;
+	}
+	closedir(dp);
+	return res;
+}
+
+/* The namespace side of a restore, from the log of oplog.h: directories and
+   symbolic links that have gone are made again before the files are
+   restored, and permissions and owners are put back afterwards.  Files
+   that have gone cannot come back, as their history went with them. */
+struct namespace_restore {
+	const char *storage_dir;
+	int res;
+};
+
+static int restore_entry(const struct oplog_entry *e, void *arg)
+{
+	struct namespace_restore *nr = arg;
+	char live[PATH_MAX];
+	struct stat st;
+	int res;
+
+	snprintf(live, sizeof(live), "%s%s", nr->storage_dir, e->path);
+	if (lstat(live, &st) == 0 || errno != ENOENT)
+		return 0;
+
+	oplog_lock();
+	if (S_ISDIR(e->mode)) {
+		// Writable until restore_attrs() gives it its own mode.
+		res = mkdir(live, S_IRWXU);
+		if (res == 0)
+			oplog_record(OPLOG_MKDIR, live, NULL);
+	} else if (S_ISLNK(e->mode) && e->target != NULL) {
+		res = symlink(e->target, live);
+		if (res == 0)
+			oplog_record(OPLOG_SYMLINK, live, NULL);
+	} else {
+		res = 0;
+	}
+	if (res == -1 && nr->res == 0)
+		nr->res = -errno;
+	oplog_unlock();
+	return 0;
+}
+
+static int restore_attrs(const struct oplog_entry *e, void *arg)
+{
+	struct namespace_restore *nr = arg;
+	char live[PATH_MAX];
+	struct stat st;
+	int changed = 0;
+
+	snprintf(live, sizeof(live), "%s%s", nr->storage_dir, e->path);
+	if (lstat(live, &st) == -1 ||
+	    (st.st_mode & S_IFMT) != (e->mode & S_IFMT))
+		return 0;
+
+	oplog_lock();
+	if (!S_ISLNK(e->mode) && (st.st_mode & 07777) != (e->mode & 07777)) {
+		if (chmod(live, e->mode & 07777) == 0)
+			changed = 1;
+		else if (nr->res == 0)
+			nr->res = -errno;
+	}
+	// Best effort: only a privileged daemon can give files away.
+	if ((st.st_uid != e->uid || st.st_gid != e->gid) &&
+	    lchown(live, e->uid, e->gid) == 0)
+		changed = 1;
+	if (changed)
+		oplog_record(OPLOG_SETATTR, live, NULL);
+	oplog_unlock();
+	return 0;
+}
+
+int vstore_restore(const char *storage_dir, const char *path, const char *spec,
+		   vstore_lock_fn lock, vstore_lock_fn unlock)
+{
+	char live[PATH_MAX];
+	char history_dir[PATH_MAX];
+	struct namespace_restore nr = { storage_dir, 0 };
+	struct oplog_tree *tree = NULL;
+	struct stat st;
+	char *end;
+	int res;
+
+	snprintf(live, sizeof(live), "%s%s", storage_dir, path);
+	if (lstat(live, &st) == -1)
+		return -errno;
+	if (spec[0] == '@') {
+		long long when = strtoll(spec + 1, &end, 10);
+		if (spec[1] == '\0' || *end != '\0')
+			return -EINVAL;
+		// Stores without a namespace log get their contents back only.
+		tree = oplog_replay(storage_dir, (time_t) when);
+		if (tree == NULL && errno != ENOENT)
+			return -errno;
+	}
+	if (tree != NULL)
+		oplog_walk(tree, path, 0, restore_entry, &nr);
+
+	if (!S_ISDIR(st.st_mode))
+		res = restore_file(storage_dir, path, spec, lock, unlock);
+	else if (spec[0] != '@')
+		res = -EINVAL;
+	else {
+		vstore_history_dir(history_dir, storage_dir,
+				   strcmp(path, "/") == 0 ? "" : path);
+		res = restore_tree(storage_dir, history_dir,
+				   strcmp(path, "/") == 0 ? "" : path, spec,
+				   lock, unlock);
+	}
+
+	if (tree != NULL) {
+		oplog_walk(tree, path, 1, restore_attrs, &nr);
+		oplog_tree_free(tree);
+	}
+	return res < 0 ? res : nr.res;
+}
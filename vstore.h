@@ -0,0 +1,199 @@
+/**
+ * \file vstore.h
+ * \date October 2026
+ *
+ * The on-disk layout of versfs histories, shared by versfs and verstool.
+ *
+ * The history of the file <path> (a path in the mount point) lives in the
+ * storage directory under .versfs/history/<path>/: one file per version,
+ * named <N>, and a counter file holding the newest version number.  The
+ * versions are spread over buckets of VSTORE_FANOUT by number, so <N> is
+ * <N / VSTORE_FANOUT>xxx/<N> there (1234 is 1xxx/1234) and no directory
+ * grows past a bucket's worth however long the history.  Storage
+ * directories made before the buckets keep every <N> in the history
+ * directory itself; .versfs/layout marks those that have them (see
+ * vstore_check_layout()).
+ *
+ * Most versions are full copies of the file.  A version made by truncate is
+ * instead recorded in the history's index as a length change: the first
+ * data_len bytes of an earlier, full version, then a hole up to its length.
+ * A restore is recorded the same way, with all of the old version's bytes.
+ * Such a version's <N> is an empty placeholder that keeps the time it was
+ * made.  The index holds one fixed-size record per version number; versions
+ * without a record, including every version from before the index existed,
+ * are full.
+ *
+ * A file that is only appended to keeps one base file for a run of
+ * versions: each append adds the new bytes to the end of the base, and the
+ * version is recorded as the first data_len bytes of it.  The base itself
+ * gets a record of its own length before anything is added to it.  Bytes
+ * already in a base never change, so every version made from it still
+ * reads the same.
+ *
+ * Every file that holds version data (a full version or a base) may have a
+ * hidden companion, .<N>.sum, with a checksum for each VSTORE_CHUNK bytes
+ * of it: the CRC-32C (crc32c.h) of the chunk's first len bytes.  A base's
+ * last checksum covers only what the base held when it was written, and is
+ * rewritten after each append; a chunk with len 0 has no checksum.
+ * Versions from before checksums existed have no companion.
+ */
+
+#ifndef VSTORE_H
+#define VSTORE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define VSTORE_DIR         "/.versfs"
+#define VSTORE_HISTORY_DIR VSTORE_DIR "/history"
+#define VSTORE_COUNTER     ".version_file.txt"
+#define VSTORE_INDEX       ".index"
+#define VSTORE_LAYOUT      VSTORE_DIR "/layout"
+
+/* Before the history tree, the versions of <file> were kept next to it in
+   the directory <file>__versions__. */
+#define VSTORE_LEGACY_SUFFIX "__versions__"
+
+/* Versions per bucket (one per xxx in its name), and the layout written to
+   VSTORE_LAYOUT. */
+#define VSTORE_FANOUT         1000
+#define VSTORE_LAYOUT_VERSION 2
+
+/* The history directory of path ("" or "/..." in the mount point) within
+   storage_dir.  out must hold PATH_MAX bytes, as must the outputs below.
+   A path that would not fit comes back empty. */
+void vstore_history_dir(char *out, const char *storage_dir, const char *path);
+
+void vstore_version_path(char *out, const char *history_dir, int vers_num);
+void vstore_counter_path(char *out, const char *history_dir);
+void vstore_index_path(char *out, const char *history_dir);
+
+/* Open version_path, from vstore_version_path(), with flags that include
+   O_CREAT, making its bucket if it is the first version there.  Returns a
+   descriptor or -errno. */
+int vstore_create(const char *version_path, int flags, mode_t mode);
+
+/* Make the bucket of version_path, if it has none.  Returns 0 or -errno. */
+int vstore_make_bucket(const char *version_path);
+
+/* Check that the histories in storage_dir are in buckets, marking a storage
+   directory with no histories yet as being so.  Returns 0, -EPROTO if
+   verstool migrate has to convert them first (including histories in
+   <file>VSTORE_LEGACY_SUFFIX directories), or -errno. */
+int vstore_check_layout(const char *storage_dir);
+
+/* Mark the histories in storage_dir as being in buckets.  Returns 0 or
+   -errno. */
+int vstore_mark_layout(const char *storage_dir);
+
+/* Read the newest version number of the history in history_dir into
+   *vers_num, -1 if it has none.  Returns 0 or -errno. */
+int vstore_read_counter(const char *history_dir, int *vers_num);
+
+/* The counter is written fixed width and NUL padded, so a shorter number
+   overwrites a longer one.  size is VSTORE_COUNTER_SIZE. */
+#define VSTORE_COUNTER_SIZE 16
+void vstore_format_counter(char *num_str, size_t size, int vers_num);
+int vstore_write_counter(const char *history_dir, int vers_num);
+
+/* How a version is stored, as kept in the index. */
+enum vstore_kind {
+	VSTORE_FULL = 0,	/* a copy of the file in <N> */
+	VSTORE_TRUNC = 1,	/* a length change; <N> is a placeholder */
+	VSTORE_APPEND = 2	/* a prefix of a base that appends extended */
+};
+
+struct vstore_record {
+	int32_t kind;		/* enum vstore_kind */
+	int32_t base;		/* the full version holding the data */
+	int64_t data_len;	/* bytes of base at the start of this version */
+	int64_t length;		/* size of this version; past data_len a hole */
+};
+
+/* Read how version vers_num of the history in history_dir is stored.  A
+   full version comes back as its own base, with data_len and length the
+   size of <N>.  Returns 0 or -errno. */
+int vstore_read_record(const char *history_dir, int vers_num,
+		       struct vstore_record *r);
+
+/* Record how version vers_num is stored, before it is counted.  Recording a
+   full version only clears a stale record, and makes no index if there is
+   none.  Returns 0 or -errno. */
+int vstore_write_record(const char *history_dir, int vers_num,
+			const struct vstore_record *r);
+
+/* Open version vers_num for reading, with its contents in full: <N> itself
+   for a full version, otherwise an unnamed temporary file put together from
+   its base.  *st is that of <N> (so its times are when the version was
+   made), with the size of the version.  Returns a descriptor or -errno. */
+int vstore_open_version(const char *history_dir, int vers_num, struct stat *st);
+
+#define VSTORE_CHUNK (64 * 1024)
+
+struct vstore_sum {
+	uint32_t crc;
+	uint32_t len;		/* bytes of the chunk covered, 0 for none */
+};
+
+/* The companion holding the checksums of the data file version_path. */
+void vstore_sum_path(char *out, const char *version_path);
+
+/* Read the checksums of the data file version_path into a new array of *n
+   entries, to be freed by the caller.  Returns 0, or -ENOENT if it has
+   none, or -errno. */
+int vstore_read_sums(const char *version_path, struct vstore_sum **sums,
+		     size_t *n);
+
+/* Store entries [from, n) of the checksums of version_path, keeping those
+   before from.  Returns 0 or -errno. */
+int vstore_write_sums(const char *version_path, const struct vstore_sum *sums,
+		      size_t from, size_t n);
+
+/* Checksum the data file version_path as it stands, from the chunk holding
+   byte off on.  Returns 0 or -errno. */
+int vstore_sum_file(const char *version_path, off_t off);
+
+/* Check one chunk, whose bytes start at data, of which avail are there.
+   Returns 0 if it matches its checksum (or has none), -EIO if not. */
+int vstore_check_chunk(const struct vstore_sum *sum, const void *data,
+		       size_t avail);
+
+/* Check the whole data file version_path against its checksums.  pace, if
+   not NULL, is called with the bytes read after each chunk, and stops the
+   check if it returns non-zero.  Returns 0, -ENOENT if the file has no
+   checksums, -EIO if a chunk does not match (its offset in *bad_off), or
+   -errno. */
+int vstore_verify(const char *version_path, int (*pace)(size_t bytes),
+		  off_t *bad_off);
+
+/* Copy the first size bytes of in_fd into the empty file out_fd, skipping
+   holes, so that a sparse file stays sparse in the copy.  Data extents go
+   through copy_file_range(), which file systems with reflinks turn into
+   shared extents.  Returns 0 or -errno. */
+int vstore_copy_sparse(int in_fd, int out_fd, off_t size);
+
+/* The same for the bytes from off up to size, copied to the same offsets
+   in out_fd, which must hold nothing past off. */
+int vstore_copy_sparse_range(int in_fd, int out_fd, off_t off, off_t size);
+
+/* Restore the storage file at path (a path in the mount point) to one of
+   its versions, given by spec: "<N>" for version N, or "@<T>" for the
+   version that was current at Unix time T.  If path is a directory, every
+   file below it with a version current at T is restored (spec must be a
+   time).  Each file is swapped for the version atomically with rename(),
+   a reflink of it where the file system supports them and otherwise a
+   sparse copy.  The restore is recorded as a new version that refers to
+   the old one's data in the index, with an empty <N> of its own that
+   keeps the time of the restore, so no version data is copied.  Given a
+   time, directories and symbolic links that have since gone are made
+   again, and modes and owners put back, as the namespace log (oplog.h) had
+   them.  Each file is restored between lock and unlock, given its storage
+   path, unless they are NULL: a mounted versfs takes the file's lock
+   (filelock.h) there, so that the restore and its commits get different
+   version numbers.  Returns 0 or -errno. */
+typedef void (*vstore_lock_fn)(const char *path);
+int vstore_restore(const char *storage_dir, const char *path, const char *spec,
+		   vstore_lock_fn lock, vstore_lock_fn unlock);
+
+#endif /* VSTORE_H */
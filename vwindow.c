@@ -0,0 +1,469 @@
+/**
+ * \file vwindow.c
+ * \date October 2026
+ *
+ * Windows in a hash table by storage path, like the fingerprints', and on
+ * a hashed timer wheel: a window closes window_ms after it opens, exactly
+ * as configured, and sits in the slot of the first tick at or after that,
+ * so opening and closing one costs the same however many are open, and
+ * each tick only looks at one slot.  One lock guards both.  Versions are
+ * stored without it, under the file's lock, so a window that is closing
+ * never holds up changes to other files.
+ *
+ * A window is on the wheel while it is open.  The turner takes a window
+ * that is due off the wheel; if nothing is noted, it ends there, and
+ * otherwise close_window() stores the version and puts it back.  A window
+ * off the wheel is being closed, and only close_window() and vwin_forget(),
+ * both under the file's lock, free it.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "filelock.h"
+#include "vwindow.h"
+
+#define VWIN_BUCKETS 1024
+
+/* Ticks in a window (a tick is 1 ms at least), so that it closes at most
+   1/VWIN_TICKS of a window late, and slots in the wheel, enough for a
+   window to fit one turn whatever its length. */
+#define VWIN_TICKS 32
+#define VWIN_SLOTS 64
+
+struct vwin {
+	char        *path;
+	long long    due;		/* ms after start_ms it closes at */
+	int          on_wheel;
+	int          pending;		/* changes noted since the last version */
+	off_t        lo;		/* ...to the bytes [lo, hi), */
+	off_t        hi;		/* or to any if hi is -1 */
+	int          error;		/* from storing a version */
+	struct vwin *hash_next;
+	struct vwin *slot_prev;
+	struct vwin *slot_next;
+};
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct vwin    *buckets[VWIN_BUCKETS];
+static struct vwin    *slots[VWIN_SLOTS];
+static size_t          num_open = 0;	/* on the wheel */
+static long long       turned = 0;	/* ticks gone round */
+static unsigned long long coalesced = 0;
+
+static unsigned        window_ms = 0;
+static unsigned        tick_ms = 1;
+static long long       start_ms = 0;
+static vwin_commit_fn  commit_fn = NULL;
+
+static pthread_cond_t  turner_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t       turner;
+static int             turner_started = 0;
+static int             turner_stop = 0;
+
+static unsigned hash_path(const char *path)
+{
+	unsigned h = 5381;
+
+	while (*path != '\0')
+		h = h * 33 + (unsigned char) *path++;
+	return h % VWIN_BUCKETS;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static long long now_tick(void)
+{
+	return (now_ms() - start_ms) / tick_ms;
+}
+
+/* The tick whose turn closes a window due at due: the first at or after
+   it. */
+static long long due_tick(long long due)
+{
+	return (due + tick_ms - 1) / tick_ms;
+}
+
+static struct vwin *table_find(const char *path)
+{
+	struct vwin *w;
+
+	for (w = buckets[hash_path(path)]; w != NULL; w = w->hash_next)
+		if (strcmp(w->path, path) == 0)
+			return w;
+	return NULL;
+}
+
+static void wheel_remove(struct vwin *w)
+{
+	if (!w->on_wheel)
+		return;
+	if (w->slot_prev != NULL)
+		w->slot_prev->slot_next = w->slot_next;
+	else
+		slots[due_tick(w->due) % VWIN_SLOTS] = w->slot_next;
+	if (w->slot_next != NULL)
+		w->slot_next->slot_prev = w->slot_prev;
+	w->slot_prev = w->slot_next = NULL;
+	w->on_wheel = 0;
+	num_open -= 1;
+}
+
+/* Open a window on w from now. */
+static void wheel_add(struct vwin *w)
+{
+	struct vwin **slot;
+
+	wheel_remove(w);
+	// A millisecond over, as now_ms() rounds down: never early.
+	w->due = now_ms() - start_ms + window_ms + 1;
+	slot = &slots[due_tick(w->due) % VWIN_SLOTS];
+	w->slot_prev = NULL;
+	w->slot_next = *slot;
+	if (*slot != NULL)
+		(*slot)->slot_prev = w;
+	*slot = w;
+	w->on_wheel = 1;
+	// The turner sleeps while the wheel is empty.
+	if (++num_open == 1)
+		pthread_cond_signal(&turner_wake);
+}
+
+/* Take w out of the table, and free it. */
+static void table_remove(struct vwin *w)
+{
+	struct vwin **pp = &buckets[hash_path(w->path)];
+
+	while (*pp != w)
+		pp = &(*pp)->hash_next;
+	*pp = w->hash_next;
+	wheel_remove(w);
+	free(w->path);
+	free(w);
+}
+
+static void note(struct vwin *w, off_t off, off_t len)
+{
+	if (!w->pending) {
+		w->pending = 1;
+		w->lo = off;
+		w->hi = len < 0 ? -1 : off + len;
+	} else if (len < 0 || w->hi < 0) {
+		w->hi = -1;
+	} else {
+		if (off < w->lo)
+			w->lo = off;
+		if (off + len > w->hi)
+			w->hi = off + len;
+	}
+}
+
+/* Store what the window on path has gathered.  It opens again if reopen
+   and a version was stored, or if storing one failed; otherwise it ends. */
+static int close_window(const char *path, int reopen)
+{
+	struct vwin *w;
+	off_t off, len;
+	int stored = 0;
+	int res = 0;
+
+	filelock_lock(path);
+	pthread_mutex_lock(&table_lock);
+	w = table_find(path);
+	if (w == NULL) {
+		pthread_mutex_unlock(&table_lock);
+		filelock_unlock(path);
+		return 0;
+	}
+	wheel_remove(w);
+	if (w->pending) {
+		off = w->lo;
+		len = w->hi < 0 ? -1 : w->hi - w->lo;
+		w->pending = 0;
+		pthread_mutex_unlock(&table_lock);
+		res = commit_fn(path, off, len);
+		pthread_mutex_lock(&table_lock);
+		if (res < 0) {
+			// Tried again when the window next closes, and
+			// reported to the next change meanwhile.
+			note(w, off, len);
+			w->error = res;
+		}
+		stored = res == 0;
+	}
+	if (w->pending || (reopen && stored))
+		wheel_add(w);
+	else
+		table_remove(w);
+	pthread_mutex_unlock(&table_lock);
+	filelock_unlock(path);
+	return res;
+}
+
+/* Close the windows in the slot of tick that are due: those with nothing
+   noted end, and the rest store a version.  Called with table_lock held,
+   which it lets go while storing. */
+static void turn_slot(long long tick)
+{
+	struct vwin *w, *next;
+	char **paths = NULL;
+	size_t n = 0, cap = 0;
+	size_t i;
+
+	for (w = slots[tick % VWIN_SLOTS]; w != NULL; w = next) {
+		next = w->slot_next;
+		// Later turns of the wheel.
+		if (due_tick(w->due) > tick)
+			continue;
+		if (!w->pending) {
+			table_remove(w);
+			continue;
+		}
+		wheel_remove(w);
+		if (n == cap) {
+			char **more;
+			cap = cap == 0 ? 16 : cap * 2;
+			more = realloc(paths, cap * sizeof(*paths));
+			if (more == NULL) {
+				// Put back, for the next tick.
+				wheel_add(w);
+				break;
+			}
+			paths = more;
+		}
+		paths[n] = strdup(w->path);
+		if (paths[n] == NULL) {
+			wheel_add(w);
+			break;
+		}
+		n += 1;
+	}
+	if (n == 0) {
+		free(paths);
+		return;
+	}
+
+	pthread_mutex_unlock(&table_lock);
+	for (i = 0; i < n; i += 1) {
+		// A failure stays with the window, for the next change.
+		close_window(paths[i], 1);
+		free(paths[i]);
+	}
+	free(paths);
+	pthread_mutex_lock(&table_lock);
+}
+
+static void *turner_main(void *arg)
+{
+	struct timespec deadline;
+	long long now, wait;
+
+	(void) arg;
+	pthread_mutex_lock(&table_lock);
+	while (!turner_stop) {
+		if (num_open == 0) {
+			pthread_cond_wait(&turner_wake, &table_lock);
+			continue;
+		}
+		// Until the next tick starts, rather than a tick from now, so
+		// that waking late does not add up.
+		wait = (turned + 1) * tick_ms - (now_ms() - start_ms);
+		if (wait > 0) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += wait / 1000;
+			deadline.tv_nsec += (wait % 1000) * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec += 1;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&turner_wake, &table_lock,
+					       &deadline);
+		}
+
+		// After a long sleep one turn covers every slot.
+		now = now_tick();
+		if (now - turned > VWIN_SLOTS)
+			turned = now - VWIN_SLOTS;
+		while (turned < now && !turner_stop) {
+			turned += 1;
+			turn_slot(turned);
+		}
+	}
+	pthread_mutex_unlock(&table_lock);
+	return NULL;
+}
+
+/* Started with the first window rather than at set-up, which in a FUSE
+   daemon runs before it forks into the background.  Called with
+   table_lock held. */
+static void start_turner(void)
+{
+	if (turner_started || turner_stop)
+		return;
+	turner_started = pthread_create(&turner, NULL, turner_main, NULL) == 0;
+	if (!turner_started) {
+		fprintf(stderr, "WARNING: No version window thread; every change "
+			"makes a version\n");
+		window_ms = 0;
+	}
+}
+
+/* Settle the windows whose paths match, all if prefix is NULL. */
+static int settle_many(const char *prefix)
+{
+	size_t len = prefix == NULL ? 0 : strlen(prefix);
+	char **paths = NULL;
+	size_t n = 0, cap = 0;
+	struct vwin *w;
+	size_t i;
+	int res = 0;
+
+	pthread_mutex_lock(&table_lock);
+	for (i = 0; i < VWIN_BUCKETS; i += 1) {
+		for (w = buckets[i]; w != NULL; w = w->hash_next) {
+			if (prefix != NULL && (strncmp(w->path, prefix, len) != 0 ||
+					       w->path[len] != '/'))
+				continue;
+			if (n == cap) {
+				char **more;
+				cap = cap == 0 ? 16 : cap * 2;
+				more = realloc(paths, cap * sizeof(*paths));
+				if (more == NULL) {
+					res = -ENOMEM;
+					break;
+				}
+				paths = more;
+			}
+			paths[n] = strdup(w->path);
+			if (paths[n] == NULL) {
+				res = -ENOMEM;
+				break;
+			}
+			n += 1;
+		}
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	for (i = 0; i < n; i += 1) {
+		int r = close_window(paths[i], 0);
+		if (r < 0 && res == 0)
+			res = r;
+		free(paths[i]);
+	}
+	free(paths);
+	return res;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void vwin_configure(unsigned ms, vwin_commit_fn commit)
+{
+	window_ms = ms;
+	tick_ms = ms / VWIN_TICKS > 0 ? ms / VWIN_TICKS : 1;
+	start_ms = now_ms();
+	commit_fn = commit;
+}
+
+int vwin_change(const char *path, off_t off, off_t len)
+{
+	struct vwin *w;
+	int res;
+
+	if (__atomic_load_n(&window_ms, __ATOMIC_RELAXED) == 0)
+		return 1;
+
+	pthread_mutex_lock(&table_lock);
+	w = table_find(path);
+	if (w != NULL) {
+		note(w, off, len);
+		res = w->error;
+		w->error = 0;
+		__atomic_add_fetch(&coalesced, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&table_lock);
+		return res;
+	}
+
+	// No window: stored now, and one opens.  Without memory for it, the
+	// change is stored all the same.
+	w = calloc(1, sizeof(*w));
+	if (w != NULL)
+		w->path = strdup(path);
+	if (w != NULL && w->path != NULL) {
+		w->hash_next = buckets[hash_path(path)];
+		buckets[hash_path(path)] = w;
+		wheel_add(w);
+		start_turner();
+	} else if (w != NULL) {
+		free(w);
+	}
+	pthread_mutex_unlock(&table_lock);
+	return 1;
+}
+
+int vwin_settle(const char *path)
+{
+	return window_ms == 0 ? 0 : close_window(path, 0);
+}
+
+int vwin_settle_tree(const char *dir)
+{
+	return window_ms == 0 ? 0 : settle_many(dir);
+}
+
+int vwin_settle_all(void)
+{
+	return window_ms == 0 ? 0 : settle_many(NULL);
+}
+
+void vwin_forget(const char *path)
+{
+	struct vwin *w;
+
+	pthread_mutex_lock(&table_lock);
+	w = table_find(path);
+	if (w != NULL)
+		table_remove(w);
+	pthread_mutex_unlock(&table_lock);
+}
+
+void vwin_shutdown(void)
+{
+	struct vwin *w;
+	size_t i;
+
+	pthread_mutex_lock(&table_lock);
+	turner_stop = 1;
+	pthread_cond_signal(&turner_wake);
+	pthread_mutex_unlock(&table_lock);
+	if (turner_started)
+		pthread_join(turner, NULL);
+	turner_started = 0;
+	settle_many(NULL);
+
+	// Whatever could not be stored.
+	pthread_mutex_lock(&table_lock);
+	for (i = 0; i < VWIN_BUCKETS; i += 1) {
+		while ((w = buckets[i]) != NULL) {
+			fprintf(stderr, "ERROR: %s: changes since its last version "
+				"were not stored\n", w->path);
+			table_remove(w);
+		}
+	}
+	pthread_mutex_unlock(&table_lock);
+}
+
+unsigned long long vwin_coalesced(void)
+{
+	return __atomic_load_n(&coalesced, __ATOMIC_RELAXED);
+}
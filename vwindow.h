@@ -0,0 +1,59 @@
+/**
+ * \file vwindow.h
+ * \date October 2026
+ *
+ * Version windows, which bound how many versions a file gets however fast
+ * it is written.  The first change to a file stores a version at once, as
+ * without windows, and opens a window on the file.  Changes while it is
+ * open are only noted, their byte ranges merged; when it closes, they are
+ * stored together as one version and another window opens.  A window that
+ * closes with nothing noted ends, and the next change is stored at once
+ * again.  So a file written in a tight loop gets a version as the loop
+ * starts, one per window while it runs, and one with what it left at most
+ * a window after it stops.
+ *
+ * Windows close on the turns of a timer wheel, driven by a thread of its
+ * own that sleeps while no window is open.
+ */
+
+#ifndef VWINDOW_H
+#define VWINDOW_H
+
+#include <sys/types.h>
+
+/* Store the file at the storage path path as a new version, of which only
+   the bytes [off, off + len) (len -1 for any) and the length can differ
+   from the newest.  Returns 0 or -errno. */
+typedef int (*vwin_commit_fn)(const char *path, off_t off, off_t len);
+
+/* Open windows of window_ms on files as they change, none if 0, and store
+   what they gather with commit, which is called with the file's lock
+   (filelock.h) held. */
+void vwin_configure(unsigned window_ms, vwin_commit_fn commit);
+
+/* Note a change to the bytes [off, off + len) of the file at path (len -1
+   for any), with its lock held.  Returns 1 if the caller is to store a
+   version now, 0 if the change waits for the window to close, or -errno
+   from a version the window failed to store (the change still waits, and
+   the version is tried again when the window closes). */
+int vwin_change(const char *path, off_t off, off_t len);
+
+/* Store what the window on path, those on the files below the directory
+   dir, or all of them, have gathered, and end them.  Called without the
+   files' locks, before the files change name or go back to a version.
+   Each returns 0 or the first error. */
+int vwin_settle(const char *path);
+int vwin_settle_tree(const char *dir);
+int vwin_settle_all(void);
+
+/* End the window on path without storing anything, with its lock held:
+   the file and its history are going. */
+void vwin_forget(const char *path);
+
+/* Settle every window and stop the thread. */
+void vwin_shutdown(void);
+
+/* Changes that waited for a window rather than making a version. */
+unsigned long long vwin_coalesced(void);
+
+#endif /* VWINDOW_H */
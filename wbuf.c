@@ -0,0 +1,410 @@
+/**
+ * \file wbuf.c
+ * \date October 2026
+ *
+ * Write buffers in a hash table by device and inode.  The table lock only
+ * guards finding, adding and removing buffers; each buffer has a lock of its
+ * own, held while it is filled or flushed, so flushing one file never holds
+ * up writes to another.  A background thread flushes buffers that have
+ * been held for the flush interval.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "wbuf.h"
+
+#define WBUF_BUCKETS 256
+#define WBUF_BATCH   64
+/* Idle buffers kept for reuse, so that writing one file after another does
+   not allocate and free a buffer for each. */
+#define WBUF_SPARE   32
+
+struct wbuf {
+	dev_t            dev;
+	ino_t            ino;
+	int              refs;		/* under table_lock */
+	int              busy;		/* holds data or an error */
+	pthread_mutex_t  lock;
+	/* The rest under lock; busy and since are also read without it, so
+	   they are written atomically. */
+	int              fd;		/* of the last writer */
+	char             path[PATH_MAX];
+	char            *data;
+	off_t            off;
+	size_t           len;
+	long long        since;		/* when the oldest data came in, in
+					   monotonic ms; 0 if none */
+	int              error;		/* from a background flush */
+	struct wbuf     *next;
+};
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct wbuf    *buckets[WBUF_BUCKETS];
+static struct wbuf    *spare = NULL;	/* under table_lock, by next */
+static int             num_spare = 0;
+/* Busy buffers: while there are none, flushing is a no-op. */
+static int             num_busy = 0;
+
+static size_t          max_bytes = 0;
+static unsigned        flush_ms = 1000;
+static wbuf_flush_fn   flush_fn = NULL;
+
+static pthread_cond_t  flusher_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t       flusher;
+static int             flusher_started = 0;
+static int             flusher_stop = 0;
+
+static unsigned hash_file(dev_t dev, ino_t ino)
+{
+	return (unsigned) (ino * 31 + dev) % WBUF_BUCKETS;
+}
+
+static int any_busy(void)
+{
+	return __atomic_load_n(&num_busy, __ATOMIC_ACQUIRE) > 0;
+}
+
+/* Called with b->lock held after len or error changes. */
+static void update_busy(struct wbuf *b)
+{
+	int busy = b->len > 0 || b->error != 0;
+
+	if (busy != b->busy) {
+		__atomic_store_n(&b->busy, busy, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&num_busy, busy ? 1 : -1, __ATOMIC_RELEASE);
+	}
+}
+
+/* The buffer of a file, held, or NULL.  Made if create. */
+static struct wbuf *wbuf_get(dev_t dev, ino_t ino, int create)
+{
+	struct wbuf **bucket = &buckets[hash_file(dev, ino)];
+	struct wbuf *b;
+
+	pthread_mutex_lock(&table_lock);
+	for (b = *bucket; b != NULL; b = b->next) {
+		if (b->dev == dev && b->ino == ino)
+			break;
+	}
+	if (b == NULL && create) {
+		// A spare one is as good as new: empty and without error.
+		if (spare != NULL) {
+			b = spare;
+			spare = b->next;
+			num_spare -= 1;
+		} else {
+			b = calloc(1, sizeof(*b));
+			if (b != NULL)
+				b->data = malloc(max_bytes);
+			if (b != NULL && b->data == NULL) {
+				free(b);
+				b = NULL;
+			}
+			if (b != NULL)
+				pthread_mutex_init(&b->lock, NULL);
+		}
+		if (b != NULL) {
+			b->dev = dev;
+			b->ino = ino;
+			b->next = *bucket;
+			*bucket = b;
+		}
+	}
+	if (b != NULL)
+		b->refs += 1;
+	pthread_mutex_unlock(&table_lock);
+	return b;
+}
+
+/* Let go of b; it is freed once nobody holds it and it has nothing in it. */
+static void wbuf_put(struct wbuf *b)
+{
+	struct wbuf **pp;
+
+	pthread_mutex_lock(&table_lock);
+	if (--b->refs == 0 && !__atomic_load_n(&b->busy, __ATOMIC_RELAXED)) {
+		pp = &buckets[hash_file(b->dev, b->ino)];
+		while (*pp != b)
+			pp = &(*pp)->next;
+		*pp = b->next;
+		if (num_spare < WBUF_SPARE) {
+			b->next = spare;
+			spare = b;
+			num_spare += 1;
+		} else {
+			pthread_mutex_destroy(&b->lock);
+			free(b->data);
+			free(b);
+		}
+	}
+	pthread_mutex_unlock(&table_lock);
+}
+
+/* Called with b->lock held. */
+static int take_error(struct wbuf *b)
+{
+	int res = b->error;
+
+	b->error = 0;
+	update_busy(b);
+	return res;
+}
+
+/* Called with b->lock held. */
+static int flush_locked(struct wbuf *b)
+{
+	int res;
+
+	if (b->len == 0)
+		return 0;
+	res = flush_fn(b->fd, b->path, b->data, b->len, b->off);
+	// Failed data is dropped, as the kernel does after a failed
+	// write-back; the error goes to whoever asks next.
+	b->len = 0;
+	__atomic_store_n(&b->since, 0, __ATOMIC_RELAXED);
+	update_busy(b);
+	return res;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + 1;	/* never 0 */
+}
+
+/* Safe without b->lock, as a hint. */
+static int is_old(struct wbuf *b, long long now)
+{
+	long long since = __atomic_load_n(&b->since, __ATOMIC_RELAXED);
+
+	return since != 0 && now - since >= flush_ms;
+}
+
+/* Flush every busy buffer, or (if old_only) every buffer whose data has
+   been held for the flush interval.  Failures are kept for later in the
+   buffers' error if old_only, and returned otherwise. */
+static int flush_many(int old_only)
+{
+	struct wbuf *batch[WBUF_BATCH];
+	long long now = now_ms();
+	struct wbuf *b;
+	unsigned i;
+	int n, j, res = 0;
+
+	for (i = 0; i < WBUF_BUCKETS; i += 1) {
+		// Taken a batch at a time; what is flushed no longer matches,
+		// so a long chain is gone through by going round again.
+		do {
+			n = 0;
+			pthread_mutex_lock(&table_lock);
+			for (b = buckets[i]; b != NULL && n < WBUF_BATCH; b = b->next) {
+				if (old_only ? is_old(b, now) :
+				    __atomic_load_n(&b->busy, __ATOMIC_RELAXED)) {
+					b->refs += 1;
+					batch[n++] = b;
+				}
+			}
+			pthread_mutex_unlock(&table_lock);
+
+			for (j = 0; j < n; j += 1) {
+				int r;
+
+				b = batch[j];
+				pthread_mutex_lock(&b->lock);
+				if (old_only) {
+					if (b->len > 0 && is_old(b, now)) {
+						r = flush_locked(b);
+						if (r < 0 && b->error == 0)
+							b->error = r;
+						update_busy(b);
+					}
+				} else {
+					r = take_error(b);
+					if (r == 0)
+						r = flush_locked(b);
+					if (r < 0 && res == 0)
+						res = r;
+				}
+				pthread_mutex_unlock(&b->lock);
+				wbuf_put(b);
+			}
+		} while (n == WBUF_BATCH);
+	}
+	return res;
+}
+
+static void *flusher_main(void *arg)
+{
+	struct timespec deadline;
+	unsigned tick = flush_ms / 2 > 0 ? flush_ms / 2 : 1;
+
+	(void) arg;
+	pthread_mutex_lock(&table_lock);
+	while (!flusher_stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += tick / 1000;
+		deadline.tv_nsec += (tick % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&flusher_wake, &table_lock, &deadline);
+		if (flusher_stop)
+			break;
+		pthread_mutex_unlock(&table_lock);
+		if (any_busy())
+			flush_many(1);
+		pthread_mutex_lock(&table_lock);
+	}
+	pthread_mutex_unlock(&table_lock);
+	return NULL;
+}
+
+/* Started on the first buffered write rather than at set-up, which in a
+   FUSE daemon runs before it forks into the background. */
+static void start_flusher(void)
+{
+	pthread_mutex_lock(&table_lock);
+	if (!flusher_started && !flusher_stop) {
+		flusher_started = pthread_create(&flusher, NULL, flusher_main,
+						 NULL) == 0;
+		if (!flusher_started)
+			fprintf(stderr, "WARNING: No write buffer flusher; buffers are "
+				"flushed on fsync and close only\n");
+		flusher_stop = !flusher_started;
+	}
+	pthread_mutex_unlock(&table_lock);
+}
+
+/* ------------------------------------------------------------------------ */
+
+void wbuf_configure(size_t max, unsigned ms, wbuf_flush_fn flush)
+{
+	max_bytes = max;
+	flush_ms = ms;
+	flush_fn = flush;
+}
+
+ssize_t wbuf_write(int fd, const char *path, const char *buf, size_t size,
+		   off_t off)
+{
+	struct stat st;
+	struct wbuf *b;
+	ssize_t res;
+
+	if (max_bytes == 0)
+		return 0;
+	if (size >= max_bytes) {
+		res = wbuf_flush_fd(fd);
+		return res < 0 ? res : 0;
+	}
+
+	if (fstat(fd, &st) == -1)
+		return -errno;
+	b = wbuf_get(st.st_dev, st.st_ino, 1);
+	if (b == NULL)
+		return 0;
+
+	pthread_mutex_lock(&b->lock);
+	res = take_error(b);
+	// The write must land inside the buffered range or just after it.
+	if (res == 0 && b->len > 0 &&
+	    (off < b->off || off > b->off + (off_t) b->len ||
+	     off + size - b->off > max_bytes))
+		res = flush_locked(b);
+	if (res == 0) {
+		if (b->len == 0) {
+			b->off = off;
+			__atomic_store_n(&b->since, now_ms(), __ATOMIC_RELAXED);
+		}
+		memcpy(b->data + (off - b->off), buf, size);
+		if (off + size - b->off > b->len)
+			b->len = off + size - b->off;
+		b->fd = fd;
+		snprintf(b->path, sizeof(b->path), "%s", path);
+		update_busy(b);
+		res = size;
+	}
+	pthread_mutex_unlock(&b->lock);
+	wbuf_put(b);
+
+	if (!flusher_started)
+		start_flusher();
+	return res;
+}
+
+static int flush_file(const struct stat *st)
+{
+	struct wbuf *b = wbuf_get(st->st_dev, st->st_ino, 0);
+	int res, flush_res;
+
+	if (b == NULL)
+		return 0;
+	pthread_mutex_lock(&b->lock);
+	res = take_error(b);
+	flush_res = flush_locked(b);
+	pthread_mutex_unlock(&b->lock);
+	wbuf_put(b);
+	return res < 0 ? res : flush_res;
+}
+
+int wbuf_flush_fd(int fd)
+{
+	struct stat st;
+
+	if (!any_busy())
+		return 0;
+	if (fstat(fd, &st) == -1)
+		return -errno;
+	return flush_file(&st);
+}
+
+int wbuf_flush_path(const char *path)
+{
+	struct stat st;
+
+	if (!any_busy())
+		return 0;
+	if (lstat(path, &st) == -1)
+		return errno == ENOENT ? 0 : -errno;
+	return flush_file(&st);
+}
+
+int wbuf_flush_all(void)
+{
+	return any_busy() ? flush_many(0) : 0;
+}
+
+void wbuf_shutdown(void)
+{
+	pthread_mutex_lock(&table_lock);
+	flusher_stop = 1;
+	pthread_cond_signal(&flusher_wake);
+	pthread_mutex_unlock(&table_lock);
+	if (flusher_started)
+		pthread_join(flusher, NULL);
+	flusher_started = 0;
+	wbuf_flush_all();
+
+	pthread_mutex_lock(&table_lock);
+	while (spare != NULL) {
+		struct wbuf *b = spare;
+		spare = b->next;
+		pthread_mutex_destroy(&b->lock);
+		free(b->data);
+		free(b);
+	}
+	num_spare = 0;
+	pthread_mutex_unlock(&table_lock);
+}
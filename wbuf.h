@@ -0,0 +1,48 @@
+/**
+ * \file wbuf.h
+ * \date October 2026
+ *
+ * Per-file write buffers.  Small writes to a file are gathered in memory
+ * and handed on together, so that a run of small appends costs one write
+ * to the backing file (and, in versfs, one new version) rather than one
+ * each.  A buffer holds one contiguous range of a file and is flushed when
+ * a write does not fit it, when it has been held for the flush interval,
+ * and whenever the caller asks: before anything else looks at the file,
+ * and on fsync, flush and release.
+ *
+ * Buffers belong to files (device and inode), not to open handles, so a
+ * write through one handle is flushed before a read through another.
+ */
+
+#ifndef WBUF_H
+#define WBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Write size bytes at off to the file open as fd, whose storage path is
+   path.  Returns 0 or -errno. */
+typedef int (*wbuf_flush_fn)(int fd, const char *path, const char *data,
+			     size_t size, off_t off);
+
+/* Buffer up to max_bytes per file, for at most flush_ms milliseconds, and
+   write buffers out with flush.  max_bytes of 0 turns buffering off. */
+void wbuf_configure(size_t max_bytes, unsigned flush_ms, wbuf_flush_fn flush);
+
+/* Buffer a write to the file open as fd.  Returns size if it was buffered,
+   0 if the caller must write it itself (anything buffered for the file has
+   then been flushed), or -errno if flushing failed.  An error from a flush
+   in the background is returned by the next call for the same file. */
+ssize_t wbuf_write(int fd, const char *path, const char *buf, size_t size,
+		   off_t off);
+
+/* Flush what is buffered for the file open as fd, or at path, or for every
+   file.  Each returns 0 or the first error. */
+int wbuf_flush_fd(int fd);
+int wbuf_flush_path(const char *path);
+int wbuf_flush_all(void);
+
+/* Flush everything and stop the background flusher. */
+void wbuf_shutdown(void);
+
+#endif /* WBUF_H */